@@ -24,6 +24,11 @@
  * =======================================================================
  */
 
+/* For recvmmsg() and sendmmsg() - must be before sys/socket.h include! */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+ #define _GNU_SOURCE
+#endif
+
 #include "../../common/header/common.h"
 
 #include <unistd.h>
@@ -43,13 +48,32 @@
 #include <errno.h>
 #include <arpa/inet.h>
 #include <net/if.h>
+#include <time.h>
+
+/* The dedicated server waits for its next frame in epoll_wait(),
+   woken up by its sockets, stdin or a timerfd armed with the
+   exact deadline. Elsewhere it's select() with a timeout. */
+#if defined(__linux__)
+ #define NET_USE_EPOLL
+ #include <sys/epoll.h>
+ #include <sys/timerfd.h>
+#endif
 
 netadr_t net_local_adr;
 
 #define LOOPBACK 0x7f000001
-#define MAX_LOOPBACK 4
+#define MAX_LOOPBACK 64 /* room for a fragmented message */
 #define QUAKE2MCAST "ff12::666"
 
+/* Datagrams are received and sent up to NET_BATCH at a time.
+   Where recvmmsg() and sendmmsg() are available that's a
+   single system call per batch. */
+#if defined(__linux__) || defined(__FreeBSD__)
+ #define NET_USE_MMSG
+#endif
+
+#define NET_BATCH 32
+
 typedef struct
 {
 	byte data[MAX_MSGLEN];
@@ -62,11 +86,54 @@ typedef struct
 	int get, send;
 } loopback_t;
 
+/* Datagrams read from one socket but not yet
+   handed out by NET_GetPacket() */
+typedef struct
+{
+	byte data[NET_BATCH][MAX_MSGLEN];
+	int lengths[NET_BATCH];
+	struct sockaddr_storage from[NET_BATCH];
+	int count, next;
+} netrecvring_t;
+
+/* Server datagram waiting for NET_FlushPackets() */
+typedef struct
+{
+	int socket;
+	struct sockaddr_storage addr;
+	int addr_size;
+	netadr_t to;
+	int length;
+	byte data[MAX_MSGLEN];
+} netsendslot_t;
+
 loopback_t loopbacks[2];
 int ip_sockets[2];
 int ip6_sockets[2];
 int ipx_sockets[2];
 char *multicast_interface = NULL;
+netstats_t net_stats;
+
+static netrecvring_t net_recvrings[2][3]; /* [netsrc_t][protocol] */
+static netsendslot_t net_sendqueue[NET_BATCH];
+static int net_numqueued;
+
+#ifdef NET_USE_EPOLL
+/* Descriptors NET_Sleep() waits for, the timer is
+   registered once, the others whenever they change */
+enum
+{
+	NET_WAIT_STDIN,
+	NET_WAIT_IP,
+	NET_WAIT_IP6,
+	NET_WAIT_TIMER
+};
+
+static int net_epollfd = -1;
+static int net_timerfd = -1;
+static qboolean net_epollfailed;
+static int net_waitfds[NET_WAIT_TIMER] = {-1, -1, -1};
+#endif
 
 static int NET_Socket(char *net_interface, int port, netsrc_t type, int family);
 static const char *NET_ErrorString(void);
@@ -512,15 +579,86 @@ NET_SendLoopPacket(netsrc_t sock, int length, void *data, netadr_t to)
 	loop->msgs[i].datalen = length;
 }
 
-qboolean
-NET_GetPacket(netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message)
+/*
+ * Reads as many datagrams as are waiting on the socket,
+ * up to NET_BATCH, into the ring. Returns false if
+ * there was nothing to read.
+ */
+static qboolean
+NET_FillRecvRing(int net_socket, netrecvring_t *ring)
 {
 	int ret;
-	struct sockaddr_storage from;
+	int err;
+	netadr_t from;
+#ifdef NET_USE_MMSG
+	struct mmsghdr hdrs[NET_BATCH];
+	struct iovec iov[NET_BATCH];
+	int i;
+
+	memset(hdrs, 0, sizeof(hdrs));
+
+	for (i = 0; i < NET_BATCH; i++)
+	{
+		iov[i].iov_base = ring->data[i];
+		iov[i].iov_len = sizeof(ring->data[i]);
+		hdrs[i].msg_hdr.msg_name = &ring->from[i];
+		hdrs[i].msg_hdr.msg_namelen = sizeof(ring->from[i]);
+		hdrs[i].msg_hdr.msg_iov = &iov[i];
+		hdrs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	ret = recvmmsg(net_socket, hdrs, NET_BATCH, MSG_DONTWAIT, NULL);
+	net_stats.recv_calls++;
+
+	if (ret > 0)
+	{
+		for (i = 0; i < ret; i++)
+		{
+			ring->lengths[i] = hdrs[i].msg_len;
+		}
+	}
+#else
 	socklen_t fromlen;
+
+	fromlen = sizeof(ring->from[0]);
+	ret = recvfrom(net_socket, ring->data[0], sizeof(ring->data[0]),
+			0, (struct sockaddr *)&ring->from[0], &fromlen);
+	net_stats.recv_calls++;
+
+	if (ret >= 0)
+	{
+		ring->lengths[0] = ret;
+		ret = 1;
+	}
+#endif
+
+	if (ret == -1)
+	{
+		err = errno;
+
+		if ((err != EWOULDBLOCK) && (err != EAGAIN) && (err != ECONNREFUSED))
+		{
+			SockadrToNetadr(&ring->from[0], &from);
+			Com_Printf("%s: %s from %s\n", NET_ErrorString(),
+					__func__, NET_AdrToString(from));
+		}
+
+		return false;
+	}
+
+	ring->count = ret;
+	ring->next = 0;
+
+	return ret > 0;
+}
+
+static qboolean
+NET_ReadPacket(netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message)
+{
+	netrecvring_t *ring;
 	int net_socket;
 	int protocol;
-	int err;
+	int i;
 
 	if (NET_GetLoopPacket(sock, net_from, net_message))
 	{
@@ -547,47 +685,177 @@ NET_GetPacket(netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message)
 			continue;
 		}
 
-		fromlen = sizeof(from);
-		ret = recvfrom(net_socket, net_message->data, net_message->maxsize,
-				0, (struct sockaddr *)&from, &fromlen);
-
-		SockadrToNetadr(&from, net_from);
+		ring = &net_recvrings[sock][protocol];
 
-		if (ret == -1)
+		while (true)
 		{
-			err = errno;
+			if ((ring->next >= ring->count) &&
+				!NET_FillRecvRing(net_socket, ring))
+			{
+				break;
+			}
+
+			i = ring->next++;
+			net_stats.packets_received++;
+
+			SockadrToNetadr(&ring->from[i], net_from);
 
-			if ((err == EWOULDBLOCK) || (err == ECONNREFUSED))
+			if ((ring->lengths[i] >= MAX_MSGLEN) ||
+				(ring->lengths[i] > net_message->maxsize))
 			{
+				Com_Printf("Oversize packet from %s\n", NET_AdrToString(*net_from));
 				continue;
 			}
 
-			Com_Printf("%s: %s from %s\n", NET_ErrorString(),
-					__func__, NET_AdrToString(*net_from));
-			continue;
+			memcpy(net_message->data, ring->data[i], ring->lengths[i]);
+			net_message->cursize = ring->lengths[i];
+			return true;
 		}
+	}
 
-		if (ret == net_message->maxsize)
+	return false;
+}
+
+/*
+ * Returns the next datagram for sock. Everything read
+ * goes through the impairment simulator first.
+ */
+qboolean
+NET_GetPacket(netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message)
+{
+	while (NET_ReadPacket(sock, net_from, net_message))
+	{
+		if (!NET_SimReceivedPacket(sock, *net_from, net_message))
 		{
-			Com_Printf("Oversize packet from %s\n", NET_AdrToString(*net_from));
-			continue;
+			return true;
 		}
+	}
 
-		net_message->cursize = ret;
-		return true;
+	return NET_SimGetPacket(sock, net_from, net_message);
+}
+
+/*
+ * Hands a datagram to the system, or queues it if it's from the
+ * server. Queued datagrams are sent by NET_FlushPackets().
+ */
+static void
+NET_SendTo(netsrc_t sock, int net_socket, int length, void *data,
+		const struct sockaddr_storage *addr, int addr_size, netadr_t to)
+{
+	netsendslot_t *slot;
+	int ret;
+
+	if ((sock == NS_SERVER) && (length <= MAX_MSGLEN))
+	{
+		if (net_numqueued == NET_BATCH)
+		{
+			NET_FlushPackets();
+		}
+
+		slot = &net_sendqueue[net_numqueued++];
+		slot->socket = net_socket;
+		slot->addr = *addr;
+		slot->addr_size = addr_size;
+		slot->to = to;
+		slot->length = length;
+		memcpy(slot->data, data, length);
+
+		return;
 	}
 
-	return false;
+	ret = sendto(net_socket, data, length, 0,
+			(const struct sockaddr *)addr, addr_size);
+	net_stats.send_calls++;
+
+	if (ret == -1)
+	{
+		Com_Printf("%s ERROR: %s to %s\n", NET_ErrorString(),
+				__func__, NET_AdrToString(to));
+		return;
+	}
+
+	net_stats.packets_sent++;
+}
+
+/*
+ * Sends the queued server datagrams, batching all that
+ * go out through the same socket in a row.
+ */
+void
+NET_FlushPackets(void)
+{
+	netsendslot_t *slot;
+	int first, ret;
+#ifdef NET_USE_MMSG
+	struct mmsghdr hdrs[NET_BATCH];
+	struct iovec iov[NET_BATCH];
+	int count;
+#endif
+
+	first = 0;
+
+	while (first < net_numqueued)
+	{
+		slot = &net_sendqueue[first];
+
+#ifdef NET_USE_MMSG
+		memset(hdrs, 0, sizeof(hdrs));
+
+		for (count = 0; first + count < net_numqueued; count++)
+		{
+			netsendslot_t *s = &net_sendqueue[first + count];
+
+			if (s->socket != slot->socket)
+			{
+				break;
+			}
+
+			iov[count].iov_base = s->data;
+			iov[count].iov_len = s->length;
+			hdrs[count].msg_hdr.msg_name = &s->addr;
+			hdrs[count].msg_hdr.msg_namelen = s->addr_size;
+			hdrs[count].msg_hdr.msg_iov = &iov[count];
+			hdrs[count].msg_hdr.msg_iovlen = 1;
+		}
+
+		ret = sendmmsg(slot->socket, hdrs, count, 0);
+#else
+		ret = sendto(slot->socket, slot->data, slot->length, 0,
+				(struct sockaddr *)&slot->addr, slot->addr_size);
+		ret = (ret == -1) ? -1 : 1;
+#endif
+		net_stats.send_calls++;
+
+		if (ret <= 0)
+		{
+			/* the first datagram of the batch failed, skip it */
+			Com_Printf("%s ERROR: %s to %s\n", NET_ErrorString(),
+					__func__, NET_AdrToString(slot->to));
+			ret = 1;
+		}
+		else
+		{
+			net_stats.packets_sent += ret;
+		}
+
+		first += ret;
+	}
+
+	net_numqueued = 0;
 }
 
 void
 NET_SendPacket(netsrc_t sock, int length, void *data, netadr_t to)
 {
-	int ret;
 	struct sockaddr_storage addr;
 	int net_socket;
 	int addr_size = sizeof(struct sockaddr_in);
 
+	if (NET_SimSendPacket(sock, length, data, to))
+	{
+		return;
+	}
+
 	switch (to.type)
 	{
 		case NA_LOOPBACK:
@@ -720,18 +988,7 @@ NET_SendPacket(netsrc_t sock, int length, void *data, netadr_t to)
 		}
 	}
 
-	ret = sendto(net_socket,
-			data,
-			length,
-			0,
-			(struct sockaddr *)&addr,
-			addr_size);
-
-	if (ret == -1)
-	{
-		Com_Printf("%s ERROR: %s to %s\n", NET_ErrorString(),
-				__func__, NET_AdrToString(to));
-	}
+	NET_SendTo(sock, net_socket, length, data, &addr, addr_size, to);
 }
 
 static void
@@ -777,7 +1034,27 @@ NET_Config(qboolean multiplayer)
 	{
 		int i;
 
+		/* don't lose what's still queued */
+		NET_FlushPackets();
+
 		/* shut down any existing sockets */
+		memset(net_recvrings, 0, sizeof(net_recvrings));
+
+#ifdef NET_USE_EPOLL
+		/* start over with the new sockets, a forked
+		   server instance must not share the set */
+		if (net_epollfd != -1)
+		{
+			close(net_epollfd);
+			close(net_timerfd);
+			net_epollfd = net_timerfd = -1;
+		}
+
+		net_waitfds[NET_WAIT_STDIN] = -1;
+		net_waitfds[NET_WAIT_IP] = -1;
+		net_waitfds[NET_WAIT_IP6] = -1;
+#endif
+
 		for (i = 0; i < 2; i++)
 		{
 			if (ip_sockets[i])
@@ -991,22 +1268,183 @@ NET_ErrorString(void)
 	return strerror(code);
 }
 
+static void
+NET_RecordWakeup(long long late)
+{
+	net_stats.timer_wakeups++;
+
+	if (late < 0)
+	{
+		late = 0;
+	}
+
+	if (late > 1000)
+	{
+		net_stats.late_wakeups++;
+	}
+
+	net_stats.wakeup_late_total += late;
+
+	if (late > net_stats.wakeup_late_max)
+	{
+		net_stats.wakeup_late_max = (unsigned int)late;
+	}
+}
+
+#ifdef NET_USE_EPOLL
+static void
+NET_WatchDescriptor(int slot, int fd)
+{
+	struct epoll_event ev;
+
+	if (net_waitfds[slot] == fd)
+	{
+		return;
+	}
+
+	/* fails harmlessly if it's already closed */
+	if (net_waitfds[slot] != -1)
+	{
+		epoll_ctl(net_epollfd, EPOLL_CTL_DEL, net_waitfds[slot], NULL);
+	}
+
+	/* kept even if adding fails, stdin redirected
+	   from a file can't be polled and isn't retried */
+	net_waitfds[slot] = fd;
+
+	if (fd != -1)
+	{
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.u32 = slot;
+		epoll_ctl(net_epollfd, EPOLL_CTL_ADD, fd, &ev);
+	}
+}
+
+static qboolean
+NET_CreateEpoll(void)
+{
+	struct epoll_event ev;
+
+	net_epollfd = epoll_create1(EPOLL_CLOEXEC);
+	net_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = NET_WAIT_TIMER;
+
+	if ((net_epollfd == -1) || (net_timerfd == -1) ||
+		(epoll_ctl(net_epollfd, EPOLL_CTL_ADD, net_timerfd, &ev) == -1))
+	{
+		Com_Printf("%s: %s, falling back to select()\n", __func__, NET_ErrorString());
+
+		if (net_epollfd != -1)
+		{
+			close(net_epollfd);
+		}
+
+		if (net_timerfd != -1)
+		{
+			close(net_timerfd);
+		}
+
+		net_epollfd = net_timerfd = -1;
+		net_epollfailed = true;
+
+		return false;
+	}
+
+	return true;
+}
+
 /*
- * sleeps msec or until net socket is ready
+ * Waits until the absolute deadline usec from now, or until
+ * one of the server sockets or stdin becomes readable.
  */
-void
-NET_Sleep(int msec)
+static qboolean
+NET_EpollSleep(int usec)
+{
+	extern qboolean stdin_active;
+	struct epoll_event events[NET_WAIT_TIMER + 1];
+	struct itimerspec timer;
+	struct timespec now;
+	long long deadline;
+	uint64_t expirations;
+	int i, count;
+
+	if ((net_epollfd == -1) && (net_epollfailed || !NET_CreateEpoll()))
+	{
+		return false;
+	}
+
+	NET_WatchDescriptor(NET_WAIT_STDIN, stdin_active ? 0 : -1);
+	NET_WatchDescriptor(NET_WAIT_IP, ip_sockets[NS_SERVER] ? ip_sockets[NS_SERVER] : -1);
+	NET_WatchDescriptor(NET_WAIT_IP6, ip6_sockets[NS_SERVER] ? ip6_sockets[NS_SERVER] : -1);
+
+	/* arming the timer again also clears an expiration
+	   left over from a wakeup by one of the sockets */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	deadline = now.tv_sec * 1000000000LL + now.tv_nsec + Q_max(usec, 0) * 1000LL;
+
+	memset(&timer, 0, sizeof(timer));
+	timer.it_value.tv_sec = deadline / 1000000000LL;
+	timer.it_value.tv_nsec = deadline % 1000000000LL;
+
+	if (timerfd_settime(net_timerfd, TFD_TIMER_ABSTIME, &timer, NULL) == -1)
+	{
+		return false;
+	}
+
+	/* a signal interrupts the wait, the
+	   main loop has to look at it anyway */
+	count = epoll_wait(net_epollfd, events, ARRLEN(events), -1);
+
+	for (i = 0; i < count; i++)
+	{
+		if ((events[i].data.u32 == NET_WAIT_TIMER) &&
+			(read(net_timerfd, &expirations, sizeof(expirations)) > 0))
+		{
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			NET_RecordWakeup((now.tv_sec * 1000000000LL + now.tv_nsec - deadline) / 1000);
+		}
+	}
+
+	return true;
+}
+#endif
+
+/*
+ * Sleeps usec or until a server socket is ready. Returns
+ * false if there's nothing to wait for and it didn't sleep.
+ */
+qboolean
+NET_Sleep(int usec)
 {
 	struct timeval timeout;
 	fd_set fdset;
 	extern cvar_t *dedicated;
 	extern qboolean stdin_active;
+	long long deadline;
+
+	NET_FlushPackets();
 
 	if ((!ip_sockets[NS_SERVER] &&
 		 !ip6_sockets[NS_SERVER]) || (dedicated && !dedicated->value))
 	{
-		return; /* we're not a server, just run full speed */
+		return false; /* we're not a server, just run full speed */
+	}
+
+	net_stats.sleeps++;
+
+	/* wake up for datagrams the simulator holds back */
+	usec = NET_SimTimeout(usec);
+
+#ifdef NET_USE_EPOLL
+	if (NET_EpollSleep(usec))
+	{
+		return true;
 	}
+#endif
 
 	FD_ZERO(&fdset);
 
@@ -1017,9 +1455,17 @@ NET_Sleep(int msec)
 
 	FD_SET(ip_sockets[NS_SERVER], &fdset); /* IPv4 network socket */
 	FD_SET(ip6_sockets[NS_SERVER], &fdset); /* IPv6 network socket */
-	timeout.tv_sec = msec / 1000;
-	timeout.tv_usec = (msec % 1000) * 1000;
-	select(MAX(ip_sockets[NS_SERVER],
-					ip6_sockets[NS_SERVER]) + 1, &fdset, NULL, NULL, &timeout);
+	usec = Q_max(usec, 0);
+	timeout.tv_sec = usec / 1000000;
+	timeout.tv_usec = usec % 1000000;
+	deadline = Sys_Microseconds() + usec;
+
+	if (select(MAX(ip_sockets[NS_SERVER],
+					ip6_sockets[NS_SERVER]) + 1, &fdset, NULL, NULL, &timeout) == 0)
+	{
+		NET_RecordWakeup(Sys_Microseconds() - deadline);
+	}
+
+	return true;
 }
 
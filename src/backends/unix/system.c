@@ -27,6 +27,7 @@
 #include <dirent.h>
 #include <dlfcn.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -34,8 +35,14 @@
 #include <time.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/select.h> /* for fd_set */
+#include <sys/wait.h>
+#ifdef __linux__
+#include <signal.h>
+#include <sys/prctl.h>
+#endif
 #ifndef FNDELAY
 #define FNDELAY O_NDELAY
 #endif
@@ -310,6 +317,304 @@ Sys_Nanosleep(int nanosec)
 
 /* ================================================================ */
 
+struct sysThread_s
+{
+	pthread_t thread;
+	void (*func)(void *);
+	void *data;
+};
+
+struct sysMutex_s
+{
+	pthread_mutex_t mutex;
+};
+
+struct sysCond_s
+{
+	pthread_cond_t cond;
+};
+
+static void *
+Sys_ThreadMain(void *arg)
+{
+	sysThread_t *thread = arg;
+
+	thread->func(thread->data);
+
+	return NULL;
+}
+
+sysThread_t *
+Sys_CreateThread(void (*func)(void *), void *data)
+{
+	sysThread_t *thread;
+
+	if ((thread = calloc(1, sizeof(sysThread_t))) == NULL)
+	{
+		return NULL;
+	}
+
+	thread->func = func;
+	thread->data = data;
+
+	if (pthread_create(&thread->thread, NULL, Sys_ThreadMain, thread) != 0)
+	{
+		free(thread);
+		return NULL;
+	}
+
+	return thread;
+}
+
+void
+Sys_JoinThread(sysThread_t *thread)
+{
+	if (thread)
+	{
+		pthread_join(thread->thread, NULL);
+		free(thread);
+	}
+}
+
+sysMutex_t *
+Sys_CreateMutex(void)
+{
+	sysMutex_t *mutex;
+
+	if ((mutex = calloc(1, sizeof(sysMutex_t))) == NULL)
+	{
+		return NULL;
+	}
+
+	pthread_mutex_init(&mutex->mutex, NULL);
+
+	return mutex;
+}
+
+void
+Sys_DestroyMutex(sysMutex_t *mutex)
+{
+	if (mutex)
+	{
+		pthread_mutex_destroy(&mutex->mutex);
+		free(mutex);
+	}
+}
+
+void
+Sys_LockMutex(sysMutex_t *mutex)
+{
+	pthread_mutex_lock(&mutex->mutex);
+}
+
+void
+Sys_UnlockMutex(sysMutex_t *mutex)
+{
+	pthread_mutex_unlock(&mutex->mutex);
+}
+
+sysCond_t *
+Sys_CreateCond(void)
+{
+	sysCond_t *cond;
+
+	if ((cond = calloc(1, sizeof(sysCond_t))) == NULL)
+	{
+		return NULL;
+	}
+
+	pthread_cond_init(&cond->cond, NULL);
+
+	return cond;
+}
+
+void
+Sys_DestroyCond(sysCond_t *cond)
+{
+	if (cond)
+	{
+		pthread_cond_destroy(&cond->cond);
+		free(cond);
+	}
+}
+
+void
+Sys_WaitCond(sysCond_t *cond, sysMutex_t *mutex)
+{
+	pthread_cond_wait(&cond->cond, &mutex->mutex);
+}
+
+void
+Sys_SignalCond(sysCond_t *cond)
+{
+	pthread_cond_signal(&cond->cond);
+}
+
+void
+Sys_BroadcastCond(sysCond_t *cond)
+{
+	pthread_cond_broadcast(&cond->cond);
+}
+
+int
+Sys_GetNumCPUs(void)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return (cpus > 0) ? (int)cpus : 1;
+}
+
+/* ================================================================ */
+
+/* Processes of the server instances, 0 if not running. */
+static pid_t sys_instances[MAX_INSTANCES];
+
+/*
+ * Forks a copy of the process to run the given server instance.
+ * Returns 1 in the copy, 0 in the original and -1 on error. The
+ * copy gets no console input and exits with the original.
+ */
+int
+Sys_ForkInstance(int instance)
+{
+	pid_t parent, pid;
+
+	if ((instance <= 0) || (instance >= MAX_INSTANCES))
+	{
+		return -1;
+	}
+
+	/* don't write buffered output twice */
+	fflush(NULL);
+
+	parent = getpid();
+	pid = fork();
+
+	if (pid == -1)
+	{
+		Com_Printf("%s: %s\n", __func__, strerror(errno));
+		return -1;
+	}
+
+	if (pid)
+	{
+		sys_instances[instance] = pid;
+		return 0;
+	}
+
+#ifdef __linux__
+	prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+
+	if (getppid() != parent)
+	{
+		exit(0);
+	}
+
+	memset(sys_instances, 0, sizeof(sys_instances));
+	stdin_active = false;
+	srand(getpid());
+
+	return 1;
+}
+
+#ifdef __linux__
+static qboolean
+Sys_ReadProcessStats(pid_t pid, sysinstance_t *stats)
+{
+	unsigned long utime, stime;
+	char line[256];
+	char *s;
+	FILE *f;
+	int kb;
+
+	/* comm may contain spaces, the fields
+	   we're after come after its ')' */
+	if (!(f = fopen(va("/proc/%i/stat", (int)pid), "r")))
+	{
+		return false;
+	}
+
+	s = fgets(line, sizeof(line), f) ? strrchr(line, ')') : NULL;
+	fclose(f);
+
+	if (!s || (sscanf(s, ") %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+				&utime, &stime) != 2))
+	{
+		return false;
+	}
+
+	stats->cputime = (int)((utime + stime) * 1000 / sysconf(_SC_CLK_TCK));
+
+	if (!(f = fopen(va("/proc/%i/smaps_rollup", (int)pid), "r")))
+	{
+		return true;
+	}
+
+	while (fgets(line, sizeof(line), f))
+	{
+		if (sscanf(line, "Rss: %d", &kb) == 1)
+		{
+			stats->rss = kb;
+		}
+		else if (sscanf(line, "Pss: %d", &kb) == 1)
+		{
+			stats->pss = kb;
+		}
+		else if ((sscanf(line, "Shared_Clean: %d", &kb) == 1) ||
+				(sscanf(line, "Shared_Dirty: %d", &kb) == 1))
+		{
+			stats->shared += kb;
+		}
+	}
+
+	fclose(f);
+
+	return true;
+}
+#endif
+
+/*
+ * Fills in what the system knows about the process running
+ * the given server instance. Returns false if it's not running.
+ */
+qboolean
+Sys_GetInstanceStats(int instance, sysinstance_t *stats)
+{
+	pid_t pid;
+	int status;
+
+	if ((instance < 0) || (instance >= MAX_INSTANCES))
+	{
+		return false;
+	}
+
+	pid = instance ? sys_instances[instance] : getpid();
+
+	if (!pid)
+	{
+		return false;
+	}
+
+	/* collect instances that have exited */
+	if (instance && (waitpid(pid, &status, WNOHANG) == pid))
+	{
+		sys_instances[instance] = 0;
+		return false;
+	}
+
+	memset(stats, 0, sizeof(*stats));
+	stats->pid = (int)pid;
+
+#ifdef __linux__
+	Sys_ReadProcessStats(pid, stats);
+#endif
+
+	return true;
+}
+
+/* ================================================================ */
+
 /* The musthave and canhave arguments are unused in YQ2. We
    can't remove them since Sys_FindFirst() and Sys_FindNext()
    are defined in shared.h and may be used in custom game DLLs. */
@@ -621,6 +926,49 @@ Sys_Rename(const char *from, const char *to)
 	return rename(from, to);
 }
 
+/*
+ * Maps the whole file read only into memory. Returns
+ * NULL if the file can't be opened or is empty.
+ */
+void *
+Sys_MapFile(const char *path, size_t *size)
+{
+	struct stat sb;
+	void *data;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+	{
+		return NULL;
+	}
+
+	if ((fstat(fd, &sb) == -1) || (sb.st_size <= 0))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED)
+	{
+		return NULL;
+	}
+
+	*size = sb.st_size;
+	return data;
+}
+
+void
+Sys_UnmapFile(void *data, size_t size)
+{
+	if (data != NULL)
+	{
+		munmap(data, size);
+	}
+}
+
 void
 Sys_RemoveDir(const char *path)
 {
@@ -32,7 +32,7 @@
 #include <wsipx.h>
 #include "../../common/header/common.h"
 
-#define MAX_LOOPBACK 4
+#define MAX_LOOPBACK 64 /* room for a fragmented message */
 #define QUAKE2MCAST "ff12::666"
 
 typedef struct
@@ -55,6 +55,7 @@ loopback_t loopbacks[2];
 int ip_sockets[2];
 int ip6_sockets[2];
 int ipx_sockets[2];
+netstats_t net_stats;
 
 char *multicast_interface;
 static const char *NET_ErrorString(void);
@@ -537,8 +538,8 @@ NET_SendLoopPacket(netsrc_t sock, int length, void *data, netadr_t to)
 
 /* ============================================================================= */
 
-qboolean
-NET_GetPacket(netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message)
+static qboolean
+NET_ReadPacket(netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message)
 {
 	int ret;
 	struct sockaddr_storage from;
@@ -576,6 +577,7 @@ NET_GetPacket(netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message)
 		ret = recvfrom(net_socket, (char *)net_message->data,
 				net_message->maxsize, 0, (struct sockaddr *)&from,
 				&fromlen);
+		net_stats.recv_calls++;
 
 		SockadrToNetadr(&from, net_from);
 
@@ -615,6 +617,7 @@ NET_GetPacket(netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message)
 			continue;
 		}
 
+		net_stats.packets_received++;
 		net_message->cursize = ret;
 		return true;
 	}
@@ -622,6 +625,24 @@ NET_GetPacket(netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message)
 	return false;
 }
 
+/*
+ * Returns the next datagram for sock. Everything read
+ * goes through the impairment simulator first.
+ */
+qboolean
+NET_GetPacket(netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message)
+{
+	while (NET_ReadPacket(sock, net_from, net_message))
+	{
+		if (!NET_SimReceivedPacket(sock, *net_from, net_message))
+		{
+			return true;
+		}
+	}
+
+	return NET_SimGetPacket(sock, net_from, net_message);
+}
+
 /* ============================================================================= */
 
 void
@@ -632,6 +653,11 @@ NET_SendPacket(netsrc_t sock, int length, void *data, netadr_t to)
 	int net_socket;
 	int addr_size = sizeof(struct sockaddr_in);
 
+	if (NET_SimSendPacket(sock, length, data, to))
+	{
+		return;
+	}
+
 	switch (to.type)
 	{
 		case NA_LOOPBACK:
@@ -758,6 +784,12 @@ NET_SendPacket(netsrc_t sock, int length, void *data, netadr_t to)
 
 	ret = sendto(net_socket, data, length, 0,
 			(struct sockaddr *)&addr, addr_size);
+	net_stats.send_calls++;
+
+	if (ret != -1)
+	{
+		net_stats.packets_sent++;
+	}
 
 	if (ret == -1)
 	{
@@ -1214,22 +1246,36 @@ NET_Config(qboolean multiplayer)
 }
 
 /*
- * sleeps msec or until
- * net socket is ready
+ * Winsock has no batched sends,
+ * NET_SendPacket() sends right away.
  */
 void
-NET_Sleep(int msec)
+NET_FlushPackets(void)
+{
+}
+
+/*
+ * sleeps usec or until net socket is ready,
+ * returns false if it didn't sleep
+ */
+qboolean
+NET_Sleep(int usec)
 {
 	struct timeval timeout;
 	fd_set fdset;
 	extern cvar_t *dedicated;
+	long long deadline;
+	long long late;
 	int i;
 
 	if (!dedicated || !dedicated->value)
 	{
-		return; /* we're not a server, just run full speed */
+		return false; /* we're not a server, just run full speed */
 	}
 
+	/* wake up for datagrams the simulator holds back */
+	usec = NET_SimTimeout(usec);
+
 	FD_ZERO(&fdset);
 	i = 0;
 
@@ -1255,11 +1301,32 @@ NET_Sleep(int msec)
 		}
 	}
 
-	timeout.tv_sec = msec / 1000;
-	timeout.tv_usec = (msec % 1000) * 1000;
+	usec = Q_max(usec, 0);
+	timeout.tv_sec = usec / 1000000;
+	timeout.tv_usec = usec % 1000000;
 	i = Q_max(ip_sockets[NS_SERVER], ip6_sockets[NS_SERVER]);
 	i = Q_max(i, ipx_sockets[NS_SERVER]);
-	select(i + 1, &fdset, NULL, NULL, &timeout);
+	deadline = Sys_Microseconds() + usec;
+	net_stats.sleeps++;
+
+	if (select(i + 1, &fdset, NULL, NULL, &timeout) == 0)
+	{
+		late = Q_max(Sys_Microseconds() - deadline, 0);
+		net_stats.timer_wakeups++;
+		net_stats.wakeup_late_total += late;
+
+		if (late > 1000)
+		{
+			net_stats.late_wakeups++;
+		}
+
+		if (late > net_stats.wakeup_late_max)
+		{
+			net_stats.wakeup_late_max = (unsigned int)late;
+		}
+	}
+
+	return true;
 }
 
 /* =================================================================== */
@@ -318,6 +318,172 @@ Sys_Nanosleep(int nanosec)
 
 /* ================================================================ */
 
+struct sysThread_s
+{
+	HANDLE thread;
+	void (*func)(void *);
+	void *data;
+};
+
+struct sysMutex_s
+{
+	CRITICAL_SECTION cs;
+};
+
+struct sysCond_s
+{
+	CONDITION_VARIABLE cv;
+};
+
+static DWORD WINAPI
+Sys_ThreadMain(LPVOID arg)
+{
+	sysThread_t *thread = arg;
+
+	thread->func(thread->data);
+
+	return 0;
+}
+
+sysThread_t *
+Sys_CreateThread(void (*func)(void *), void *data)
+{
+	sysThread_t *thread;
+
+	if ((thread = calloc(1, sizeof(sysThread_t))) == NULL)
+	{
+		return NULL;
+	}
+
+	thread->func = func;
+	thread->data = data;
+
+	if ((thread->thread = CreateThread(NULL, 0, Sys_ThreadMain, thread, 0, NULL)) == NULL)
+	{
+		free(thread);
+		return NULL;
+	}
+
+	return thread;
+}
+
+void
+Sys_JoinThread(sysThread_t *thread)
+{
+	if (thread)
+	{
+		WaitForSingleObject(thread->thread, INFINITE);
+		CloseHandle(thread->thread);
+		free(thread);
+	}
+}
+
+sysMutex_t *
+Sys_CreateMutex(void)
+{
+	sysMutex_t *mutex;
+
+	if ((mutex = calloc(1, sizeof(sysMutex_t))) == NULL)
+	{
+		return NULL;
+	}
+
+	InitializeCriticalSection(&mutex->cs);
+
+	return mutex;
+}
+
+void
+Sys_DestroyMutex(sysMutex_t *mutex)
+{
+	if (mutex)
+	{
+		DeleteCriticalSection(&mutex->cs);
+		free(mutex);
+	}
+}
+
+void
+Sys_LockMutex(sysMutex_t *mutex)
+{
+	EnterCriticalSection(&mutex->cs);
+}
+
+void
+Sys_UnlockMutex(sysMutex_t *mutex)
+{
+	LeaveCriticalSection(&mutex->cs);
+}
+
+sysCond_t *
+Sys_CreateCond(void)
+{
+	sysCond_t *cond;
+
+	if ((cond = calloc(1, sizeof(sysCond_t))) == NULL)
+	{
+		return NULL;
+	}
+
+	InitializeConditionVariable(&cond->cv);
+
+	return cond;
+}
+
+void
+Sys_DestroyCond(sysCond_t *cond)
+{
+	free(cond);
+}
+
+void
+Sys_WaitCond(sysCond_t *cond, sysMutex_t *mutex)
+{
+	SleepConditionVariableCS(&cond->cv, &mutex->cs, INFINITE);
+}
+
+void
+Sys_SignalCond(sysCond_t *cond)
+{
+	WakeConditionVariable(&cond->cv);
+}
+
+void
+Sys_BroadcastCond(sysCond_t *cond)
+{
+	WakeAllConditionVariable(&cond->cv);
+}
+
+int
+Sys_GetNumCPUs(void)
+{
+	SYSTEM_INFO info;
+
+	GetSystemInfo(&info);
+
+	return (info.dwNumberOfProcessors > 0) ? (int)info.dwNumberOfProcessors : 1;
+}
+
+/* ================================================================ */
+
+/*
+ * There's no fork() on Windows, start
+ * more dedicated servers instead.
+ */
+int
+Sys_ForkInstance(int instance)
+{
+	return -1;
+}
+
+qboolean
+Sys_GetInstanceStats(int instance, sysinstance_t *stats)
+{
+	return false;
+}
+
+/* ================================================================ */
+
 /* The musthave and canhave arguments are unused in YQ2. We
    can't remove them since Sys_FindFirst() and Sys_FindNext()
    are defined in shared.h and may be used in custom game DLLs. */
@@ -572,6 +738,64 @@ Sys_Rename(const char *from, const char *to)
 	return _wrename(wfrom, wto);
 }
 
+/*
+ * Maps the whole file read only into memory. Returns
+ * NULL if the file can't be opened or is empty.
+ */
+void *
+Sys_MapFile(const char *path, size_t *size)
+{
+	WCHAR wpath[MAX_OSPATH] = {0};
+	LARGE_INTEGER filesize;
+	HANDLE file, mapping;
+	void *data = NULL;
+
+	MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, MAX_OSPATH);
+
+	file = CreateFileW(wpath, GENERIC_READ, FILE_SHARE_READ, NULL,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return NULL;
+	}
+
+	if (!GetFileSizeEx(file, &filesize) || (filesize.QuadPart <= 0))
+	{
+		CloseHandle(file);
+		return NULL;
+	}
+
+	mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+
+	if (mapping == NULL)
+	{
+		return NULL;
+	}
+
+	/* The view keeps the mapping alive. */
+	data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+
+	if (data == NULL)
+	{
+		return NULL;
+	}
+
+	*size = (size_t)filesize.QuadPart;
+	return data;
+}
+
+void
+Sys_UnmapFile(void *data, size_t size)
+{
+	if (data != NULL)
+	{
+		UnmapViewOfFile(data);
+	}
+}
+
 void
 Sys_RemoveDir(const char *path)
 {
@@ -589,6 +589,22 @@ CL_DownloadFilter(const char *filename)
 	return false;
 }
 
+/*
+ * Asks the server for cls.downloadname, starting at
+ * offset. Servers that know windowed downloads send
+ * DOWNLOAD_WINDOW bytes ahead, others ignore it.
+ */
+static void
+CL_RequestDownload(int offset)
+{
+	cls.downloadacked = offset;
+	cls.downloadresume = -1;
+
+	MSG_WriteByte(&cls.netchan.message, clc_stringcmd);
+	MSG_WriteString(&cls.netchan.message, va("download %s %i %i",
+				cls.downloadname, offset, DOWNLOAD_WINDOW));
+}
+
 /*
  * Returns true if the file exists, otherwise it attempts
  * to start a download from the server.
@@ -682,14 +698,12 @@ CL_CheckOrDownloadFile(const char *filename)
 
 		/* give the server an offset to start the download */
 		Com_Printf("Resuming %s\n", cls.downloadname);
-		MSG_WriteByte(&cls.netchan.message, clc_stringcmd);
-		MSG_WriteString(&cls.netchan.message, va("download %s %i", cls.downloadname, len));
+		CL_RequestDownload(len);
 	}
 	else
 	{
 		Com_Printf("Downloading %s\n", cls.downloadname);
-		MSG_WriteByte(&cls.netchan.message, clc_stringcmd);
-		MSG_WriteString(&cls.netchan.message, va("download %s", cls.downloadname));
+		CL_RequestDownload(0);
 	}
 
 	cls.downloadnumber++;
@@ -728,8 +742,7 @@ CL_Download_f(void)
 	COM_StripExtension(cls.downloadname, cls.downloadtempname);
 	strcat(cls.downloadtempname, ".tmp");
 
-	MSG_WriteByte(&cls.netchan.message, clc_stringcmd);
-	MSG_WriteString(&cls.netchan.message, va("download %s", cls.downloadname));
+	CL_RequestDownload(0);
 
 	cls.downloadnumber++;
 }
@@ -742,11 +755,19 @@ CL_ParseDownload(void)
 {
 	char name[MAX_OSPATH];
 	int r, percent, size;
+	int offset, position;
 	static qboolean second_try;
 
 	/* read the data */
 	size = MSG_ReadShort(&net_message);
 	percent = MSG_ReadByte(&net_message);
+	offset = -1;
+
+	if (percent & DOWNLOAD_WINDOWED)
+	{
+		percent &= ~DOWNLOAD_WINDOWED;
+		offset = MSG_ReadLong(&net_message);
+	}
 
 	if (size == -1)
 	{
@@ -795,23 +816,65 @@ CL_ParseDownload(void)
 		}
 	}
 
+	position = (int)ftell(cls.download);
+
+	/* windowed downloads arrive out of order or not at all, ask
+	   again for what's missing, or once more if that got lost */
+	if ((offset != -1) && (offset != position))
+	{
+		net_message.readcount += size;
+
+		if ((offset > position) && ((cls.downloadresume != position) ||
+				(cls.realtime - cls.downloadresumetime > 500)))
+		{
+			cls.downloadresume = position;
+			cls.downloadresumetime = cls.realtime;
+
+			MSG_WriteByte(&cls.netchan.message, clc_stringcmd);
+			MSG_WriteString(&cls.netchan.message, va("download %s %i %i",
+						cls.downloadname, position, DOWNLOAD_WINDOW));
+			cls.forcePacket = true;
+		}
+
+		return;
+	}
+
 	fwrite(net_message.data + net_message.readcount, 1, size, cls.download);
 	net_message.readcount += size;
+	position += size;
 
 	if (percent != 100)
 	{
-		/* request next block */
 		cls.downloadpercent = percent;
 
-		MSG_WriteByte(&cls.netchan.message, clc_stringcmd);
-		SZ_Print(&cls.netchan.message, "nextdl");
-		cls.forcePacket = true;
+		if (offset == -1)
+		{
+			/* request next block */
+			MSG_WriteByte(&cls.netchan.message, clc_stringcmd);
+			SZ_Print(&cls.netchan.message, "nextdl");
+			cls.forcePacket = true;
+		}
+		else if (position - cls.downloadacked >= DOWNLOAD_WINDOW / 4)
+		{
+			/* tell the server how far we got */
+			cls.downloadacked = position;
+
+			MSG_WriteByte(&cls.netchan.message, clc_stringcmd);
+			MSG_WriteString(&cls.netchan.message, va("nextdl %i", position));
+		}
 	}
 	else
 	{
 		char oldn[MAX_OSPATH];
 		char newn[MAX_OSPATH];
 
+		if (offset != -1)
+		{
+			/* the server can let go of the file */
+			MSG_WriteByte(&cls.netchan.message, clc_stringcmd);
+			MSG_WriteString(&cls.netchan.message, va("nextdl %i", position));
+		}
+
 		fclose(cls.download);
 
 		/* rename the temp file to it's final name */
@@ -824,6 +887,8 @@ CL_ParseDownload(void)
 			Com_Printf("failed to rename.\n");
 		}
 
+		FS_FlushDirCache();
+
 		cls.download = NULL;
 		cls.downloadpercent = 0;
 
@@ -238,6 +238,14 @@ CL_Record_f(void)
 	Com_sprintf(name, sizeof(name), "%s/demos/%s.dm2", FS_Gamedir(), Cmd_Argv(1));
 
 	Com_Printf("recording to %s.\n", name);
+
+	/* the demo stores the messages as they came */
+	if (cls.netchan.version >= NETCHAN_VERSION)
+	{
+		Com_Printf("Messages from this server may be longer than %i bytes, "
+				"clients without fragmented messages can't play the demo.\n",
+				MAX_MSGLEN);
+	}
 	FS_CreatePath(name);
 	cls.demofile = Q_fopen(name, "wb");
 
@@ -396,6 +404,7 @@ CL_ClearState(void)
 	S_StopAllSounds();
 	CL_ClearEffects();
 	CL_ClearTEnts();
+	CL_PrefetchFlush();
 
 	/* wipe the entire cl structure */
 	memset(&cl, 0, sizeof(cl));
@@ -608,6 +617,8 @@ CL_InitLocal(void)
 	cl_r1q2_lightstyle = Cvar_Get("cl_r1q2_lightstyle", "1", CVAR_ARCHIVE);
 	cl_limitsparksounds = Cvar_Get("cl_limitsparksounds", "0", CVAR_ARCHIVE);
 
+	CL_PrefetchInit();
+
 	/* userinfo */
 	name = Cvar_Get("name", "unnamed", CVAR_USERINFO | CVAR_ARCHIVE);
 	skin = Cvar_Get("skin", "male/grunt", CVAR_USERINFO | CVAR_ARCHIVE);
@@ -729,6 +740,8 @@ CL_WriteConfiguration(void)
 	fclose(f);
 
 	Cvar_WriteVariables(path);
+
+	FS_FlushDirCache();
 }
 
 typedef struct
@@ -911,6 +924,7 @@ CL_Frame(int packetdelta, int renderdelta, int timedelta, qboolean packetframe,
 	{
 		VID_CheckChanges();
 		CL_PredictMovement();
+		CL_PrefetchFrame();
 
 		if (!cl.refresh_prepped && (cls.state == ca_active))
 		{
@@ -1033,6 +1047,8 @@ CL_Shutdown(void)
 
 	Key_WriteConsoleHistory();
 
+	CL_PrefetchShutdown();
+
 	OGG_Stop();
 
 	S_Shutdown();
@@ -133,8 +133,11 @@ CL_SendConnectPacket(void)
 
 	userinfo_modified = false;
 
-	Netchan_OutOfBandPrint(NS_CLIENT, adr, "connect %i %i %i \"%s\"\n",
-			PROTOCOL_VERSION, port, cls.challenge, Cvar_Userinfo());
+	/* servers that don't know about netchan
+	   versions ignore the last argument */
+	Netchan_OutOfBandPrint(NS_CLIENT, adr, "connect %i %i %i \"%s\" netchan=%i\n",
+			PROTOCOL_VERSION, port, cls.challenge, Cvar_Userinfo(),
+			NETCHAN_VERSION);
 }
 
 /*
@@ -624,6 +627,11 @@ CL_ConnectionlessPacket(void)
 				Com_Printf("HTTP downloading supported by server but not the client.\n");
 #endif
 			}
+			else if (!strncmp(p, "netchan=", 8))
+			{
+				cls.netchan.version = Q_max(NETCHAN_VERSION_OLD, Q_min(NETCHAN_VERSION,
+						(int)strtol(p + 8, (char **)NULL, 10)));
+			}
 		}
 
 		/* Put client into pause mode when connecting to a local server.
@@ -1196,6 +1196,10 @@ CL_ParseConfigString(void)
 				cl.model_clip[i - CS_MODELS] = NULL;
 			}
 		}
+		else
+		{
+			CL_PrefetchConfigString(i);
+		}
 	}
 	else if ((i >= CS_SOUNDS) && (i < CS_SOUNDS + MAX_MODELS))
 	{
@@ -1204,6 +1208,10 @@ CL_ParseConfigString(void)
 			cl.sound_precache[i - CS_SOUNDS] =
 				S_RegisterSound(cl.configstrings[i]);
 		}
+		else
+		{
+			CL_PrefetchConfigString(i);
+		}
 	}
 	else if ((i >= CS_IMAGES) && (i < CS_IMAGES + MAX_MODELS))
 	{
@@ -1211,6 +1219,10 @@ CL_ParseConfigString(void)
 		{
 			cl.image_precache[i - CS_IMAGES] = Draw_FindPic(cl.configstrings[i]);
 		}
+		else
+		{
+			CL_PrefetchConfigString(i);
+		}
 	}
 	else if ((i >= CS_PLAYERSKINS) && (i < CS_PLAYERSKINS + MAX_CLIENTS))
 	{
@@ -0,0 +1,608 @@
+/*
+ * Copyright (C) 1997-2001 Id Software, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ * =======================================================================
+ *
+ * Background prefetching of the precache lists. While the server sends
+ * the model, sound and image configstrings the files are opened on the
+ * main thread and read (and inflated if they're stored in a PK3) by a
+ * small pool of worker threads. When the registration functions call
+ * FS_LoadFile() later on the finished buffers are handed over without
+ * touching the disk again.
+ *
+ * Only the main thread opens and closes files and allocates from the
+ * zone. The workers do nothing but FS_ReadDetached() into a buffer
+ * that was allocated for them.
+ *
+ * =======================================================================
+ */
+
+#include "header/client.h"
+
+extern qboolean file_from_protected_pak;
+
+#define PREFETCH_MAX_JOBS (MAX_MODELS + MAX_SOUNDS + MAX_IMAGES)
+#define PREFETCH_HASH_SIZE 1024
+#define PREFETCH_MAX_OPEN 32
+#define PREFETCH_MAX_THREADS 8
+#define PREFETCH_MAX_BYTES (64 * 1024 * 1024)
+
+typedef enum
+{
+	PF_PENDING,     /* Not opened yet. */
+	PF_QUEUED,      /* Opened, waiting for a worker. */
+	PF_READING,     /* A worker is reading it. */
+	PF_DONE,        /* Data is ready. */
+	PF_FAILED,      /* Couldn't be read or was cancelled. */
+	PF_TAKEN        /* Handed over to FS_LoadFile(). */
+} pfState_t;
+
+typedef struct pfJob_s
+{
+	char name[MAX_QPATH];
+	unsigned hash;
+	pfState_t state;
+	fileHandle_t handle;
+	qboolean fromprotected;
+	int size;
+	byte *data;
+	struct pfJob_s *hashnext;
+	struct pfJob_s *queuenext;
+} pfJob_t;
+
+static cvar_t *cl_prefetch;
+
+static pfJob_t pf_jobs[PREFETCH_MAX_JOBS];
+static pfJob_t *pf_hash[PREFETCH_HASH_SIZE];
+static int pf_numjobs;
+static int pf_nextpending;
+
+/* Jobs holding an open file handle. */
+static pfJob_t *pf_open[PREFETCH_MAX_OPEN];
+static int pf_numopen;
+static int pf_bytes;
+
+/* Work queue, protected by pf_mutex. */
+static pfJob_t *pf_queuehead;
+static pfJob_t *pf_queuetail;
+static int pf_reading;
+static qboolean pf_quit;
+
+static sysMutex_t *pf_mutex;
+static sysCond_t *pf_workcond;
+static sysCond_t *pf_donecond;
+static sysThread_t *pf_threads[PREFETCH_MAX_THREADS];
+static int pf_numthreads;
+
+static struct
+{
+	int files;
+	int served;
+	int bytes;
+} pf_stats;
+
+static unsigned
+CL_PrefetchHash(const char *name)
+{
+	unsigned hash = 0;
+
+	while (*name)
+	{
+		hash = hash * 31 + (unsigned char)*name++;
+	}
+
+	return hash;
+}
+
+static void
+CL_PrefetchWorker(void *data)
+{
+	pfJob_t *job;
+	int r;
+
+	Sys_LockMutex(pf_mutex);
+
+	while (true)
+	{
+		while (!pf_quit && !pf_queuehead)
+		{
+			Sys_WaitCond(pf_workcond, pf_mutex);
+		}
+
+		if (pf_quit)
+		{
+			break;
+		}
+
+		job = pf_queuehead;
+		pf_queuehead = job->queuenext;
+
+		if (!pf_queuehead)
+		{
+			pf_queuetail = NULL;
+		}
+
+		job->queuenext = NULL;
+
+		/* Cancelled while queued. */
+		if (job->state != PF_QUEUED)
+		{
+			continue;
+		}
+
+		job->state = PF_READING;
+		pf_reading++;
+
+		Sys_UnlockMutex(pf_mutex);
+		r = FS_ReadDetached(job->data, job->size, job->handle);
+		Sys_LockMutex(pf_mutex);
+
+		job->state = (r == job->size) ? PF_DONE : PF_FAILED;
+		pf_reading--;
+
+		Sys_BroadcastCond(pf_donecond);
+	}
+
+	Sys_UnlockMutex(pf_mutex);
+}
+
+static void
+CL_PrefetchStopThreads(void)
+{
+	int i;
+
+	if (!pf_numthreads)
+	{
+		return;
+	}
+
+	Sys_LockMutex(pf_mutex);
+	pf_quit = true;
+	Sys_BroadcastCond(pf_workcond);
+	Sys_UnlockMutex(pf_mutex);
+
+	for (i = 0; i < pf_numthreads; i++)
+	{
+		Sys_JoinThread(pf_threads[i]);
+		pf_threads[i] = NULL;
+	}
+
+	pf_numthreads = 0;
+	pf_quit = false;
+}
+
+static qboolean
+CL_PrefetchStartThreads(void)
+{
+	int count;
+
+	if (pf_numthreads)
+	{
+		return true;
+	}
+
+	count = Q_min((int)cl_prefetch->value, PREFETCH_MAX_THREADS);
+
+	if (count <= 0)
+	{
+		return false;
+	}
+
+	if (!pf_mutex)
+	{
+		pf_mutex = Sys_CreateMutex();
+		pf_workcond = Sys_CreateCond();
+		pf_donecond = Sys_CreateCond();
+
+		if (!pf_mutex || !pf_workcond || !pf_donecond)
+		{
+			Com_Printf("%s: couldn't create locks, prefetching disabled\n", __func__);
+			Cvar_Set("cl_prefetch", "0");
+			return false;
+		}
+	}
+
+	while (pf_numthreads < count)
+	{
+		if ((pf_threads[pf_numthreads] = Sys_CreateThread(CL_PrefetchWorker, NULL)) == NULL)
+		{
+			break;
+		}
+
+		pf_numthreads++;
+	}
+
+	if (!pf_numthreads)
+	{
+		Com_Printf("%s: couldn't create threads, prefetching disabled\n", __func__);
+		Cvar_Set("cl_prefetch", "0");
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Closes the handles of jobs the workers are done with and
+ * opens the next pending files as long as there's room. Main
+ * thread only.
+ */
+static void
+CL_PrefetchPump(void)
+{
+	pfJob_t *job;
+	int i;
+
+	if (!pf_numthreads)
+	{
+		return;
+	}
+
+	Sys_LockMutex(pf_mutex);
+
+	for (i = 0; i < pf_numopen; i++)
+	{
+		job = pf_open[i];
+
+		if ((job->state == PF_QUEUED) || (job->state == PF_READING))
+		{
+			continue;
+		}
+
+		/* Cancelled jobs may still be linked into the queue,
+		   the workers skip them. Only the handle goes away. */
+		FS_FCloseFile(job->handle);
+		job->handle = 0;
+
+		if ((job->state == PF_FAILED) && job->data)
+		{
+			Z_Free(job->data);
+			job->data = NULL;
+			pf_bytes -= job->size;
+		}
+
+		pf_open[i--] = pf_open[--pf_numopen];
+	}
+
+	Sys_UnlockMutex(pf_mutex);
+
+	while ((pf_nextpending < pf_numjobs) && (pf_numopen < PREFETCH_MAX_OPEN) &&
+			(pf_bytes < PREFETCH_MAX_BYTES))
+	{
+		job = &pf_jobs[pf_nextpending++];
+
+		if (job->state != PF_PENDING)
+		{
+			continue;
+		}
+
+		job->size = FS_FOpenFile(job->name, &job->handle, false);
+		job->fromprotected = file_from_protected_pak;
+
+		if (job->size <= 0)
+		{
+			if (job->size == 0)
+			{
+				FS_FCloseFile(job->handle);
+			}
+
+			job->handle = 0;
+			job->state = PF_FAILED;
+			continue;
+		}
+
+		job->data = Z_Malloc(job->size);
+		pf_bytes += job->size;
+		pf_open[pf_numopen++] = job;
+		pf_stats.files++;
+
+		Sys_LockMutex(pf_mutex);
+
+		job->state = PF_QUEUED;
+
+		if (pf_queuetail)
+		{
+			pf_queuetail->queuenext = job;
+		}
+		else
+		{
+			pf_queuehead = job;
+		}
+
+		pf_queuetail = job;
+
+		Sys_SignalCond(pf_workcond);
+		Sys_UnlockMutex(pf_mutex);
+	}
+}
+
+static void
+CL_PrefetchAdd(const char *name)
+{
+	pfJob_t *job;
+	unsigned hash;
+
+	if (!name[0] || (strlen(name) >= MAX_QPATH) || (pf_numjobs == PREFETCH_MAX_JOBS))
+	{
+		return;
+	}
+
+	hash = CL_PrefetchHash(name);
+
+	for (job = pf_hash[hash & (PREFETCH_HASH_SIZE - 1)]; job; job = job->hashnext)
+	{
+		if ((job->hash == hash) && !strcmp(job->name, name))
+		{
+			return;
+		}
+	}
+
+	if (!CL_PrefetchStartThreads())
+	{
+		return;
+	}
+
+	job = &pf_jobs[pf_numjobs++];
+	memset(job, 0, sizeof(*job));
+
+	Q_strlcpy(job->name, name, sizeof(job->name));
+	job->hash = hash;
+	job->state = PF_PENDING;
+	job->hashnext = pf_hash[hash & (PREFETCH_HASH_SIZE - 1)];
+	pf_hash[hash & (PREFETCH_HASH_SIZE - 1)] = job;
+
+	CL_PrefetchPump();
+}
+
+/*
+ * Queues the file behind a model, sound or image configstring.
+ * The names are resolved the same way R_RegisterModel(),
+ * S_RegisterSound() and Draw_FindPic() do it.
+ */
+void
+CL_PrefetchConfigString(int index)
+{
+	const char *s;
+
+	if (!cl_prefetch || (cl_prefetch->value <= 0))
+	{
+		return;
+	}
+
+	s = cl.configstrings[index];
+
+	if (!s[0])
+	{
+		return;
+	}
+
+	if ((index >= CS_MODELS) && (index < CS_MODELS + MAX_MODELS))
+	{
+		/* Inline and view models. */
+		if ((s[0] == '*') || (s[0] == '#'))
+		{
+			return;
+		}
+
+		CL_PrefetchAdd(s);
+	}
+	else if ((index >= CS_SOUNDS) && (index < CS_SOUNDS + MAX_SOUNDS))
+	{
+		/* Sexed sounds are resolved per player. */
+		if (s[0] == '*')
+		{
+			return;
+		}
+
+		if (s[0] == '#')
+		{
+			CL_PrefetchAdd(s + 1);
+		}
+		else
+		{
+			CL_PrefetchAdd(va("sound/%s", s));
+		}
+	}
+	else if ((index >= CS_IMAGES) && (index < CS_IMAGES + MAX_IMAGES))
+	{
+		if ((s[0] == '/') || (s[0] == '\\'))
+		{
+			CL_PrefetchAdd(s + 1);
+		}
+		else
+		{
+			CL_PrefetchAdd(va("pics/%s.pcx", s));
+		}
+	}
+}
+
+/*
+ * Called by FS_LoadFile(). Hands over the buffer if the file
+ * was prefetched, waiting for the worker if it's still being
+ * read. Returns -1 if FS_LoadFile() must load it itself.
+ */
+int
+CL_PrefetchTake(const char *name, void **buffer, qboolean *fromprotected)
+{
+	pfJob_t *job;
+	unsigned hash;
+	int size;
+
+	if (!pf_numjobs)
+	{
+		return -1;
+	}
+
+	hash = CL_PrefetchHash(name);
+
+	for (job = pf_hash[hash & (PREFETCH_HASH_SIZE - 1)]; job; job = job->hashnext)
+	{
+		if ((job->hash == hash) && !strcmp(job->name, name))
+		{
+			break;
+		}
+	}
+
+	if (!job)
+	{
+		return -1;
+	}
+
+	Sys_LockMutex(pf_mutex);
+
+	/* Not started yet. Loading it right away is faster
+	   than waiting for the queue to drain. */
+	if ((job->state == PF_PENDING) || (job->state == PF_QUEUED))
+	{
+		job->state = PF_FAILED;
+	}
+
+	while (job->state == PF_READING)
+	{
+		Sys_WaitCond(pf_donecond, pf_mutex);
+	}
+
+	size = -1;
+
+	if (job->state == PF_DONE)
+	{
+		*buffer = job->data;
+		*fromprotected = job->fromprotected;
+		size = job->size;
+
+		job->data = NULL;
+		job->state = PF_TAKEN;
+		pf_bytes -= size;
+
+		pf_stats.served++;
+		pf_stats.bytes += size;
+	}
+
+	Sys_UnlockMutex(pf_mutex);
+
+	/* Make room for the next files. */
+	CL_PrefetchPump();
+
+	return size;
+}
+
+/*
+ * Runs once per frame to keep the queue filled.
+ */
+void
+CL_PrefetchFrame(void)
+{
+	if (pf_nextpending < pf_numjobs)
+	{
+		CL_PrefetchPump();
+	}
+}
+
+/*
+ * Cancels everything and throws away all buffers that
+ * weren't taken. Must be called before search paths
+ * are freed since the workers read from open handles.
+ */
+void
+CL_PrefetchFlush(void)
+{
+	pfJob_t *job;
+	int i;
+
+	if (!pf_numjobs)
+	{
+		return;
+	}
+
+	Sys_LockMutex(pf_mutex);
+
+	for (i = 0; i < pf_numjobs; i++)
+	{
+		if ((pf_jobs[i].state == PF_PENDING) || (pf_jobs[i].state == PF_QUEUED))
+		{
+			pf_jobs[i].state = PF_FAILED;
+		}
+	}
+
+	while (pf_reading)
+	{
+		Sys_WaitCond(pf_donecond, pf_mutex);
+	}
+
+	pf_queuehead = pf_queuetail = NULL;
+
+	Sys_UnlockMutex(pf_mutex);
+
+	for (i = 0; i < pf_numopen; i++)
+	{
+		FS_FCloseFile(pf_open[i]->handle);
+	}
+
+	for (i = 0; i < pf_numjobs; i++)
+	{
+		job = &pf_jobs[i];
+
+		if (job->data)
+		{
+			Z_Free(job->data);
+		}
+	}
+
+	Com_DPrintf("Prefetch: %i of %i files used, %i kb\n",
+			pf_stats.served, pf_stats.files, pf_stats.bytes / 1024);
+
+	memset(pf_hash, 0, sizeof(pf_hash));
+	memset(&pf_stats, 0, sizeof(pf_stats));
+	pf_numjobs = 0;
+	pf_nextpending = 0;
+	pf_numopen = 0;
+	pf_bytes = 0;
+
+	/* Pick up changes to the number of threads. */
+	if (cl_prefetch->modified)
+	{
+		cl_prefetch->modified = false;
+		CL_PrefetchStopThreads();
+	}
+}
+
+void
+CL_PrefetchInit(void)
+{
+	cl_prefetch = Cvar_Get("cl_prefetch", "2", CVAR_ARCHIVE);
+	cl_prefetch->modified = false;
+}
+
+void
+CL_PrefetchShutdown(void)
+{
+	if (!cl_prefetch)
+	{
+		return;
+	}
+
+	CL_PrefetchFlush();
+	CL_PrefetchStopThreads();
+
+	Sys_DestroyCond(pf_donecond);
+	Sys_DestroyCond(pf_workcond);
+	Sys_DestroyMutex(pf_mutex);
+	pf_donecond = pf_workcond = NULL;
+	pf_mutex = NULL;
+}
@@ -331,6 +331,9 @@ CL_PrepRefresh(void)
 	/* the renderer can now free unneeded stuff */
 	R_EndRegistration();
 
+	/* drop prefetched files nobody asked for */
+	CL_PrefetchFlush();
+
 	/* clear any lines of console text */
 	Con_ClearNotify();
 
@@ -243,6 +243,9 @@ typedef struct
 	dltype_t	downloadtype;
 	size_t		downloadposition;
 	int			downloadpercent;
+	int			downloadacked; /* offset last reported to the server */
+	int			downloadresume; /* offset last asked for again, -1 for none */
+	int			downloadresumetime;
 
 	/* demo recording info must be here, so it isn't cleared on level change */
 	qboolean	demorecording;
@@ -458,6 +461,13 @@ void CL_Snd_Restart_f (void);
 void CL_RequestNextDownload (void);
 void CL_ResetPrecacheCheck (void);	// unused
 
+void CL_PrefetchInit (void);
+void CL_PrefetchShutdown (void);
+void CL_PrefetchConfigString (int index);
+int CL_PrefetchTake (const char *name, void **buffer, qboolean *fromprotected);
+void CL_PrefetchFrame (void);
+void CL_PrefetchFlush (void);
+
 typedef struct
 {
 	int			down[2]; /* key nums holding it down */
@@ -25,6 +25,7 @@
  * =======================================================================
  */
 
+#include <limits.h>
 #include <stdint.h>
 
 #include "header/common.h"
@@ -35,6 +36,19 @@ typedef struct
 	int			children[2]; /* negative numbers are leafs */
 } cnode_t;
 
+/* Node layout used by traces. The splitting plane is stored
+   inline, so walking down the tree touches one cache line per
+   node instead of chasing cnode_t -> cplane_t. Built from
+   map_nodes and map_planes when a map is loaded. */
+typedef struct
+{
+	float		normal[3];
+	float		dist;
+	int			type;
+	int			children[2]; /* negative numbers are leafs */
+	int			pad;
+} ctracenode_t;
+
 typedef struct
 {
 	cplane_t	*plane;
@@ -55,7 +69,6 @@ typedef struct
 	int			contents;
 	unsigned int			numsides;
 	unsigned int			firstbrushside;
-	int			checkcount;	/* to avoid repeated testings */
 } cbrush_t;
 
 typedef struct
@@ -66,11 +79,77 @@ typedef struct
 	int		floodvalid;
 } carea_t;
 
+/* Slot of the on demand PVS / PHS row cache, used
+   when the expanded matrix would be too large. */
+typedef struct cvisslot_s
+{
+	int		key; /* cluster * 2 + DVIS_PVS / DVIS_PHS, -1 if unused */
+	byte	*row;
+	struct cvisslot_s	*prev, *next; /* LRU order, most recently used first */
+	struct cvisslot_s	*hashnext;
+} cvisslot_t;
+
+#define VISCACHE_SLOTS 128
+#define VISCACHE_HASH 256
+
+/* The box hull handed out by CM_HeadnodeForBox(). Every thread
+   has its own copy of the template built by CM_InitBoxHull(), so
+   threads can clip against different boxes at the same time. */
+typedef struct
+{
+	int			generation; /* of the template this was copied from */
+	cplane_t	planes[12];
+	cnode_t		nodes[6];
+	ctracenode_t	tracenodes[6];
+	cbrushside_t	sides[6];
+} cboxhull_t;
+
+/* Everything a thread changes while tracing. The rest of
+   the collision data is read only once a map is loaded. */
+typedef struct
+{
+	cboxhull_t	box;
+	int			markcount;
+	int			brushmarks[MAX_MAP_BRUSHES]; /* markcount of the last trace that tested the brush */
+} cmthread_t;
+
+/* State of a single trace, lives on the stack of CM_BoxTrace(). */
+typedef struct
+{
+	trace_t		trace;
+	vec3_t		start, end;
+	vec3_t		mins, maxs;
+	vec3_t		extents;
+	int			contents;
+	qboolean	ispoint; /* optimized case */
+	const ctracenode_t	*nodes; /* map_tracenodes or the box hull */
+	int			firstnode; /* node number of nodes[0] */
+	const cbrushside_t	*brushsides; /* map_brushsides or the box hull */
+	int			firstbrushside; /* side number of brushsides[0] */
+	int			*brushmarks;
+	int			markcount;
+} cmtrace_t;
+
+/* Leaf list and bounds of a CM_BoxLeafnums() walk. */
+typedef struct
+{
+	const float	*mins, *maxs;
+	int			*list;
+	int			count, maxcount;
+	int			topnode;
+} cmleafs_t;
+
 static byte *cmod_base;
 static byte map_visibility[MAX_MAP_VISIBILITY];
 // DG: is casted to int32_t* in SV_FatPVS() so align accordingly
-static YQ2_ALIGNAS_TYPE(int32_t) byte pvsrow[MAX_MAP_LEAFS / 8];
-static byte phsrow[MAX_MAP_LEAFS / 8];
+static YQ2_ALIGNAS_TYPE(int32_t) byte vis_nullrow[MAX_MAP_LEAFS / 8];
+static YQ2_ALIGNAS_TYPE(int32_t) byte vis_allrow[MAX_MAP_LEAFS / 8];
+static byte *vis_matrix;
+static byte *vis_slotrows;
+static cvisslot_t vis_slots[VISCACHE_SLOTS];
+static cvisslot_t *vis_hash[VISCACHE_HASH];
+static cvisslot_t vis_lru;
+static int vis_rowsize;
 static carea_t	map_areas[MAX_MAP_AREAS];
 static cbrush_t map_brushes[MAX_MAP_BRUSHES];
 static cbrushside_t map_brushsides[MAX_MAP_BRUSHSIDES];
@@ -81,19 +160,17 @@ static cleaf_t *box_leaf;
 static cleaf_t	map_leafs[MAX_MAP_LEAFS];
 static cmodel_t map_cmodels[MAX_MAP_MODELS];
 static cnode_t	map_nodes[MAX_MAP_NODES+6]; /* extra for box hull */
+static YQ2_ALIGNAS_TYPE(double) ctracenode_t map_tracenodes[MAX_MAP_NODES+6];
 static cplane_t *box_planes;
 static cplane_t map_planes[MAX_MAP_PLANES+12]; /* extra for box hull */
 static cvar_t *map_noareas;
+static cvar_t *cm_viscache;
 static dareaportal_t map_areaportals[MAX_MAP_AREAPORTALS];
 static dvis_t *map_vis = (dvis_t *)map_visibility;
 static int box_headnode;
-static int checkcount;
+static int box_generation;
 static int emptyleaf, solidleaf;
 static int floodvalid;
-static float *leaf_mins, *leaf_maxs;
-static int leaf_count, leaf_maxcount;
-static int *leaf_list;
-static int leaf_topnode;
 static int numareaportals;
 static int numareas = 1;
 static int numbrushes;
@@ -107,20 +184,16 @@ static int numnodes;
 static int numplanes;
 int numtexinfo;
 static int numvisibility;
-static int trace_contents;
 mapsurface_t map_surfaces[MAX_MAP_TEXINFO];
 static mapsurface_t nullsurface;
 static qboolean portalopen[MAX_MAP_AREAPORTALS];
-static qboolean trace_ispoint; /* optimized case */
-static trace_t trace_trace;
 static unsigned short map_leafbrushes[MAX_MAP_LEAFBRUSHES];
-static vec3_t trace_start, trace_end;
-static vec3_t trace_mins, trace_maxs;
-static vec3_t trace_extents;
+
+static YQ2_THREAD_LOCAL cmthread_t cm_thread;
 
 #ifndef DEDICATED_ONLY
-int		c_pointcontents;
-int		c_traces, c_brush_traces;
+YQ2_THREAD_LOCAL int c_pointcontents;
+YQ2_THREAD_LOCAL int c_traces, c_brush_traces;
 #endif
 
 /* 1/32 epsilon to keep floating point happy */
@@ -278,7 +351,7 @@ CM_ReadPortalState(fileHandle_t f)
  * is potentially visible
  */
 qboolean
-CM_HeadnodeVisible(int nodenum, byte *visbits)
+CM_HeadnodeVisible(int nodenum, const byte *visbits)
 {
 	const cnode_t *node;
 
@@ -313,6 +386,31 @@ CM_HeadnodeVisible(int nodenum, byte *visbits)
 	return CM_HeadnodeVisible(node->children[1], visbits);
 }
 
+/*
+ * Sets the bits of all clusters below the given node,
+ * i.e. everything CM_HeadnodeVisible() would look at.
+ */
+void
+CM_HeadnodeClusters(int nodenum, byte *clusterbits)
+{
+	const cnode_t *node;
+	int cluster;
+
+	while (nodenum >= 0)
+	{
+		node = &map_nodes[nodenum];
+		CM_HeadnodeClusters(node->children[0], clusterbits);
+		nodenum = node->children[1];
+	}
+
+	cluster = map_leafs[-1 - nodenum].cluster;
+
+	if (cluster != -1)
+	{
+		clusterbits[cluster >> 3] |= 1 << (cluster & 7);
+	}
+}
+
 /*
  * Set up the planes and nodes so that the six floats of a bounding box
  * can just be stored out and get a proper clipping hull structure.
@@ -325,6 +423,7 @@ CM_InitBoxHull(void)
 
 	box_headnode = numnodes;
 	box_planes = &map_planes[numplanes];
+	box_generation++;
 
 	if ((numnodes + 6 > MAX_MAP_NODES) ||
 		(numbrushes + 1 > MAX_MAP_BRUSHES) ||
@@ -390,49 +489,132 @@ CM_InitBoxHull(void)
 	}
 }
 
+/*
+ * Builds the packed nodes used by traces. Must run after
+ * CM_InitBoxHull(), the box hull is part of the tree.
+ */
+static void
+CM_InitTraceNodes(void)
+{
+	const cnode_t *in;
+	ctracenode_t *out;
+	int i;
+
+	for (i = 0; i < numnodes + 6; i++)
+	{
+		in = &map_nodes[i];
+		out = &map_tracenodes[i];
+
+		VectorCopy(in->plane->normal, out->normal);
+		out->dist = in->plane->dist;
+		out->type = in->plane->type;
+		out->children[0] = in->children[0];
+		out->children[1] = in->children[1];
+		out->pad = 0;
+	}
+}
+
+/*
+ * Copies the box hull template of the current map into
+ * the calling thread's box hull.
+ */
+static void
+CM_CopyBoxHull(cboxhull_t *box)
+{
+	int i;
+
+	memcpy(box->planes, box_planes, sizeof(box->planes));
+	memcpy(box->nodes, &map_nodes[box_headnode], sizeof(box->nodes));
+	memcpy(box->tracenodes, &map_tracenodes[box_headnode], sizeof(box->tracenodes));
+	memcpy(box->sides, &map_brushsides[box_brush->firstbrushside], sizeof(box->sides));
+
+	for (i = 0; i < 6; i++)
+	{
+		box->nodes[i].plane = &box->planes[i * 2];
+		box->sides[i].plane = &box->planes[i * 2 + (i & 1)];
+	}
+
+	box->generation = box_generation;
+}
+
 /*
  * To keep everything totally uniform, bounding boxes are turned into
- * small BSP trees instead of being compared directly.
+ * small BSP trees instead of being compared directly. The returned
+ * headnode refers to the calling thread's box until its next call.
  */
 int
 CM_HeadnodeForBox(vec3_t mins, vec3_t maxs)
 {
-	box_planes[0].dist = maxs[0];
-	box_planes[1].dist = -maxs[0];
-	box_planes[2].dist = mins[0];
-	box_planes[3].dist = -mins[0];
-	box_planes[4].dist = maxs[1];
-	box_planes[5].dist = -maxs[1];
-	box_planes[6].dist = mins[1];
-	box_planes[7].dist = -mins[1];
-	box_planes[8].dist = maxs[2];
-	box_planes[9].dist = -maxs[2];
-	box_planes[10].dist = mins[2];
-	box_planes[11].dist = -mins[2];
+	cboxhull_t *box;
+	int i;
+
+	box = &cm_thread.box;
+
+	if (box->generation != box_generation)
+	{
+		CM_CopyBoxHull(box);
+	}
+
+	box->planes[0].dist = maxs[0];
+	box->planes[1].dist = -maxs[0];
+	box->planes[2].dist = mins[0];
+	box->planes[3].dist = -mins[0];
+	box->planes[4].dist = maxs[1];
+	box->planes[5].dist = -maxs[1];
+	box->planes[6].dist = mins[1];
+	box->planes[7].dist = -mins[1];
+	box->planes[8].dist = maxs[2];
+	box->planes[9].dist = -maxs[2];
+	box->planes[10].dist = mins[2];
+	box->planes[11].dist = -mins[2];
+
+	for (i = 0; i < 6; i++)
+	{
+		box->tracenodes[i].dist = box->planes[i * 2].dist;
+	}
 
 	return box_headnode;
 }
 
+/*
+ * Returns the nodes a walk starting at headnode goes through,
+ * either the map's or the calling thread's box hull, and the
+ * node number of the first one in firstnode.
+ */
+static const ctracenode_t *
+CM_TraceNodes(int headnode, int *firstnode)
+{
+	if (headnode >= box_headnode)
+	{
+		*firstnode = box_headnode;
+		return cm_thread.box.tracenodes;
+	}
+
+	*firstnode = 0;
+	return map_tracenodes;
+}
+
 static int
 CM_PointLeafnum_r(vec3_t p, int num)
 {
 	float d;
-	cnode_t *node;
-	cplane_t *plane;
+	const ctracenode_t *nodes, *node;
+	int firstnode;
+
+	nodes = CM_TraceNodes(num, &firstnode);
 
 	while (num >= 0)
 	{
-		node = map_nodes + num;
-		plane = node->plane;
+		node = &nodes[num - firstnode];
 
-		if (plane->type < 3)
+		if (node->type < 3)
 		{
-			d = p[plane->type] - plane->dist;
+			d = p[node->type] - node->dist;
 		}
 
 		else
 		{
-			d = DotProduct(plane->normal, p) - plane->dist;
+			d = DotProduct(node->normal, p) - node->dist;
 		}
 
 		if (d < 0)
@@ -468,28 +650,29 @@ CM_PointLeafnum(vec3_t p)
  * Fills in a list of all the leafs touched
  */
 static void
-CM_BoxLeafnums_r(int nodenum)
+CM_BoxLeafnums_r(cmleafs_t *leafs, const cnode_t *nodes, int firstnode,
+		int nodenum)
 {
 	while (1)
 	{
 		cplane_t *plane;
-		cnode_t *node;
+		const cnode_t *node;
 		int s;
 
 		if (nodenum < 0)
 		{
-			if (leaf_count >= leaf_maxcount)
+			if (leafs->count >= leafs->maxcount)
 			{
 				return;
 			}
 
-			leaf_list[leaf_count++] = -1 - nodenum;
+			leafs->list[leafs->count++] = -1 - nodenum;
 			return;
 		}
 
-		node = &map_nodes[nodenum];
+		node = &nodes[nodenum - firstnode];
 		plane = node->plane;
-		s = BOX_ON_PLANE_SIDE(leaf_mins, leaf_maxs, plane);
+		s = BOX_ON_PLANE_SIDE(leafs->mins, leafs->maxs, plane);
 
 		if (s == 1)
 		{
@@ -504,12 +687,12 @@ CM_BoxLeafnums_r(int nodenum)
 		else
 		{
 			/* go down both */
-			if (leaf_topnode == -1)
+			if (leafs->topnode == -1)
 			{
-				leaf_topnode = nodenum;
+				leafs->topnode = nodenum;
 			}
 
-			CM_BoxLeafnums_r(node->children[0]);
+			CM_BoxLeafnums_r(leafs, nodes, firstnode, node->children[0]);
 			nodenum = node->children[1];
 		}
 	}
@@ -519,22 +702,31 @@ static int
 CM_BoxLeafnums_headnode(vec3_t mins, vec3_t maxs, int *list,
 		int listsize, int headnode, int *topnode)
 {
-	leaf_list = list;
-	leaf_count = 0;
-	leaf_maxcount = listsize;
-	leaf_mins = mins;
-	leaf_maxs = maxs;
+	cmleafs_t leafs;
+
+	leafs.list = list;
+	leafs.count = 0;
+	leafs.maxcount = listsize;
+	leafs.mins = mins;
+	leafs.maxs = maxs;
+	leafs.topnode = -1;
 
-	leaf_topnode = -1;
+	if (headnode >= box_headnode)
+	{
+		CM_BoxLeafnums_r(&leafs, cm_thread.box.nodes, box_headnode, headnode);
+	}
 
-	CM_BoxLeafnums_r(headnode);
+	else
+	{
+		CM_BoxLeafnums_r(&leafs, map_nodes, 0, headnode);
+	}
 
 	if (topnode)
 	{
-		*topnode = leaf_topnode;
+		*topnode = leafs.topnode;
 	}
 
-	return leaf_count;
+	return leafs.count;
 }
 
 int
@@ -592,9 +784,89 @@ CM_TransformedPointContents(vec3_t p, int headnode,
 	return map_leafs[l].contents;
 }
 
+/*
+ * Trace recording. cm_tracerecord writes the arguments of every
+ * CM_BoxTrace() call to a file, cm_tracebench replays them against
+ * the loaded map. Traces against the box hull carry the box with
+ * them, their headnode is stored as -1.
+ */
+#define TRACEFILE_IDENT (('R' << 24) + ('T' << 16) + ('M' << 8) + 'C')
+#define TRACEFILE_VERSION 1
+
+typedef struct
+{
+	int ident;
+	int version;
+	int numnodes;
+	int numleafs;
+	int numtraces;
+	char mapname[MAX_QPATH];
+} tracefileheader_t;
+
+typedef struct
+{
+	float start[3], end[3];
+	float mins[3], maxs[3];
+	float boxmins[3], boxmaxs[3];
+	int headnode;
+	int brushmask;
+} tracefileentry_t;
+
+static FILE *cm_recording;
+static sysMutex_t *cm_recordlock; /* traces may come from several threads */
+static tracefileheader_t cm_recordheader;
+
 static void
-CM_ClipBoxToBrush(vec3_t mins, vec3_t maxs, vec3_t p1,
-		vec3_t p2, trace_t *trace, cbrush_t *brush)
+CM_RecordTrace(const vec3_t start, const vec3_t end, const vec3_t mins,
+		const vec3_t maxs, int headnode, int brushmask)
+{
+	tracefileentry_t entry;
+
+	memset(&entry, 0, sizeof(entry));
+	VectorCopy(start, entry.start);
+	VectorCopy(end, entry.end);
+	VectorCopy(mins, entry.mins);
+	VectorCopy(maxs, entry.maxs);
+	entry.headnode = headnode;
+	entry.brushmask = brushmask;
+
+	if (numnodes && (headnode == box_headnode))
+	{
+		const cplane_t *planes = cm_thread.box.planes;
+
+		entry.boxmaxs[0] = planes[0].dist;
+		entry.boxmins[0] = planes[2].dist;
+		entry.boxmaxs[1] = planes[4].dist;
+		entry.boxmins[1] = planes[6].dist;
+		entry.boxmaxs[2] = planes[8].dist;
+		entry.boxmins[2] = planes[10].dist;
+		entry.headnode = -1;
+	}
+
+	Sys_LockMutex(cm_recordlock);
+	fwrite(&entry, sizeof(entry), 1, cm_recording);
+	cm_recordheader.numtraces++;
+	Sys_UnlockMutex(cm_recordlock);
+}
+
+static void
+CM_StopRecording(void)
+{
+	if (!cm_recording)
+	{
+		return;
+	}
+
+	fseek(cm_recording, 0, SEEK_SET);
+	fwrite(&cm_recordheader, sizeof(cm_recordheader), 1, cm_recording);
+	fclose(cm_recording);
+	cm_recording = NULL;
+
+	Com_Printf("Recorded %i traces.\n", cm_recordheader.numtraces);
+}
+
+static void
+CM_ClipBoxToBrush(cmtrace_t *tr, const cbrush_t *brush)
 {
 	int i, j;
 	cplane_t *plane, *clipplane;
@@ -604,7 +876,8 @@ CM_ClipBoxToBrush(vec3_t mins, vec3_t maxs, vec3_t p1,
 	float d1, d2;
 	qboolean getout, startout;
 	float f;
-	cbrushside_t *side, *leadside;
+	const cbrushside_t *side, *leadside;
+	trace_t *trace;
 
 	enterfrac = -1;
 	leavefrac = 1;
@@ -619,16 +892,17 @@ CM_ClipBoxToBrush(vec3_t mins, vec3_t maxs, vec3_t p1,
 	c_brush_traces++;
 #endif
 
+	trace = &tr->trace;
 	getout = false;
 	startout = false;
 	leadside = NULL;
 
 	for (i = 0; i < brush->numsides; i++)
 	{
-		side = &map_brushsides[brush->firstbrushside + i];
+		side = &tr->brushsides[brush->firstbrushside + i - tr->firstbrushside];
 		plane = side->plane;
 
-		if (!trace_ispoint)
+		if (!tr->ispoint)
 		{
 			/* general box case
 			   push the plane out
@@ -637,12 +911,12 @@ CM_ClipBoxToBrush(vec3_t mins, vec3_t maxs, vec3_t p1,
 			{
 				if (plane->normal[j] < 0)
 				{
-					ofs[j] = maxs[j];
+					ofs[j] = tr->maxs[j];
 				}
 
 				else
 				{
-					ofs[j] = mins[j];
+					ofs[j] = tr->mins[j];
 				}
 			}
 
@@ -656,8 +930,8 @@ CM_ClipBoxToBrush(vec3_t mins, vec3_t maxs, vec3_t p1,
 			dist = plane->dist;
 		}
 
-		d1 = DotProduct(p1, plane->normal) - dist;
-		d2 = DotProduct(p2, plane->normal) - dist;
+		d1 = DotProduct(tr->start, plane->normal) - dist;
+		d2 = DotProduct(tr->end, plane->normal) - dist;
 
 		if (d2 > 0)
 		{
@@ -742,13 +1016,12 @@ CM_ClipBoxToBrush(vec3_t mins, vec3_t maxs, vec3_t p1,
 }
 
 static void
-CM_TestBoxInBrush(vec3_t mins, vec3_t maxs, vec3_t p1,
-		trace_t *trace, const cbrush_t *brush)
+CM_TestBoxInBrush(cmtrace_t *tr, const cbrush_t *brush)
 {
 	int i, j;
 	cplane_t *plane;
 	vec3_t ofs;
-	cbrushside_t *side;
+	const cbrushside_t *side;
 
 	if (!brush->numsides)
 	{
@@ -759,7 +1032,7 @@ CM_TestBoxInBrush(vec3_t mins, vec3_t maxs, vec3_t p1,
 	{
 		float d1, dist;
 
-		side = &map_brushsides[brush->firstbrushside + i];
+		side = &tr->brushsides[brush->firstbrushside + i - tr->firstbrushside];
 		plane = side->plane;
 
 		/* general box case
@@ -769,19 +1042,19 @@ CM_TestBoxInBrush(vec3_t mins, vec3_t maxs, vec3_t p1,
 		{
 			if (plane->normal[j] < 0)
 			{
-				ofs[j] = maxs[j];
+				ofs[j] = tr->maxs[j];
 			}
 
 			else
 			{
-				ofs[j] = mins[j];
+				ofs[j] = tr->mins[j];
 			}
 		}
 
 		dist = DotProduct(ofs, plane->normal);
 		dist = plane->dist - dist;
 
-		d1 = DotProduct(p1, plane->normal) - dist;
+		d1 = DotProduct(tr->start, plane->normal) - dist;
 
 		/* if completely in front of face, no intersection */
 		if (d1 > 0)
@@ -791,20 +1064,20 @@ CM_TestBoxInBrush(vec3_t mins, vec3_t maxs, vec3_t p1,
 	}
 
 	/* inside this brush */
-	trace->startsolid = trace->allsolid = true;
-	trace->fraction = 0;
-	trace->contents = brush->contents;
+	tr->trace.startsolid = tr->trace.allsolid = true;
+	tr->trace.fraction = 0;
+	tr->trace.contents = brush->contents;
 }
 
 static void
-CM_TraceToLeaf(int leafnum)
+CM_TraceToLeaf(cmtrace_t *tr, int leafnum)
 {
 	const cleaf_t *leaf;
 	int k;
 
 	leaf = &map_leafs[leafnum];
 
-	if (!(leaf->contents & trace_contents))
+	if (!(leaf->contents & tr->contents))
 	{
 		return;
 	}
@@ -818,22 +1091,21 @@ CM_TraceToLeaf(int leafnum)
 		brushnum = map_leafbrushes[leaf->firstleafbrush + k];
 		b = &map_brushes[brushnum];
 
-		if (b->checkcount == checkcount)
+		if (tr->brushmarks[brushnum] == tr->markcount)
 		{
 			continue; /* already checked this brush in another leaf */
 		}
 
-		b->checkcount = checkcount;
+		tr->brushmarks[brushnum] = tr->markcount;
 
-		if (!(b->contents & trace_contents))
+		if (!(b->contents & tr->contents))
 		{
 			continue;
 		}
 
-		CM_ClipBoxToBrush(trace_mins, trace_maxs, trace_start,
-				trace_end, &trace_trace, b);
+		CM_ClipBoxToBrush(tr, b);
 
-		if (!trace_trace.fraction)
+		if (!tr->trace.fraction)
 		{
 			return;
 		}
@@ -841,14 +1113,14 @@ CM_TraceToLeaf(int leafnum)
 }
 
 static void
-CM_TestInLeaf(int leafnum)
+CM_TestInLeaf(cmtrace_t *tr, int leafnum)
 {
 	const cleaf_t *leaf;
 	int k;
 
 	leaf = &map_leafs[leafnum];
 
-	if (!(leaf->contents & trace_contents))
+	if (!(leaf->contents & tr->contents))
 	{
 		return;
 	}
@@ -862,21 +1134,21 @@ CM_TestInLeaf(int leafnum)
 		brushnum = map_leafbrushes[leaf->firstleafbrush + k];
 		b = &map_brushes[brushnum];
 
-		if (b->checkcount == checkcount)
+		if (tr->brushmarks[brushnum] == tr->markcount)
 		{
 			continue; /* already checked this brush in another leaf */
 		}
 
-		b->checkcount = checkcount;
+		tr->brushmarks[brushnum] = tr->markcount;
 
-		if (!(b->contents & trace_contents))
+		if (!(b->contents & tr->contents))
 		{
 			continue;
 		}
 
-		CM_TestBoxInBrush(trace_mins, trace_maxs, trace_start, &trace_trace, b);
+		CM_TestBoxInBrush(tr, b);
 
-		if (!trace_trace.fraction)
+		if (!tr->trace.fraction)
 		{
 			return;
 		}
@@ -884,10 +1156,10 @@ CM_TestInLeaf(int leafnum)
 }
 
 static void
-CM_RecursiveHullCheck(int num, float p1f, float p2f, const vec3_t p1, const vec3_t p2)
+CM_RecursiveHullCheck(cmtrace_t *tr, int num, float p1f, float p2f,
+		const vec3_t p1, const vec3_t p2)
 {
-	cnode_t *node;
-	cplane_t *plane;
+	const ctracenode_t *node;
 	float t1, t2, offset;
 	float frac, frac2;
 	float idist;
@@ -896,7 +1168,7 @@ CM_RecursiveHullCheck(int num, float p1f, float p2f, const vec3_t p1, const vec3
 	int side;
 	float midf;
 
-	if (trace_trace.fraction <= p1f)
+	if (tr->trace.fraction <= p1f)
 	{
 		return; /* already hit something nearer */
 	}
@@ -904,50 +1176,49 @@ CM_RecursiveHullCheck(int num, float p1f, float p2f, const vec3_t p1, const vec3
 	/* if < 0, we are in a leaf node */
 	if (num < 0)
 	{
-		CM_TraceToLeaf(-1 - num);
+		CM_TraceToLeaf(tr, -1 - num);
 		return;
 	}
 
 	/* find the point distances to the seperating plane
 	   and the offset for the size of the box */
-	node = map_nodes + num;
-	plane = node->plane;
+	node = &tr->nodes[num - tr->firstnode];
 
-	if (plane->type < 3)
+	if (node->type < 3)
 	{
-		t1 = p1[plane->type] - plane->dist;
-		t2 = p2[plane->type] - plane->dist;
-		offset = trace_extents[plane->type];
+		t1 = p1[node->type] - node->dist;
+		t2 = p2[node->type] - node->dist;
+		offset = tr->extents[node->type];
 	}
 
 	else
 	{
-		t1 = DotProduct(plane->normal, p1) - plane->dist;
-		t2 = DotProduct(plane->normal, p2) - plane->dist;
+		t1 = DotProduct(node->normal, p1) - node->dist;
+		t2 = DotProduct(node->normal, p2) - node->dist;
 
-		if (trace_ispoint)
+		if (tr->ispoint)
 		{
 			offset = 0;
 		}
 
 		else
 		{
-			offset = (float)fabs(trace_extents[0] * plane->normal[0]) +
-					 (float)fabs(trace_extents[1] * plane->normal[1]) +
-					 (float)fabs(trace_extents[2] * plane->normal[2]);
+			offset = (float)fabs(tr->extents[0] * node->normal[0]) +
+					 (float)fabs(tr->extents[1] * node->normal[1]) +
+					 (float)fabs(tr->extents[2] * node->normal[2]);
 		}
 	}
 
 	/* see which sides we need to consider */
 	if ((t1 >= offset) && (t2 >= offset))
 	{
-		CM_RecursiveHullCheck(node->children[0], p1f, p2f, p1, p2);
+		CM_RecursiveHullCheck(tr, node->children[0], p1f, p2f, p1, p2);
 		return;
 	}
 
 	if ((t1 < -offset) && (t2 < -offset))
 	{
-		CM_RecursiveHullCheck(node->children[1], p1f, p2f, p1, p2);
+		CM_RecursiveHullCheck(tr, node->children[1], p1f, p2f, p1, p2);
 		return;
 	}
 
@@ -993,7 +1264,7 @@ CM_RecursiveHullCheck(int num, float p1f, float p2f, const vec3_t p1, const vec3
 		mid[i] = p1[i] + frac * (p2[i] - p1[i]);
 	}
 
-	CM_RecursiveHullCheck(node->children[side], p1f, midf, p1, mid);
+	CM_RecursiveHullCheck(tr, node->children[side], p1f, midf, p1, mid);
 
 	/* go past the node */
 	if (frac2 < 0)
@@ -1013,34 +1284,63 @@ CM_RecursiveHullCheck(int num, float p1f, float p2f, const vec3_t p1, const vec3
 		mid[i] = p1[i] + frac2 * (p2[i] - p1[i]);
 	}
 
-	CM_RecursiveHullCheck(node->children[side ^ 1], midf, p2f, mid, p2);
+	CM_RecursiveHullCheck(tr, node->children[side ^ 1], midf, p2f, mid, p2);
 }
 
 trace_t
 CM_BoxTrace(const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs,
 		int headnode, int brushmask)
 {
-	checkcount++; /* for multi-check avoidance */
+	cmtrace_t tr;
+
+	/* for multi-check avoidance */
+	if (cm_thread.markcount == INT_MAX)
+	{
+		memset(cm_thread.brushmarks, 0, sizeof(cm_thread.brushmarks));
+		cm_thread.markcount = 0;
+	}
+
+	tr.brushmarks = cm_thread.brushmarks;
+	tr.markcount = ++cm_thread.markcount;
 
 #ifndef DEDICATED_ONLY
 	c_traces++; /* for statistics, may be zeroed */
 #endif
 
+	if (cm_recording)
+	{
+		CM_RecordTrace(start, end, mins, maxs, headnode, brushmask);
+	}
+
 	/* fill in a default trace */
-	memset(&trace_trace, 0, sizeof(trace_trace));
-	trace_trace.fraction = 1;
-	trace_trace.surface = &(nullsurface.c);
+	memset(&tr.trace, 0, sizeof(tr.trace));
+	tr.trace.fraction = 1;
+	tr.trace.surface = &(nullsurface.c);
 
 	if (!numnodes)  /* map not loaded */
 	{
-		return trace_trace;
+		return tr.trace;
 	}
 
-	trace_contents = brushmask;
-	VectorCopy(start, trace_start);
-	VectorCopy(end, trace_end);
-	VectorCopy(mins, trace_mins);
-	VectorCopy(maxs, trace_maxs);
+	tr.nodes = CM_TraceNodes(headnode, &tr.firstnode);
+
+	if (headnode >= box_headnode)
+	{
+		tr.brushsides = cm_thread.box.sides;
+		tr.firstbrushside = box_brush->firstbrushside;
+	}
+
+	else
+	{
+		tr.brushsides = map_brushsides;
+		tr.firstbrushside = 0;
+	}
+
+	tr.contents = brushmask;
+	VectorCopy(start, tr.start);
+	VectorCopy(end, tr.end);
+	VectorCopy(mins, tr.mins);
+	VectorCopy(maxs, tr.maxs);
 
 	/* check for position test special case */
 	if ((start[0] == end[0]) && (start[1] == end[1]) && (start[2] == end[2]))
@@ -1064,40 +1364,40 @@ CM_BoxTrace(const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_
 
 		for (i = 0; i < numleafs; i++)
 		{
-			CM_TestInLeaf(leafs[i]);
+			CM_TestInLeaf(&tr, leafs[i]);
 
-			if (trace_trace.allsolid)
+			if (tr.trace.allsolid)
 			{
 				break;
 			}
 		}
 
-		VectorCopy(start, trace_trace.endpos);
-		return trace_trace;
+		VectorCopy(start, tr.trace.endpos);
+		return tr.trace;
 	}
 
 	/* check for point special case */
 	if ((mins[0] == 0) && (mins[1] == 0) && (mins[2] == 0) &&
 		(maxs[0] == 0) && (maxs[1] == 0) && (maxs[2] == 0))
 	{
-		trace_ispoint = true;
-		VectorClear(trace_extents);
+		tr.ispoint = true;
+		VectorClear(tr.extents);
 	}
 
 	else
 	{
-		trace_ispoint = false;
-		trace_extents[0] = -mins[0] > maxs[0] ? -mins[0] : maxs[0];
-		trace_extents[1] = -mins[1] > maxs[1] ? -mins[1] : maxs[1];
-		trace_extents[2] = -mins[2] > maxs[2] ? -mins[2] : maxs[2];
+		tr.ispoint = false;
+		tr.extents[0] = -mins[0] > maxs[0] ? -mins[0] : maxs[0];
+		tr.extents[1] = -mins[1] > maxs[1] ? -mins[1] : maxs[1];
+		tr.extents[2] = -mins[2] > maxs[2] ? -mins[2] : maxs[2];
 	}
 
 	/* general sweeping through world */
-	CM_RecursiveHullCheck(headnode, 0, 1, start, end);
+	CM_RecursiveHullCheck(&tr, headnode, 0, 1, start, end);
 
-	if (trace_trace.fraction == 1)
+	if (tr.trace.fraction == 1)
 	{
-		VectorCopy(end, trace_trace.endpos);
+		VectorCopy(end, tr.trace.endpos);
 	}
 
 	else
@@ -1106,12 +1406,12 @@ CM_BoxTrace(const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_
 
 		for (i = 0; i < 3; i++)
 		{
-			trace_trace.endpos[i] = start[i] + trace_trace.fraction *
-									(end[i] - start[i]);
+			tr.trace.endpos[i] = start[i] + tr.trace.fraction *
+								 (end[i] - start[i]);
 		}
 	}
 
-	return trace_trace;
+	return tr.trace;
 }
 
 /*
@@ -1699,19 +1999,305 @@ CMod_LoadEntityString(const lump_t *l, const char *name)
 	map_entitystring[numentitychars] = 0;
 }
 
+void
+CM_DecompressVis(byte *in, byte *out)
+{
+	int c;
+	byte *out_p;
+	int row;
+
+	row = (numclusters + 7) >> 3;
+	out_p = out;
+
+	if (!in || !numvisibility)
+	{
+		/* no vis info, so make all visible */
+		while (row)
+		{
+			*out_p++ = 0xff;
+			row--;
+		}
+
+		return;
+	}
+
+	do
+	{
+		if (*in)
+		{
+			*out_p++ = *in++;
+			continue;
+		}
+
+		c = in[1];
+		in += 2;
+
+		if ((out_p - out) + c > row)
+		{
+			c = row - (out_p - out);
+			Com_DPrintf("warning: Vis decompression overrun\n");
+		}
+
+		while (c)
+		{
+			*out_p++ = 0;
+			c--;
+		}
+	}
+	while (out_p - out < row);
+}
+
+static void
+CM_DecompressClusterVis(int cluster, int type, byte *out)
+{
+	memset(out, 0, vis_rowsize);
+
+	/* Leafs may reference clusters the vis lump doesn't know. */
+	if (cluster < map_vis->numclusters)
+	{
+		CM_DecompressVis(map_visibility +
+				LittleLong(map_vis->bitofs[cluster][type]), out);
+	}
+}
+
+/*
+ * Returns the row of the LRU cache holding the given cluster,
+ * decompressing it into the least recently used slot on a miss.
+ */
+static const byte *
+CM_CachedClusterVis(int cluster, int type)
+{
+	cvisslot_t *slot, **link;
+	int key;
+
+	key = cluster * 2 + type;
+
+	for (slot = vis_hash[key & (VISCACHE_HASH - 1)]; slot; slot = slot->hashnext)
+	{
+		if (slot->key == key)
+		{
+			break;
+		}
+	}
+
+	if (!slot)
+	{
+		/* Evict the least recently used row. */
+		slot = vis_lru.prev;
+
+		if (slot->key != -1)
+		{
+			for (link = &vis_hash[slot->key & (VISCACHE_HASH - 1)]; *link; link = &(*link)->hashnext)
+			{
+				if (*link == slot)
+				{
+					*link = slot->hashnext;
+					break;
+				}
+			}
+		}
+
+		slot->key = key;
+		slot->hashnext = vis_hash[key & (VISCACHE_HASH - 1)];
+		vis_hash[key & (VISCACHE_HASH - 1)] = slot;
+
+		CM_DecompressClusterVis(cluster, type, slot->row);
+	}
+
+	/* Move to the front of the LRU list. */
+	slot->prev->next = slot->next;
+	slot->next->prev = slot->prev;
+	slot->next = vis_lru.next;
+	slot->prev = &vis_lru;
+	vis_lru.next->prev = slot;
+	vis_lru.next = slot;
+
+	return slot->row;
+}
+
+static const byte *
+CM_ClusterVis(int cluster, int type)
+{
+	if ((cluster < 0) || (cluster >= numclusters))
+	{
+		return vis_nullrow;
+	}
+
+	if (!numvisibility)
+	{
+		return vis_allrow;
+	}
+
+	if (vis_matrix)
+	{
+		return vis_matrix + ((size_t)cluster * 2 + type) * vis_rowsize;
+	}
+
+	return CM_CachedClusterVis(cluster, type);
+}
+
+/*
+ * Rows are valid until the next map is loaded. On maps too
+ * large for cm_viscache they're only guaranteed to be valid
+ * for the next VISCACHE_SLOTS - 1 calls.
+ */
+const byte *
+CM_ClusterPVS(int cluster)
+{
+	return CM_ClusterVis(cluster, DVIS_PVS);
+}
+
+const byte *
+CM_ClusterPHS(int cluster)
+{
+	return CM_ClusterVis(cluster, DVIS_PHS);
+}
+
+static void
+CM_FreeVisCache(void)
+{
+	if (vis_matrix)
+	{
+		Z_Free(vis_matrix);
+		vis_matrix = NULL;
+	}
+
+	if (vis_slotrows)
+	{
+		Z_Free(vis_slotrows);
+		vis_slotrows = NULL;
+	}
+}
+
+/*
+ * Expands the PVS and PHS of all clusters into one bit
+ * matrix if it fits into cm_viscache megabytes. Otherwise
+ * rows are decompressed on demand into an LRU cache.
+ */
+static void
+CM_InitVisCache(qboolean expand)
+{
+	size_t size;
+	int i;
+
+	/* Rows are read as int32_t by SV_FatPVS(). */
+	vis_rowsize = ((numclusters + 31) >> 5) << 2;
+
+	memset(vis_allrow, 0, sizeof(vis_allrow));
+	memset(vis_allrow, 0xff, (numclusters + 7) >> 3);
+
+	if (!numvisibility)
+	{
+		return;
+	}
+
+	size = (size_t)numclusters * 2 * vis_rowsize;
+
+	if (expand && (cm_viscache->value > 0) && (size < INT_MAX) &&
+		(size <= (size_t)(cm_viscache->value * 1024 * 1024)))
+	{
+		vis_matrix = Z_Malloc((int)size);
+
+		for (i = 0; i < numclusters; i++)
+		{
+			CM_DecompressClusterVis(i, DVIS_PVS,
+					vis_matrix + ((size_t)i * 2 + DVIS_PVS) * vis_rowsize);
+			CM_DecompressClusterVis(i, DVIS_PHS,
+					vis_matrix + ((size_t)i * 2 + DVIS_PHS) * vis_rowsize);
+		}
+
+		Com_DPrintf("%s: expanded %i clusters, %i kb\n", __func__,
+				numclusters, (int)(size / 1024));
+
+		return;
+	}
+
+	vis_slotrows = Z_Malloc(VISCACHE_SLOTS * vis_rowsize);
+	memset(vis_hash, 0, sizeof(vis_hash));
+
+	vis_lru.next = vis_lru.prev = &vis_lru;
+
+	for (i = 0; i < VISCACHE_SLOTS; i++)
+	{
+		vis_slots[i].key = -1;
+		vis_slots[i].row = vis_slotrows + i * vis_rowsize;
+		vis_slots[i].hashnext = NULL;
+
+		vis_slots[i].next = vis_lru.next;
+		vis_slots[i].prev = &vis_lru;
+		vis_lru.next->prev = &vis_slots[i];
+		vis_lru.next = &vis_slots[i];
+	}
+}
+
+/*
+ * The lumps are read in place as the structs they hold. A
+ * mapped file may start anywhere in its pack and a lump
+ * anywhere in the file, so if one of them isn't aligned
+ * for those structs the lumps are copied into a buffer
+ * of their own. Returns that buffer, or NULL if the
+ * lumps can be used where they are.
+ */
+static byte *
+CMod_AlignLumps(const byte *buf, int length, dheader_t *header)
+{
+	qboolean aligned;
+	lump_t *l;
+	byte *copy;
+	int i, size;
+
+	aligned = !((size_t)buf & 3);
+	size = 0;
+
+	for (i = 0; i < HEADER_LUMPS; i++)
+	{
+		l = &header->lumps[i];
+
+		if ((l->fileofs < 0) || (l->filelen < 0) ||
+			(l->fileofs > length - l->filelen))
+		{
+			Com_Error(ERR_DROP, "%s: lump %i out of bounds", __func__, i);
+		}
+
+		aligned = aligned && !(l->fileofs & 3);
+		size += (l->filelen + 3) & ~3;
+	}
+
+	if (aligned)
+	{
+		return NULL;
+	}
+
+	copy = Z_Malloc(size);
+	size = 0;
+
+	for (i = 0; i < HEADER_LUMPS; i++)
+	{
+		l = &header->lumps[i];
+
+		memcpy(copy + size, buf + l->fileofs, l->filelen);
+		l->fileofs = size;
+		size += (l->filelen + 3) & ~3;
+	}
+
+	return copy;
+}
+
 /*
  * Loads in the map and all submodels
  */
 cmodel_t *
 CM_LoadMap(char *name, qboolean clientload, unsigned *checksum)
 {
-	unsigned *buf;
+	const byte *buf;
+	byte *copy;
 	int i;
 	dheader_t header;
 	int length;
 	static unsigned last_checksum;
 
 	map_noareas = Cvar_Get("map_noareas", "0", 0);
+	cm_viscache = Cvar_Get("cm_viscache", "32", 0);
 
 	if (strcmp(map_name, name) == 0
 		&& (clientload || !Cvar_VariableValue("flushmap")))
@@ -1728,6 +2314,8 @@ CM_LoadMap(char *name, qboolean clientload, unsigned *checksum)
 	}
 
 	/* free old stuff */
+	CM_StopRecording();
+	CM_FreeVisCache();
 	numplanes = 0;
 	numnodes = 0;
 	numleafs = 0;
@@ -1743,20 +2331,28 @@ CM_LoadMap(char *name, qboolean clientload, unsigned *checksum)
 		numclusters = 1;
 		numareas = 1;
 		*checksum = 0;
+		CM_InitVisCache(false);
 		return &map_cmodels[0]; /* cinematic servers won't have anything at all */
 	}
 
-	length = FS_LoadFile(name, (void **)&buf);
+	/* The lumps are copied out, no need for a private copy. */
+	length = FS_MapFile(name, (const void **)&buf);
 
 	if (!buf)
 	{
 		Com_Error(ERR_DROP, "Couldn't load %s", name);
 	}
 
+	if (length < (int)sizeof(dheader_t))
+	{
+		FS_FreeFile((void *)buf);
+		Com_Error(ERR_DROP, "%s: %s is too short", __func__, name);
+	}
+
 	last_checksum = LittleLong(Com_BlockChecksum(buf, length));
 	*checksum = last_checksum;
 
-	header = *(dheader_t *)buf;
+	memcpy(&header, buf, sizeof(header));
 
 	for (i = 0; i < sizeof(dheader_t) / 4; i++)
 	{
@@ -1770,7 +2366,8 @@ CM_LoadMap(char *name, qboolean clientload, unsigned *checksum)
 				name, header.version, BSPVERSION);
 	}
 
-	cmod_base = (byte *)buf;
+	copy = CMod_AlignLumps(buf, length, &header);
+	cmod_base = copy ? copy : (byte *)buf;
 
 	/* load into heap */
 	CMod_LoadSurfaces(&header.lumps[LUMP_TEXINFO]);
@@ -1787,9 +2384,19 @@ CM_LoadMap(char *name, qboolean clientload, unsigned *checksum)
 	/* From kmquake2: adding an extra parameter for .ent support. */
 	CMod_LoadEntityString(&header.lumps[LUMP_ENTITIES], name);
 
-	FS_FreeFile(buf);
+	if (copy)
+	{
+		Z_Free(copy);
+	}
+
+	FS_FreeFile((void *)buf);
 
 	CM_InitBoxHull();
+	CM_InitTraceNodes();
+
+	/* The client never asks for PVS rows, don't
+	   waste memory on the expanded matrix. */
+	CM_InitVisCache(!clientload);
 
 	memset(portalopen, 0, sizeof(portalopen));
 	FloodAreaConnections();
@@ -1870,84 +2477,154 @@ CM_LeafArea(int leafnum)
 	return map_leafs[leafnum].area;
 }
 
-void
-CM_DecompressVis(byte *in, byte *out)
-{
-	int c;
-	byte *out_p;
-	int row;
 
-	row = (numclusters + 7) >> 3;
-	out_p = out;
+static void
+CM_TraceRecord_f(void)
+{
+	char name[MAX_OSPATH];
 
-	if (!in || !numvisibility)
+	if (Cmd_Argc() < 2)
 	{
-		/* no vis info, so make all visible */
-		while (row)
+		if (!cm_recording)
 		{
-			*out_p++ = 0xff;
-			row--;
+			Com_Printf("Usage: cm_tracerecord <name>, again without name to stop.\n");
 		}
 
+		CM_StopRecording();
 		return;
 	}
 
-	do
+	if (!numnodes)
 	{
-		if (*in)
-		{
-			*out_p++ = *in++;
-			continue;
-		}
+		Com_Printf("No map loaded.\n");
+		return;
+	}
 
-		c = in[1];
-		in += 2;
+	CM_StopRecording();
 
-		if ((out_p - out) + c > row)
-		{
-			c = row - (out_p - out);
-			Com_DPrintf("warning: Vis decompression overrun\n");
-		}
+	if (!cm_recordlock && ((cm_recordlock = Sys_CreateMutex()) == NULL))
+	{
+		Com_Printf("Couldn't create the recording lock.\n");
+		return;
+	}
 
-		while (c)
-		{
-			*out_p++ = 0;
-			c--;
-		}
+	Com_sprintf(name, sizeof(name), "%s/traces/%s.trc", FS_Gamedir(), Cmd_Argv(1));
+	FS_CreatePath(name);
+
+	if ((cm_recording = Q_fopen(name, "wb")) == NULL)
+	{
+		Com_Printf("Couldn't open %s.\n", name);
+		return;
 	}
-	while (out_p - out < row);
+
+	memset(&cm_recordheader, 0, sizeof(cm_recordheader));
+	cm_recordheader.ident = TRACEFILE_IDENT;
+	cm_recordheader.version = TRACEFILE_VERSION;
+	cm_recordheader.numnodes = numnodes;
+	cm_recordheader.numleafs = numleafs;
+	Q_strlcpy(cm_recordheader.mapname, map_name, sizeof(cm_recordheader.mapname));
+
+	/* filled in when recording stops */
+	fwrite(&cm_recordheader, sizeof(cm_recordheader), 1, cm_recording);
+
+	Com_Printf("Recording traces to %s.\n", name);
 }
 
-byte *
-CM_ClusterPVS(int cluster)
+static void
+CM_TraceBench_f(void)
 {
-	if (cluster == -1)
+	const tracefileheader_t *header;
+	const tracefileentry_t *entry;
+	FILE *recording;
+	trace_t trace;
+	unsigned hash;
+	long long start, elapsed;
+	int i, pass, passes, len, headnode;
+	byte *buf;
+
+	if (Cmd_Argc() < 2)
 	{
-		memset(pvsrow, 0, (numclusters + 7) >> 3);
+		Com_Printf("Usage: cm_tracebench <name> [passes]\n");
+		return;
 	}
-	else
+
+	len = FS_LoadFile(va("traces/%s.trc", Cmd_Argv(1)), (void **)&buf);
+
+	if (!buf)
 	{
-		CM_DecompressVis(map_visibility +
-				LittleLong(map_vis->bitofs[cluster][DVIS_PVS]), pvsrow);
+		Com_Printf("Couldn't load traces/%s.trc.\n", Cmd_Argv(1));
+		return;
 	}
 
-	return pvsrow;
-}
+	header = (const tracefileheader_t *)buf;
 
-byte *
-CM_ClusterPHS(int cluster)
-{
-	if (cluster == -1)
+	if ((len < (int)sizeof(*header)) || (header->ident != TRACEFILE_IDENT) ||
+		(header->version != TRACEFILE_VERSION) || (header->numtraces < 0) ||
+		((len - (int)sizeof(*header)) / (int)sizeof(*entry) < header->numtraces))
 	{
-		memset(phsrow, 0, (numclusters + 7) >> 3);
+		Com_Printf("traces/%s.trc is not a trace recording.\n", Cmd_Argv(1));
+		FS_FreeFile(buf);
+		return;
 	}
 
-	else
+	if (strcmp(header->mapname, map_name) || (header->numnodes != numnodes) ||
+		(header->numleafs != numleafs))
 	{
-		CM_DecompressVis(map_visibility +
-				LittleLong(map_vis->bitofs[cluster][DVIS_PHS]), phsrow);
+		Com_Printf("Recorded on %s, load that map first.\n", header->mapname);
+		FS_FreeFile(buf);
+		return;
+	}
+
+	passes = (Cmd_Argc() > 2) ? Q_max(1, atoi(Cmd_Argv(2))) : 10;
+
+	/* don't record the replay */
+	recording = cm_recording;
+	cm_recording = NULL;
+
+	hash = 0;
+	start = Sys_Microseconds();
+
+	for (pass = 0; pass < passes; pass++)
+	{
+		entry = (const tracefileentry_t *)(header + 1);
+
+		for (i = 0; i < header->numtraces; i++, entry++)
+		{
+			headnode = entry->headnode;
+
+			if (headnode < 0)
+			{
+				headnode = CM_HeadnodeForBox((float *)entry->boxmins,
+						(float *)entry->boxmaxs);
+			}
+
+			trace = CM_BoxTrace(entry->start, entry->end, entry->mins,
+					entry->maxs, headnode, entry->brushmask);
+
+			if (!pass)
+			{
+				hash = hash * 31 + (unsigned)(trace.fraction * 65536.0f);
+				hash = hash * 31 + (trace.startsolid ? 1 : 0) +
+					(trace.allsolid ? 2 : 0);
+				hash = hash * 31 + trace.contents;
+			}
+		}
 	}
 
-	return phsrow;
+	elapsed = Sys_Microseconds() - start;
+	cm_recording = recording;
+
+	Com_Printf("%i traces, %i passes: %lld usec, %.1f nsec per trace, result hash %08x\n",
+			header->numtraces, passes, elapsed,
+			header->numtraces ? elapsed * 1000.0 / ((double)header->numtraces * passes) : 0.0,
+			hash);
+
+	FS_FreeFile(buf);
 }
 
+void
+CM_Init(void)
+{
+	Cmd_AddCommand("cm_tracerecord", CM_TraceRecord_f);
+	Cmd_AddCommand("cm_tracebench", CM_TraceBench_f);
+}
@@ -50,7 +50,10 @@ typedef struct
 	char name[MAX_QPATH];
 	fsMode_t mode;
 	FILE *file;           /* Only one will be used. */
-	unzFile *zip;        /* (file or zip) */
+	unzFile *zip;        /* (file or zip or mem) */
+	const byte *mem;     /* Stored entry in a mapped pack. */
+	int memsize;
+	int mempos;
 } fsHandle_t;
 
 typedef struct fsLink_s
@@ -65,7 +68,7 @@ typedef struct
 {
 	char name[MAX_QPATH];
 	int size;
-	int offset;     /* Ignored in PK3 files. */
+	int offset;     /* Data in PAK, central directory entry in PK3 files. */
 } fsPackFile_t;
 
 typedef struct
@@ -74,6 +77,8 @@ typedef struct
 	int numFiles;
 	FILE *pak;
 	unzFile *pk3;
+	byte *map;      /* The whole pack, if it could be mapped. */
+	size_t mapsize;
 	qboolean isProtectedPak;
 	fsPackFile_t *files;
 } fsPack_t;
@@ -176,6 +181,124 @@ static voidpf ZCALLBACK fopen_file_func_utf(voidpf opaque, const char *filename,
 }
 #endif
 
+/*
+ * minizip I/O on top of a memory mapped pack. The pack
+ * is passed instead of the file name to unzOpen2_64().
+ */
+
+typedef struct
+{
+	const byte *data;
+	ZPOS64_T size;
+	ZPOS64_T pos;
+} fsZipStream_t;
+
+static voidpf ZCALLBACK
+FS_ZipMapOpen(voidpf opaque, const void *filename, int mode)
+{
+	const fsPack_t *pack = filename;
+	fsZipStream_t *stream;
+
+	if ((pack == NULL) || (pack->map == NULL) ||
+		((mode & ZLIB_FILEFUNC_MODE_READWRITEFILTER) != ZLIB_FILEFUNC_MODE_READ))
+	{
+		return NULL;
+	}
+
+	if ((stream = malloc(sizeof(fsZipStream_t))) == NULL)
+	{
+		return NULL;
+	}
+
+	stream->data = pack->map;
+	stream->size = pack->mapsize;
+	stream->pos = 0;
+
+	return stream;
+}
+
+static uLong ZCALLBACK
+FS_ZipMapRead(voidpf opaque, voidpf stream, void *buf, uLong size)
+{
+	fsZipStream_t *zs = stream;
+
+	if (size > zs->size - zs->pos)
+	{
+		size = (uLong)(zs->size - zs->pos);
+	}
+
+	memcpy(buf, zs->data + zs->pos, size);
+	zs->pos += size;
+
+	return size;
+}
+
+static uLong ZCALLBACK
+FS_ZipMapWrite(voidpf opaque, voidpf stream, const void *buf, uLong size)
+{
+	return 0;
+}
+
+static ZPOS64_T ZCALLBACK
+FS_ZipMapTell(voidpf opaque, voidpf stream)
+{
+	return ((fsZipStream_t *)stream)->pos;
+}
+
+static long ZCALLBACK
+FS_ZipMapSeek(voidpf opaque, voidpf stream, ZPOS64_T offset, int origin)
+{
+	fsZipStream_t *zs = stream;
+	ZPOS64_T pos;
+
+	switch (origin)
+	{
+		case ZLIB_FILEFUNC_SEEK_SET:
+			pos = offset;
+			break;
+		case ZLIB_FILEFUNC_SEEK_CUR:
+			pos = zs->pos + offset;
+			break;
+		case ZLIB_FILEFUNC_SEEK_END:
+			pos = zs->size + offset;
+			break;
+		default:
+			return -1;
+	}
+
+	if (pos > zs->size)
+	{
+		return -1;
+	}
+
+	zs->pos = pos;
+	return 0;
+}
+
+static int ZCALLBACK
+FS_ZipMapClose(voidpf opaque, voidpf stream)
+{
+	free(stream);
+	return 0;
+}
+
+static int ZCALLBACK
+FS_ZipMapError(voidpf opaque, voidpf stream)
+{
+	return 0;
+}
+
+static zlib_filefunc64_def fs_zipmap_api = {
+	FS_ZipMapOpen,
+	FS_ZipMapRead,
+	FS_ZipMapWrite,
+	FS_ZipMapTell,
+	FS_ZipMapSeek,
+	FS_ZipMapClose,
+	FS_ZipMapError,
+	NULL
+};
+
 // --------
 
 /*
@@ -248,6 +371,9 @@ FS_CreatePath(const char *path)
 
 	Q_strlcpy(dir_path, path, sizeof(dir_path));
 
+	/* The caller is going to write something. */
+	FS_FlushDirCache();
+
 	cur = old = dir_path;
 
 	while (cur != NULL)
@@ -301,7 +427,7 @@ FS_HandleForFile(const char *path, fileHandle_t *f)
 
 	for (i = 0; i < MAX_HANDLES; i++, handle++)
 	{
-		if ((handle->file == NULL) && (handle->zip == NULL))
+		if ((handle->file == NULL) && (handle->zip == NULL) && (handle->mem == NULL))
 		{
 			Q_strlcpy(handle->name, path, sizeof(handle->name));
 			*f = i + 1;
@@ -355,6 +481,7 @@ FS_FCloseFile(fileHandle_t f)
 		unzClose(handle->zip);
 	}
 
+	/* Mapped entries belong to the pack. */
 	memset(handle, 0, sizeof(*handle));
 }
 
@@ -406,6 +533,465 @@ FS_PackQuickSearch(const fsPack_t *pak, const char *name)
 	return -1;
 }
 
+// --------
+
+/*
+ * Lookup acceleration. Every file inside the mounted packs is put
+ * into one case insensitive hash index, mapping the name to the pack
+ * that wins in search order. Loose files are resolved through a cache
+ * of directory listings, so probing a search directory for a file
+ * doesn't need a round trip to the kernel once it was read. Both are
+ * thrown away when the search path changes or something is written.
+ */
+
+#define FS_DIRCACHE_BUCKETS 4096
+
+typedef struct fsIndexEntry_s
+{
+	const char *name;
+	unsigned hash;
+	fsSearchPath_t *search;
+	int file;
+	struct fsIndexEntry_s *next;
+} fsIndexEntry_t;
+
+typedef struct fsDirCacheEntry_s
+{
+	unsigned hash;
+	qboolean isdir;
+	struct fsDirCacheEntry_s *next;
+	char path[1];
+} fsDirCacheEntry_t;
+
+static fsIndexEntry_t **fs_indexBuckets;
+static fsIndexEntry_t *fs_indexEntries;
+static int fs_indexNumBuckets;
+static qboolean fs_indexDirty = true;
+
+static fsDirCacheEntry_t *fs_dirCache[FS_DIRCACHE_BUCKETS];
+
+static struct
+{
+	int lookups;      /* Calls to FS_FOpenFile(). */
+	int indexed;      /* Resolved through the index. */
+	int ordered;      /* Resolved by walking the search path. */
+	int packhits;     /* Found in a pack. */
+	int dirhits;      /* Found in a directory. */
+	int misses;       /* Not found at all. */
+	int probes;       /* fopen() calls for loose files. */
+	int dirreads;     /* Directories listed into the cache. */
+	int rebuilds;     /* Index rebuilds. */
+} fs_stats;
+
+cvar_t *fs_dircache;
+
+static unsigned
+FS_HashName(const char *name, qboolean fold)
+{
+	unsigned hash = 2166136261u;
+
+	while (*name)
+	{
+		int c = (unsigned char)*name++;
+
+		if (fold && (c >= 'A') && (c <= 'Z'))
+		{
+			c += 'a' - 'A';
+		}
+
+		hash = (hash ^ c) * 16777619u;
+	}
+
+	return hash;
+}
+
+/*
+ * Forgets all cached directory listings. Must be called after
+ * files are created in or moved into the search path.
+ */
+void
+FS_FlushDirCache(void)
+{
+	int i;
+
+	for (i = 0; i < FS_DIRCACHE_BUCKETS; i++)
+	{
+		fsDirCacheEntry_t *entry, *next;
+
+		for (entry = fs_dirCache[i]; entry; entry = next)
+		{
+			next = entry->next;
+			Z_Free(entry);
+		}
+
+		fs_dirCache[i] = NULL;
+	}
+}
+
+static void
+FS_FreeIndex(void)
+{
+	if (fs_indexBuckets)
+	{
+		Z_Free(fs_indexBuckets);
+	}
+
+	if (fs_indexEntries)
+	{
+		Z_Free(fs_indexEntries);
+	}
+
+	fs_indexBuckets = NULL;
+	fs_indexEntries = NULL;
+	fs_indexNumBuckets = 0;
+}
+
+/*
+ * Marks the index and the directory cache as stale. They're
+ * rebuilt on demand by the next lookup.
+ */
+static void
+FS_InvalidateIndex(void)
+{
+	FS_FreeIndex();
+	FS_FlushDirCache();
+
+	fs_indexDirty = true;
+}
+
+static void
+FS_BuildIndex(void)
+{
+	fsSearchPath_t *search;
+	int total = 0;
+	int used = 0;
+
+	FS_InvalidateIndex();
+
+	for (search = fs_searchPaths; search; search = search->next)
+	{
+		if (search->pack)
+		{
+			total += search->pack->numFiles;
+		}
+	}
+
+	fs_indexNumBuckets = 64;
+
+	while (fs_indexNumBuckets < total)
+	{
+		fs_indexNumBuckets <<= 1;
+	}
+
+	fs_indexBuckets = Z_Malloc(fs_indexNumBuckets * sizeof(fsIndexEntry_t *));
+
+	if (total > 0)
+	{
+		fs_indexEntries = Z_Malloc(total * sizeof(fsIndexEntry_t));
+	}
+
+	/* The search path is ordered from highest to lowest
+	   priority, so the first pack providing a name wins. */
+	for (search = fs_searchPaths; search; search = search->next)
+	{
+		int i;
+
+		if (!search->pack)
+		{
+			continue;
+		}
+
+		for (i = 0; i < search->pack->numFiles; i++)
+		{
+			const char *name = search->pack->files[i].name;
+			unsigned hash = FS_HashName(name, true);
+			fsIndexEntry_t **bucket = &fs_indexBuckets[hash & (fs_indexNumBuckets - 1)];
+			fsIndexEntry_t *entry;
+
+			for (entry = *bucket; entry; entry = entry->next)
+			{
+				if ((entry->hash == hash) && !Q_stricmp(entry->name, name))
+				{
+					break;
+				}
+			}
+
+			if (entry)
+			{
+				continue;
+			}
+
+			entry = &fs_indexEntries[used++];
+			entry->name = name;
+			entry->hash = hash;
+			entry->search = search;
+			entry->file = i;
+			entry->next = *bucket;
+			*bucket = entry;
+		}
+	}
+
+	fs_indexDirty = false;
+	fs_stats.rebuilds++;
+
+	FS_DPrintf("%s: %i of %i pack entries indexed.\n", __func__, used, total);
+}
+
+static const fsIndexEntry_t *
+FS_IndexLookup(const char *name)
+{
+	const fsIndexEntry_t *entry;
+	unsigned hash;
+
+	if (fs_indexDirty)
+	{
+		FS_BuildIndex();
+	}
+
+	hash = FS_HashName(name, true);
+
+	for (entry = fs_indexBuckets[hash & (fs_indexNumBuckets - 1)]; entry; entry = entry->next)
+	{
+		if ((entry->hash == hash) && !Q_stricmp(entry->name, name))
+		{
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+static fsDirCacheEntry_t *
+FS_DirCacheFind(const char *path, unsigned hash, qboolean isdir)
+{
+	fsDirCacheEntry_t *entry;
+
+	for (entry = fs_dirCache[hash & (FS_DIRCACHE_BUCKETS - 1)]; entry; entry = entry->next)
+	{
+#ifdef _WIN32
+		if ((entry->hash == hash) && (entry->isdir == isdir) && !Q_stricmp(entry->path, path))
+#else
+		if ((entry->hash == hash) && (entry->isdir == isdir) && !strcmp(entry->path, path))
+#endif
+		{
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+static void
+FS_DirCacheAdd(const char *path, unsigned hash, qboolean isdir)
+{
+	fsDirCacheEntry_t *entry;
+	size_t len = strlen(path);
+
+	entry = Z_Malloc(sizeof(fsDirCacheEntry_t) + len);
+	memcpy(entry->path, path, len + 1);
+	entry->hash = hash;
+	entry->isdir = isdir;
+	entry->next = fs_dirCache[hash & (FS_DIRCACHE_BUCKETS - 1)];
+	fs_dirCache[hash & (FS_DIRCACHE_BUCKETS - 1)] = entry;
+}
+
+/*
+ * Checks if the given full path exists, reading the directory
+ * listing into the cache if it wasn't seen before. Windows file
+ * systems are case insensitive, so is the cache there.
+ */
+static qboolean
+FS_DirCacheContains(const char *path)
+{
+#ifdef _WIN32
+	const qboolean fold = true;
+#else
+	const qboolean fold = false;
+#endif
+	char dir[MAX_OSPATH];
+	char *sep;
+	unsigned hash;
+
+	Q_strlcpy(dir, path, sizeof(dir));
+
+	if ((sep = strrchr(dir, '/')) == NULL)
+	{
+		return false;
+	}
+
+	*sep = '\0';
+	hash = FS_HashName(dir, fold);
+
+	if (!FS_DirCacheFind(dir, hash, true))
+	{
+		char findname[MAX_OSPATH];
+		char **list;
+		int i, nfiles;
+
+		Com_sprintf(findname, sizeof(findname), "%s/*", dir);
+
+		if ((list = FS_ListFiles(findname, &nfiles, 0, 0)) != NULL)
+		{
+			for (i = 0; i < nfiles - 1; i++)
+			{
+				FS_DirCacheAdd(list[i], FS_HashName(list[i], fold), false);
+			}
+
+			FS_FreeList(list, nfiles);
+		}
+
+		/* Nonexistent directories are cached, too. */
+		FS_DirCacheAdd(dir, hash, true);
+		fs_stats.dirreads++;
+	}
+
+	return FS_DirCacheFind(path, FS_HashName(path, fold), false) != NULL;
+}
+
+static void
+FS_Stats_f(void)
+{
+	if ((Cmd_Argc() == 2) && !strcmp(Cmd_Argv(1), "reset"))
+	{
+		memset(&fs_stats, 0, sizeof(fs_stats));
+		return;
+	}
+
+	Com_Printf("%i lookups (%i indexed, %i ordered)\n", fs_stats.lookups,
+			fs_stats.indexed, fs_stats.ordered);
+	Com_Printf("%i found in packs, %i in directories, %i not found\n",
+			fs_stats.packhits, fs_stats.dirhits, fs_stats.misses);
+	Com_Printf("%i loose file probes, %i directories listed\n",
+			fs_stats.probes, fs_stats.dirreads);
+	Com_Printf("%i index rebuilds\n", fs_stats.rebuilds);
+}
+
+/*
+ * Opens the given file from a pack. Returns the file size.
+ */
+static int
+FS_OpenPackFile(fsHandle_t *handle, fsPack_t *pack, int i)
+{
+	/* Found it! */
+	if (fs_debug->value)
+	{
+		Com_Printf("%s: '%s' (found in '%s').\n",
+			__func__, handle->name, pack->name);
+	}
+
+	// save the name with *correct case* in the handle
+	// (relevant for savegames, when starting map with wrong case but it's still found
+	//  because it's from pak, but save/bla/MAPname.sav/sv2 will have wrong case and can't be found then)
+	Q_strlcpy(handle->name, pack->files[i].name, sizeof(handle->name));
+
+	if (pack->isProtectedPak)
+	{
+		file_from_protected_pak = true;
+	}
+
+	if (pack->pak)
+	{
+		/* PAK */
+		if (pack->map && ((size_t)pack->files[i].offset +
+				pack->files[i].size <= pack->mapsize))
+		{
+			handle->mem = pack->map + pack->files[i].offset;
+			handle->memsize = pack->files[i].size;
+			handle->mempos = 0;
+
+			return pack->files[i].size;
+		}
+
+		handle->file = Q_fopen(pack->name, "rb");
+
+		if (handle->file)
+		{
+			fseek(handle->file, pack->files[i].offset, SEEK_SET);
+			return pack->files[i].size;
+		}
+	}
+	else if (pack->pk3)
+	{
+		/* PK3 */
+		if (pack->map)
+		{
+			handle->zip = unzOpen2_64(pack, &fs_zipmap_api);
+		}
+		else
+		{
+#ifdef _WIN32
+			handle->zip = unzOpen2(pack->name, &zlib_file_api);
+#else
+			handle->zip = unzOpen(pack->name);
+#endif
+		}
+
+		if (handle->zip)
+		{
+			/* Jump right to the entry, no need to
+			   scan the central directory again. */
+			if (unzSetOffset(handle->zip, pack->files[i].offset) == UNZ_OK)
+			{
+				if (unzOpenCurrentFile(handle->zip) == UNZ_OK)
+				{
+					return pack->files[i].size;
+				}
+			}
+
+			unzClose(handle->zip);
+		}
+	}
+
+	Com_Error(ERR_FATAL, "Couldn't reopen '%s'", pack->name);
+	return 0;
+}
+
+/*
+ * Tries to open the file from a search directory, first with
+ * the name as given and then lowercased. Directory contents are
+ * taken from the listing cache if enabled.
+ */
+static qboolean
+FS_OpenLooseFile(fsHandle_t *handle, const fsSearchPath_t *search)
+{
+	char path[MAX_OSPATH], lwrName[MAX_OSPATH];
+	int pass;
+
+	Com_sprintf(lwrName, sizeof(lwrName), "%s", handle->name);
+	Q_strlwr(lwrName);
+
+	for (pass = 0; pass < 2; pass++)
+	{
+		if ((pass == 1) && !strcmp(lwrName, handle->name))
+		{
+			break;
+		}
+
+		Com_sprintf(path, sizeof(path), "%s/%s", search->path,
+				pass ? lwrName : handle->name);
+
+		if (fs_dircache->value && !FS_DirCacheContains(path))
+		{
+			continue;
+		}
+
+		fs_stats.probes++;
+
+		if ((handle->file = Q_fopen(path, "rb")) != NULL)
+		{
+			if (fs_debug->value)
+			{
+				Com_Printf("%s: '%s' (found in '%s').\n",
+					__func__, handle->name, search->path);
+			}
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
 /*
  * Finds the file in the search path. Returns filesize and an open FILE *. Used
  * for streaming data out of either a pak file or a seperate file.
@@ -413,9 +999,7 @@ FS_PackQuickSearch(const fsPack_t *pak, const char *name)
 int
 FS_FOpenFile(const char *rawname, fileHandle_t *f, qboolean gamedir_only)
 {
-	char path[MAX_OSPATH], lwrName[MAX_OSPATH];
 	fsHandle_t *handle;
-	fsPack_t *pack;
 	fsSearchPath_t *search;
 	int input, output;
 
@@ -482,132 +1066,100 @@ FS_FOpenFile(const char *rawname, fileHandle_t *f, qboolean gamedir_only)
 	Q_strlcpy(handle->name, name, sizeof(handle->name));
 	handle->mode = FS_READ;
 
-	/* Search through the path, one element at a time. */
-	for (search = fs_searchPaths; search; search = search->next)
+	fs_stats.lookups++;
+
+	// Evil hack for maps.lst and players/, see below. The index
+	// doesn't know about it and about gamedir only lookups, walk
+	// the search path in these cases.
+	if (!gamedir_only && ((strcmp(fs_gamedirvar->string, "") != 0) ||
+		((strcmp(name, "maps.lst") != 0) && (strncmp(name, "players/", 8) != 0))))
 	{
-		if (gamedir_only)
+		const fsIndexEntry_t *entry;
+
+		fs_stats.indexed++;
+		entry = FS_IndexLookup(handle->name);
+
+		/* Loose files override packs further down the path. */
+		for (search = fs_searchPaths; search; search = search->next)
 		{
-			if (strstr(search->path, FS_Gamedir()) == NULL)
+			if (entry && (search == entry->search))
 			{
-				continue;
+				break;
 			}
-		}
 
-		// Evil hack for maps.lst and players/
-		// TODO: A flag to ignore paks would be better
-		if ((strcmp(fs_gamedirvar->string, "") == 0) && search->pack)
-		{
-			if ((!strcmp(name, "maps.lst")) || (!strncmp(name, "players/", 8)))
+			if (!search->pack && FS_OpenLooseFile(handle, search))
 			{
-				if (FS_FileInGamedir(name))
-				{
-					continue;
-				}
+				fs_stats.dirhits++;
+				return FS_FileLength(handle->file);
 			}
 		}
 
-		/* Search inside a pack file. */
-		if (search->pack)
+		if (entry)
 		{
-			int i;
-
-			pack = search->pack;
-			i = FS_PackQuickSearch(pack, handle->name);
+			fs_stats.packhits++;
+			return FS_OpenPackFile(handle, entry->search->pack, entry->file);
+		}
+	}
+	else
+	{
+		fs_stats.ordered++;
 
-			if (i >= 0)
+		/* Search through the path, one element at a time. */
+		for (search = fs_searchPaths; search; search = search->next)
+		{
+			if (gamedir_only)
 			{
-				/* Found it! */
-				if (fs_debug->value)
+				if (strstr(search->path, FS_Gamedir()) == NULL)
 				{
-					Com_Printf("%s: '%s' (found in '%s').\n",
-						__func__, handle->name, pack->name);
+					continue;
 				}
+			}
 
-				// save the name with *correct case* in the handle
-				// (relevant for savegames, when starting map with wrong case but it's still found
-				//  because it's from pak, but save/bla/MAPname.sav/sv2 will have wrong case and can't be found then)
-				Q_strlcpy(handle->name, pack->files[i].name, sizeof(handle->name));
-
-				if (pack->pak)
+			// Evil hack for maps.lst and players/
+			// TODO: A flag to ignore paks would be better
+			if ((strcmp(fs_gamedirvar->string, "") == 0) && search->pack)
+			{
+				if ((!strcmp(name, "maps.lst")) || (!strncmp(name, "players/", 8)))
 				{
-					/* PAK */
-					if (pack->isProtectedPak)
+					if (FS_FileInGamedir(name))
 					{
-						file_from_protected_pak = true;
-					}
-
-					handle->file = Q_fopen(pack->name, "rb");
-
-					if (handle->file)
-					{
-						fseek(handle->file, pack->files[i].offset, SEEK_SET);
-						return pack->files[i].size;
+						continue;
 					}
 				}
-				else if (pack->pk3)
-				{
-					/* PK3 */
-					if (pack->isProtectedPak)
-					{
-						file_from_protected_pak = true;
-					}
+			}
 
-#ifdef _WIN32
-					handle->zip = unzOpen2(pack->name, &zlib_file_api);
-#else
-					handle->zip = unzOpen(pack->name);
-#endif
+			/* Search inside a pack file. */
+			if (search->pack)
+			{
+				int i;
 
-					if (handle->zip)
-					{
-						if (unzLocateFile(handle->zip, handle->name, 2) == UNZ_OK)
-						{
-							if (unzOpenCurrentFile(handle->zip) == UNZ_OK)
-							{
-								return pack->files[i].size;
-							}
-						}
+				i = FS_PackQuickSearch(search->pack, handle->name);
 
-						unzClose(handle->zip);
-					}
+				if (i >= 0)
+				{
+					fs_stats.packhits++;
+					return FS_OpenPackFile(handle, search->pack, i);
 				}
-
-				Com_Error(ERR_FATAL, "Couldn't reopen '%s'", pack->name);
-				return 0;
-			}
-		}
-		else
-		{
-			/* Search in a directory tree. */
-			Com_sprintf(path, sizeof(path), "%s/%s", search->path, handle->name);
-
-			handle->file = Q_fopen(path, "rb");
-
-			if (!handle->file)
-			{
-				Com_sprintf(lwrName, sizeof(lwrName), "%s", handle->name);
-				Q_strlwr(lwrName);
-				Com_sprintf(path, sizeof(path), "%s/%s", search->path, lwrName);
-				handle->file = Q_fopen(path, "rb");
 			}
-
-			if (handle->file)
+			else
 			{
-				if (fs_debug->value)
+				/* Search in a directory tree. */
+				if (FS_OpenLooseFile(handle, search))
 				{
-					Com_Printf("%s: '%s' (found in '%s').\n",
-						__func__, handle->name, search->path);
+					fs_stats.dirhits++;
+					return FS_FileLength(handle->file);
 				}
-
-				return FS_FileLength(handle->file);
 			}
 		}
 	}
+
 	if (fs_debug->value)
 	{
 		Com_Printf("%s: couldn't find '%s'.\n", __func__, handle->name);
 	}
 
+	fs_stats.misses++;
+
 	/* Couldn't open, so free the handle. */
 	memset(handle, 0, sizeof(*handle));
 	*f = 0;
@@ -642,6 +1194,12 @@ FS_Read(void *buffer, int size, fileHandle_t f)
 		{
 			r = unzReadCurrentFile(handle->zip, buf, remaining);
 		}
+		else if (handle->mem)
+		{
+			r = Q_min(remaining, handle->memsize - handle->mempos);
+			memcpy(buf, handle->mem + handle->mempos, r);
+			handle->mempos += r;
+		}
 		else
 		{
 			return 0;
@@ -675,6 +1233,62 @@ FS_Read(void *buffer, int size, fileHandle_t f)
 	return size;
 }
 
+/*
+ * Like FS_Read(), but touches nothing except the handle and never
+ * calls Com_Error(). A worker thread may use it on a handle that
+ * nobody else is using at the same time. Returns the number of
+ * bytes read or -1 on error.
+ */
+int
+FS_ReadDetached(void *buffer, int size, fileHandle_t f)
+{
+	byte *buf;
+	int r;
+	int remaining;
+	fsHandle_t *handle;
+
+	if ((f <= 0) || (f > MAX_HANDLES))
+	{
+		return -1;
+	}
+
+	handle = &fs_handles[f - 1];
+	remaining = size;
+	buf = (byte *)buffer;
+
+	while (remaining)
+	{
+		if (handle->file)
+		{
+			r = fread(buf, 1, remaining, handle->file);
+		}
+		else if (handle->zip)
+		{
+			r = unzReadCurrentFile(handle->zip, buf, remaining);
+		}
+		else if (handle->mem)
+		{
+			r = Q_min(remaining, handle->memsize - handle->mempos);
+			memcpy(buf, handle->mem + handle->mempos, r);
+			handle->mempos += r;
+		}
+		else
+		{
+			return -1;
+		}
+
+		if (r <= 0)
+		{
+			return -1;
+		}
+
+		remaining -= r;
+		buf += r;
+	}
+
+	return size;
+}
+
 /*
  * Properly handles partial reads of size up to count times. No error if it
  * can't read.
@@ -710,6 +1324,12 @@ FS_FRead(void *buffer, int size, int count, fileHandle_t f)
 			{
 				r = unzReadCurrentFile(handle->zip, buf, remaining);
 			}
+			else if (handle->mem)
+			{
+				r = Q_min(remaining, handle->memsize - handle->mempos);
+				memcpy(buf, handle->mem + handle->mempos, r);
+				handle->mempos += r;
+			}
 			else
 			{
 				return 0;
@@ -746,6 +1366,11 @@ FS_FRead(void *buffer, int size, int count, fileHandle_t f)
 	return size;
 }
 
+#ifndef DEDICATED_ONLY
+// Implemented by the client, see cl_prefetch.c.
+int CL_PrefetchTake(const char *name, void **buffer, qboolean *fromprotected);
+#endif
+
 /*
  * Filename are reletive to the quake search path. A null buffer will just
  * return the file length without loading.
@@ -758,6 +1383,18 @@ FS_LoadFile(const char *path, void **buffer)
 	fileHandle_t f; /* File handle. */
 
 	buf = NULL;
+
+#ifndef DEDICATED_ONLY
+	/* The client may have read it in the background already. */
+	if (buffer)
+	{
+		if ((size = CL_PrefetchTake(path, buffer, &file_from_protected_pak)) > 0)
+		{
+			return size;
+		}
+	}
+#endif
+
 	size = FS_FOpenFile(path, &f, false);
 
 	if (size <= 0)
@@ -791,6 +1428,73 @@ FS_LoadFile(const char *path, void **buffer)
 	return size;
 }
 
+/*
+ * Like FS_LoadFile(), but files stored in a memory mapped PAK
+ * are returned without copying them. The buffer points right
+ * into the pack and must not be written to. Everything else is
+ * loaded into a private buffer. Free with FS_FreeFile().
+ */
+int
+FS_MapFile(const char *path, const void **buffer)
+{
+	fsHandle_t *handle;
+	fileHandle_t f;
+	int size;
+
+	size = FS_FOpenFile(path, &f, false);
+
+	if (size <= 0)
+	{
+		if (size == 0)
+		{
+			FS_FCloseFile(f);
+		}
+
+		*buffer = NULL;
+		return size;
+	}
+
+	handle = FS_GetFileByHandle(f);
+
+	if (handle->mem)
+	{
+		*buffer = handle->mem;
+	}
+	else
+	{
+		void *buf = Z_Malloc(size);
+
+		FS_Read(buf, size, f);
+		*buffer = buf;
+	}
+
+	FS_FCloseFile(f);
+
+	return size;
+}
+
+/*
+ * Checks if the buffer was returned zero copy by FS_MapFile().
+ */
+static qboolean
+FS_IsMappedBuffer(const void *buffer)
+{
+	const fsSearchPath_t *search;
+
+	for (search = fs_searchPaths; search; search = search->next)
+	{
+		const fsPack_t *pack = search->pack;
+
+		if (pack && pack->map && ((const byte *)buffer >= pack->map) &&
+			((const byte *)buffer < pack->map + pack->mapsize))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
 void
 FS_FreeFile(void *buffer)
 {
@@ -800,6 +1504,11 @@ FS_FreeFile(void *buffer)
 		return;
 	}
 
+	if (FS_IsMappedBuffer(buffer))
+	{
+		return;
+	}
+
 	Z_Free(buffer);
 }
 
@@ -825,6 +1534,8 @@ FS_FreeSearchPaths(fsSearchPath_t *start, fsSearchPath_t *end)
 	fsSearchPath_t *cur = start;
 	fsSearchPath_t *next;
 
+	FS_InvalidateIndex();
+
 	while (cur != end)
 	{
 		if (cur->pack)
@@ -839,6 +1550,8 @@ FS_FreeSearchPaths(fsSearchPath_t *start, fsSearchPath_t *end)
 				unzClose(cur->pack->pk3);
 			}
 
+			Sys_UnmapFile(cur->pack->map, cur->pack->mapsize);
+
 			Z_Free(cur->pack->files);
 			Z_Free(cur->pack);
 		}
@@ -931,6 +1644,7 @@ FS_LoadPAK(const char *packPath)
 	Q_strlcpy(pack->name, packPath, sizeof(pack->name));
 	pack->pak = handle;
 	pack->pk3 = NULL;
+	pack->map = Sys_MapFile(packPath, &pack->mapsize);
 	pack->numFiles = numFiles;
 	pack->files = files;
 
@@ -997,7 +1711,7 @@ FS_LoadPK3(const char *packPath)
 		unzGetCurrentFileInfo(handle, &info, fileName, sizeof(fileName),
 				NULL, 0, NULL, 0);
 		Q_strlcpy(files[i].name, fileName, sizeof(files[i].name));
-		files[i].offset = -1; /* Not used in ZIP files */
+		files[i].offset = unzGetOffset(handle);
 		files[i].size = info.uncompressed_size;
 		i++;
 		status = unzGoToNextFile(handle);
@@ -1007,6 +1721,7 @@ FS_LoadPK3(const char *packPath)
 	Q_strlcpy(pack->name, packPath, sizeof(pack->name));
 	pack->pak = NULL;
 	pack->pk3 = handle;
+	pack->map = Sys_MapFile(packPath, &pack->mapsize);
 	pack->numFiles = numFiles;
 	pack->files = files;
 
@@ -1086,7 +1801,7 @@ FS_Path_f(void)
 
 	for (i = 0, handle = fs_handles; i < MAX_HANDLES; i++, handle++)
 	{
-		if ((handle->file != NULL) || (handle->zip != NULL))
+		if ((handle->file != NULL) || (handle->zip != NULL) || (handle->mem != NULL))
 		{
 			Com_Printf("Handle %i: '%s'.\n", i + 1, handle->name);
 		}
@@ -1774,6 +2489,8 @@ FS_AddPAKFromGamedir(const char *pak)
 			search->next = fs_searchPaths;
 			fs_searchPaths = search;
 
+			FS_InvalidateIndex();
+
 			return true;
 		}
 	}
@@ -1852,6 +2569,9 @@ FS_AddDirToSearchPath(char *dir, qboolean create) {
 		FS_CreatePath(fs_gamedir);
 	}
 
+	// The index must be rebuild to pick up the new paths.
+	FS_InvalidateIndex();
+
 	// Add the directory itself.
 	search = Z_Malloc(sizeof(fsSearchPath_t));
 	Q_strlcpy(search->path, dir, sizeof(search->path));
@@ -2021,6 +2741,7 @@ extern qboolean menu_startdemoloop;
 
 // Functions
 void CL_WriteConfiguration(void);
+void CL_PrefetchFlush(void);
 #endif
 
 void
@@ -2037,6 +2758,10 @@ FS_BuildGameSpecificSearchPath(const char *dir)
 	// Write the config. Otherwise changes made by the
 	// current mod are lost.
 	CL_WriteConfiguration();
+
+	// Background reads hold handles into packs that
+	// are about to be closed.
+	CL_PrefetchFlush();
 #endif
 
 	// empty string means baseq2
@@ -2061,7 +2786,8 @@ FS_BuildGameSpecificSearchPath(const char *dir)
 	/* Close open files for game dir. */
 	for (i = 0; i < MAX_HANDLES; i++)
 	{
-		if (strstr(fs_handles[i].name, dir) && ((fs_handles[i].file != NULL) || (fs_handles[i].zip != NULL)))
+		if (strstr(fs_handles[i].name, dir) && ((fs_handles[i].file != NULL) ||
+			(fs_handles[i].zip != NULL) || (fs_handles[i].mem != NULL)))
 		{
 			FS_FCloseFile(i);
 		}
@@ -2249,12 +2975,14 @@ FS_InitFilesystem(void)
 	Cmd_AddCommand("path", FS_Path_f);
 	Cmd_AddCommand("link", FS_Link_f);
 	Cmd_AddCommand("dir", FS_Dir_f);
+	Cmd_AddCommand("fs_stats", FS_Stats_f);
 
 	// Register cvars
 	fs_basedir = Cvar_Get("basedir", ".", CVAR_NOSET);
 	fs_cddir = Cvar_Get("cddir", "", CVAR_NOSET);
 	fs_gamedirvar = Cvar_Get("game", "", CVAR_LATCH | CVAR_SERVERINFO);
 	fs_debug = Cvar_Get("fs_debug", "0", 0);
+	fs_dircache = Cvar_Get("fs_dircache", "1", 0);
 
 	// Deprecation warning, can be removed at a later time.
 	if (strcmp(fs_basedir->string, ".") != 0)
@@ -108,7 +108,11 @@ static YQ2_ATTR_INLINE void Sys_CpuPause(void)
 #endif
 #endif
 
+#ifndef DEDICATED_ONLY
 static void Qcommon_Frame(int usec);
+#else
+static qboolean Qcommon_Frame(int usec);
+#endif
 
 // ----
 
@@ -170,6 +174,9 @@ Qcommon_Mainloop(void)
 {
 	long long newtime;
 	long long oldtime = Sys_Microseconds();
+#ifdef DEDICATED_ONLY
+	qboolean slept = false;
+#endif
 
 	/* The mainloop. The legend. */
 	while (1)
@@ -203,7 +210,12 @@ Qcommon_Mainloop(void)
 			}
 		}
 #else
-		Sys_Nanosleep(850000);
+		/* The server waits in NET_Sleep() until its next
+		   frame is due, only throttle if it didn't. */
+		if (!slept)
+		{
+			Sys_Nanosleep(850000);
+		}
 #endif
 
 		newtime = Sys_Microseconds();
@@ -211,7 +223,11 @@ Qcommon_Mainloop(void)
 		// Save global time for network- und input code.
 		curtime = (int)(newtime / 1000ll);
 
+#ifndef DEDICATED_ONLY
 		Qcommon_Frame(newtime - oldtime);
+#else
+		slept = Qcommon_Frame(newtime - oldtime);
+#endif
 		oldtime = newtime;
 	}
 }
@@ -392,7 +408,9 @@ Qcommon_Init(int argc, char **argv)
 	// Start late subsystem.
 	Sys_Init();
 	NET_Init();
+	NET_SimInit();
 	Netchan_Init();
+	CM_Init();
 	SV_Init();
 #ifndef DEDICATED_ONLY
 	CL_Init();
@@ -534,8 +552,8 @@ Qcommon_Frame(int usec)
 
 	if (showtrace->value)
 	{
-		extern int c_traces, c_brush_traces;
-		extern int c_pointcontents;
+		extern YQ2_THREAD_LOCAL int c_traces, c_brush_traces;
+		extern YQ2_THREAD_LOCAL int c_pointcontents;
 
 		Com_Printf("%4i traces  %4i points\n", c_traces, c_pointcontents);
 		c_traces = 0;
@@ -726,7 +744,7 @@ Qcommon_Frame(int usec)
 	}
 }
 #else
-static void
+static qboolean
 Qcommon_Frame(int usec)
 {
 	// For the dedicated server terminal console.
@@ -749,6 +767,9 @@ Qcommon_Frame(int usec)
 	   125hz bug. */
 	qboolean packetframe = true;
 
+	// Whether the server waited for its next frame.
+	qboolean slept = false;
+
 
 	/* Tells the client to shutdown.
 	   Used by the signal handlers. */
@@ -763,7 +784,7 @@ Qcommon_Frame(int usec)
 	   it alone. */
 	if (setjmp(abortframe))
 	{
-		return;
+		return false;
 	}
 
 
@@ -807,12 +828,14 @@ Qcommon_Frame(int usec)
 
 	// Run the serverframe.
 	if (packetframe) {
-		SV_Frame(servertimedelta);
+		slept = SV_Frame(servertimedelta);
 		servertimedelta = 0;
 
 		// Reset deltas if necessary.
 		packetdelta = 0;
 	}
+
+	return slept;
 }
 #endif
 
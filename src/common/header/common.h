@@ -91,6 +91,7 @@ typedef struct sizebuf_s
 {
 	qboolean allowoverflow;     /* if false, do a Com_Error */
 	qboolean overflowed;        /* set to true if the buffer size failed */
+	qboolean quietoverflow;     /* don't print a warning, the owner checks overflowed */
 	byte *data;
 	int maxsize;
 	int cursize;
@@ -195,6 +196,12 @@ void Info_Print(char *s);
 #define UPDATE_BACKUP 16    /* copies of entity_state_t to keep buffered */
 #define UPDATE_MASK (UPDATE_BACKUP - 1)
 
+/* Clients ask for windowed downloads by passing the bytes the server
+   may send ahead to the download command. Their svc_download messages
+   have this bit set in the percent byte, followed by a [long] offset */
+#define DOWNLOAD_WINDOWED 0x80
+#define DOWNLOAD_WINDOW 65536
+
 /* server to client */
 enum svc_ops_e
 {
@@ -218,7 +225,7 @@ enum svc_ops_e
 	svc_configstring,           /* [short] [string] */
 	svc_spawnbaseline,
 	svc_centerprint,            /* [string] to put in center of the screen */
-	svc_download,               /* [short] size [size bytes] */
+	svc_download,               /* [short] size [byte] percent [size bytes] */
 	svc_playerinfo,             /* variable */
 	svc_packetentities,         /* [...] */
 	svc_deltapacketentities,    /* [...] */
@@ -525,6 +532,13 @@ extern qboolean userinfo_modified;
 #define MAX_MSGLEN 1400             /* max length of a message */
 #define PACKET_HEADER 10            /* two ints and a short */
 
+/* Netchan versions, agreed on while connecting. Version 2
+   splits messages larger than MAX_MSGLEN into fragments,
+   the whole message may be MAX_FRAGMENTED_MSGLEN long. */
+#define NETCHAN_VERSION_OLD 1
+#define NETCHAN_VERSION 2
+#define MAX_FRAGMENTED_MSGLEN 16384
+
 typedef enum
 {
 	NA_LOOPBACK,
@@ -548,6 +562,25 @@ typedef struct
 	unsigned short port;
 } netadr_t;
 
+/* Datagrams and the system calls it took to move them */
+typedef struct
+{
+	unsigned int packets_received;
+	unsigned int recv_calls;
+	unsigned int packets_sent;
+	unsigned int send_calls;
+
+	/* NET_Sleep() calls, how many of them ran until the
+	   deadline and how late they woke up, in microseconds */
+	unsigned int sleeps;
+	unsigned int timer_wakeups;
+	unsigned int late_wakeups; /* more than 1 msec late */
+	unsigned long long wakeup_late_total;
+	unsigned int wakeup_late_max;
+} netstats_t;
+
+extern netstats_t net_stats;
+
 void NET_Init(void);
 void NET_Shutdown(void);
 
@@ -556,13 +589,21 @@ void NET_Config(qboolean multiplayer);
 qboolean NET_GetPacket(netsrc_t sock, netadr_t *net_from,
 		sizebuf_t *net_message);
 void NET_SendPacket(netsrc_t sock, int length, void *data, netadr_t to);
+void NET_FlushPackets(void); /* sends what NET_SendPacket() queued for NS_SERVER */
 
 qboolean NET_CompareAdr(netadr_t a, netadr_t b);
 qboolean NET_CompareBaseAdr(netadr_t a, netadr_t b);
 qboolean NET_IsLocalAddress(netadr_t adr);
 char *NET_AdrToString(netadr_t a);
 qboolean NET_StringToAdr(const char *s, netadr_t *a);
-void NET_Sleep(int msec);
+qboolean NET_Sleep(int usec); /* true if it waited */
+
+/* network impairment simulator, called by the platform code */
+void NET_SimInit(void);
+qboolean NET_SimSendPacket(netsrc_t sock, int length, const void *data, netadr_t to);
+qboolean NET_SimReceivedPacket(netsrc_t sock, netadr_t from, sizebuf_t *net_message);
+qboolean NET_SimGetPacket(netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message);
+int NET_SimTimeout(int usec);
 
 /*=================================================================== */
 
@@ -574,6 +615,7 @@ typedef struct
 	qboolean fatal_error;
 
 	netsrc_t sock;
+	int version;                    /* NETCHAN_VERSION_OLD unless agreed otherwise */
 
 	int dropped;                    /* between last packet and previous */
 
@@ -601,11 +643,17 @@ typedef struct
 	/* message is copied to this buffer when it is first transfered */
 	int reliable_length;
 	byte reliable_buf[MAX_MSGLEN - 16];         /* unacked reliable message */
+
+	/* fragments of the incoming message being reassembled */
+	int fragment_sequence;
+	int fragment_length;                    /* 0 until the last one arrived */
+	unsigned fragment_received;             /* bit per fragment */
+	byte fragment_buf[MAX_FRAGMENTED_MSGLEN];
 } netchan_t;
 
 extern netadr_t net_from;
 extern sizebuf_t net_message;
-extern byte net_message_buffer[MAX_MSGLEN];
+extern byte net_message_buffer[MAX_FRAGMENTED_MSGLEN];
 
 void Netchan_Init(void);
 void Netchan_Setup(netsrc_t sock, netchan_t *chan, netadr_t adr, int qport);
@@ -622,6 +670,7 @@ qboolean Netchan_CanReliable(netchan_t *chan);
 
 #include "files.h"
 
+void CM_Init(void);
 cmodel_t *CM_LoadMap(char *name, qboolean clientload, unsigned *checksum);
 cmodel_t *CM_InlineModel(const char *name);       /* *1, *2, etc */
 
@@ -643,8 +692,8 @@ trace_t CM_TransformedBoxTrace(const vec3_t start, const vec3_t end,
 		const vec3_t mins, const vec3_t maxs, int headnode,
 		int brushmask, const vec3_t origin, const vec3_t angles);
 
-byte *CM_ClusterPVS(int cluster);
-byte *CM_ClusterPHS(int cluster);
+const byte *CM_ClusterPVS(int cluster);
+const byte *CM_ClusterPHS(int cluster);
 
 int CM_PointLeafnum(vec3_t p);
 
@@ -661,7 +710,8 @@ void CM_SetAreaPortalState(int portalnum, qboolean open);
 qboolean CM_AreasConnected(int area1, int area2);
 
 int CM_WriteAreaBits(byte *buffer, int area);
-qboolean CM_HeadnodeVisible(int headnode, byte *visbits);
+qboolean CM_HeadnodeVisible(int headnode, const byte *visbits);
+void CM_HeadnodeClusters(int headnode, byte *clusterbits);
 
 void CM_WritePortalState(FILE *f);
 
@@ -703,6 +753,7 @@ int FS_FOpenFile(const char *name, fileHandle_t *f, qboolean gamedir_only);
 void FS_FCloseFile(fileHandle_t f);
 int FS_Read(void *buffer, int size, fileHandle_t f);
 int FS_FRead(void *buffer, int size, int count, fileHandle_t f);
+int FS_ReadDetached(void *buffer, int size, fileHandle_t f);
 
 // returns the filename used to open f, but (if opened from pack) in correct case
 // returns NULL if f is no valid handle
@@ -720,6 +771,7 @@ void FS_BuildGameSpecificSearchPath(const char *dir);
 const char *FS_Gamedir(void);
 const char *FS_NextPath(const char *prevpath);
 int FS_LoadFile(const char *path, void **buffer);
+int FS_MapFile(const char *path, const void **buffer);
 qboolean FS_FileInGamedir(const char *file);
 qboolean FS_AddPAKFromGamedir(const char *pak);
 const char* FS_GetNextRawPath(const char* lastRawPath);
@@ -732,6 +784,7 @@ char **FS_ListMods(int *nummods);
 
 void FS_FreeFile(void *buffer);
 void FS_CreatePath(const char *path);
+void FS_FlushDirCache(void);
 
 /* MISC */
 
@@ -839,7 +892,7 @@ void SCR_BeginLoadingPlaque(void);
 
 void SV_Init(void);
 void SV_Shutdown(char *finalmsg, qboolean reconnect);
-void SV_Frame(int usec);
+qboolean SV_Frame(int usec); /* true if it waited for the next frame */
 
 /* ======================================================================= */
 
@@ -855,6 +908,8 @@ char *Sys_GetHomeDir(void);
 void Sys_Remove(const char *path);
 int Sys_Rename(const char *from, const char *to);
 void Sys_RemoveDir(const char *path);
+void *Sys_MapFile(const char *path, size_t *size);
+void Sys_UnmapFile(void *data, size_t size);
 long long Sys_Microseconds(void);
 void Sys_Nanosleep(int);
 void *Sys_GetProcAddress(void *handle, const char *sym);
@@ -866,6 +921,41 @@ void Sys_GetWorkDir(char *buffer, size_t len);
 qboolean Sys_SetWorkDir(char *path);
 qboolean Sys_Realpath(const char *in, char *out, size_t size);
 
+// Threads (system.c). Thin wrappers around the
+// native primitives, no Com_Error() on failure.
+typedef struct sysThread_s sysThread_t;
+typedef struct sysMutex_s sysMutex_t;
+typedef struct sysCond_s sysCond_t;
+
+sysThread_t *Sys_CreateThread(void (*func)(void *), void *data);
+void Sys_JoinThread(sysThread_t *thread);
+sysMutex_t *Sys_CreateMutex(void);
+void Sys_DestroyMutex(sysMutex_t *mutex);
+void Sys_LockMutex(sysMutex_t *mutex);
+void Sys_UnlockMutex(sysMutex_t *mutex);
+sysCond_t *Sys_CreateCond(void);
+void Sys_DestroyCond(sysCond_t *cond);
+void Sys_WaitCond(sysCond_t *cond, sysMutex_t *mutex);
+void Sys_SignalCond(sysCond_t *cond);
+void Sys_BroadcastCond(sysCond_t *cond);
+int Sys_GetNumCPUs(void);
+
+// Server instances forked off the dedicated
+// server process (system.c), not on Windows.
+#define MAX_INSTANCES 256
+
+typedef struct
+{
+	int pid;
+	int rss;     /* resident memory in kB */
+	int pss;     /* the same with shared pages split up */
+	int shared;  /* resident kB shared with other processes */
+	int cputime; /* user and system time in msec */
+} sysinstance_t;
+
+int Sys_ForkInstance(int instance);
+qboolean Sys_GetInstanceStats(int instance, sysinstance_t *stats);
+
 // Windows only (system.c)
 #ifdef _WIN32
 void Sys_RedirectStdout(void);
@@ -46,7 +46,7 @@ typedef unsigned char byte;
  #define NULL ((void *)0)
 #endif
 
-// stuff to align variables/arrays and for noreturn
+// stuff to align variables/arrays, for noreturn and thread locals
 #if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L // C11 or newer
 	#define YQ2_ALIGNAS_SIZE(SIZE)  _Alignas(SIZE)
 	#define YQ2_ALIGNAS_TYPE(TYPE)  _Alignas(TYPE)
@@ -57,15 +57,18 @@ typedef unsigned char byte;
 	#define YQ2_ATTR_MALLOC         __attribute__ ((__malloc__))
 	#define YQ2_ATTR_INLINE         __attribute__((always_inline)) inline
 	#define YQ2_ATTR_RETURNS_NONNULL __attribute__ ((returns_nonnull))
+	#define YQ2_THREAD_LOCAL        _Thread_local
   #elif defined(_MSC_VER)
 	#define YQ2_ATTR_MALLOC         __declspec(restrict)
 	#define YQ2_ATTR_INLINE         __forceinline
 	#define YQ2_ATTR_RETURNS_NONNULL
+	#define YQ2_THREAD_LOCAL        __declspec(thread)
   #else
 	// no equivalent per see
 	#define YQ2_ATTR_MALLOC
 	#define YQ2_ATTR_INLINE         inline
 	#define YQ2_ATTR_RETURNS_NONNULL
+	#define YQ2_THREAD_LOCAL        _Thread_local
   #endif
 #elif defined(__GNUC__) // GCC and clang should support this attribute
 	#define YQ2_ALIGNAS_SIZE(SIZE)  __attribute__(( __aligned__(SIZE) ))
@@ -75,6 +78,7 @@ typedef unsigned char byte;
 	#define YQ2_ATTR_RETURNS_NONNULL __attribute__ ((returns_nonnull))
 	#define YQ2_ATTR_MALLOC         __attribute__ ((__malloc__))
 	#define YQ2_ATTR_INLINE         __attribute__((always_inline)) inline
+	#define YQ2_THREAD_LOCAL        __thread
 	// GCC supports this extension since 4.6
 	#define YQ2_STATIC_ASSERT(C, M) _Static_assert((C), M)
 #elif defined(_MSC_VER)
@@ -96,6 +100,7 @@ typedef unsigned char byte;
 	#define YQ2_ATTR_RETURNS_NONNULL
 	#define YQ2_ATTR_MALLOC         __declspec(restrict)
 	#define YQ2_ATTR_INLINE         __forceinline
+	#define YQ2_THREAD_LOCAL        __declspec(thread)
 	#define YQ2_STATIC_ASSERT(C, M) assert((C) && M)
 #else
 	#warning "Please add a case for your compiler here to align correctly"
@@ -105,6 +110,8 @@ typedef unsigned char byte;
 	#define YQ2_ATTR_RETURNS_NONNULL
 	#define YQ2_ATTR_MALLOC
 	#define YQ2_ATTR_INLINE         inline
+	#define YQ2_THREAD_LOCAL        // shared by all threads
+	#define YQ2_NO_THREAD_LOCAL     // so the server runs no workers
 	#define YQ2_STATIC_ASSERT(C, M) assert((C) && M)
 #endif
 
@@ -421,10 +428,22 @@ qboolean Info_Validate(const char *s);
 /* ============================================= */
 
 /* Random number generator */
+#define RANDK_MAX_REWIND 64 /* numbers that can be drawn again */
+
+typedef struct
+{
+	int j;
+	unsigned long long carry, xs, cng;
+	unsigned long long qary[RANDK_MAX_REWIND];
+} randkmark_t;
+
 int randk(void);
 float frandk(void);
 float crandk(void);
 void randk_seed(void);
+void randk_reseed(unsigned int entropy);
+void randk_mark(randkmark_t *mark);
+void randk_rewind(const randkmark_t *mark);
 
 /*
  * ==============================================================
@@ -69,6 +69,15 @@
  * valid reliable acknowledgement numbers provides protection against
  * malicious address spoofing.
  *
+ * Starting with netchan version 2 a message that doesn't fit into
+ * MAX_MSGLEN is split into fragments. Each of them carries the header
+ * of the whole message with FRAGMENT_BIT set in the sequence, followed
+ * by a short with the offset of the fragment and FRAGMENT_MORE if
+ * it's not the last one. The receiver collects them in any order and
+ * handles the message once all of them arrived, a lost fragment loses
+ * the whole message. The version is agreed on while connecting, old
+ * clients and servers never see a fragment.
+ *
  * The qport field is a workaround for bad address translating routers
  * that sometimes remap the client's source port on a packet during
  * gameplay.
@@ -83,13 +92,22 @@
  * something in the unacknowledged reliable
  */
 
+#define FRAGMENT_BIT (1U << 30)
+#define FRAGMENT_MORE 0x8000
+#define FRAGMENT_SIZE (MAX_MSGLEN - 16)
+
+#define NETCHAN_TEST_RELIABLE 0xa0
+#define NETCHAN_TEST_UNRELIABLE 0xa1
+
 cvar_t *showpackets;
 cvar_t *showdrop;
 cvar_t *qport;
 
 netadr_t net_from;
 sizebuf_t net_message;
-byte net_message_buffer[MAX_MSGLEN];
+byte net_message_buffer[MAX_FRAGMENTED_MSGLEN];
+
+static void Netchan_Test_f(void);
 
 void
 Netchan_Init(void)
@@ -121,6 +139,8 @@ Netchan_Init(void)
 	showpackets = Cvar_Get("showpackets", "0", 0);
 	showdrop = Cvar_Get("showdrop", "0", 0);
 	qport = Cvar_Get("qport", va("%i", port), CVAR_NOSET);
+
+	Cmd_AddCommand("netchan_test", Netchan_Test_f);
 }
 
 /*
@@ -172,6 +192,7 @@ Netchan_Setup(netsrc_t sock, netchan_t *chan, netadr_t adr, int qport)
 	chan->last_received = curtime;
 	chan->incoming_sequence = 0;
 	chan->outgoing_sequence = 1;
+	chan->version = NETCHAN_VERSION_OLD;
 
 	SZ_Init(&chan->message, chan->message_buf, sizeof(chan->message_buf));
 	chan->message.allowoverflow = true;
@@ -214,6 +235,35 @@ Netchan_NeedReliable(netchan_t *chan)
 	return send_reliable;
 }
 
+/*
+ * Sends a message too large for a single datagram as
+ * fragments. The header is repeated in every fragment.
+ */
+static void
+Netchan_TransmitFragments(netchan_t *chan, sizebuf_t *send, int header,
+		unsigned w1)
+{
+	sizebuf_t frag;
+	byte frag_buf[MAX_MSGLEN];
+	int offset, length, total;
+
+	total = send->cursize - header;
+
+	for (offset = 0; offset < total; offset += length)
+	{
+		length = Q_min(total - offset, FRAGMENT_SIZE);
+
+		SZ_Init(&frag, frag_buf, sizeof(frag_buf));
+		MSG_WriteLong(&frag, w1 | FRAGMENT_BIT);
+		SZ_Write(&frag, send->data + 4, header - 4);
+
+		MSG_WriteShort(&frag, offset | ((offset + length < total) ? FRAGMENT_MORE : 0));
+		SZ_Write(&frag, send->data + header + offset, length);
+
+		NET_SendPacket(chan->sock, frag.cursize, frag.data, chan->remote_address);
+	}
+}
+
 /*
  * tries to send an unreliable message to a connection, and handles the
  * transmition / retransmition of the reliable messages.
@@ -224,9 +274,10 @@ void
 Netchan_Transmit(netchan_t *chan, int length, byte *data)
 {
 	sizebuf_t send;
-	byte send_buf[MAX_MSGLEN];
+	byte send_buf[MAX_FRAGMENTED_MSGLEN];
 	qboolean send_reliable;
 	unsigned w1, w2;
+	int header;
 
 	/* check for message overflow */
 	if (chan->message.overflowed)
@@ -247,8 +298,10 @@ Netchan_Transmit(netchan_t *chan, int length, byte *data)
 		chan->reliable_sequence ^= 1;
 	}
 
-	/* write the packet header */
-	SZ_Init(&send, send_buf, sizeof(send_buf));
+	/* write the packet header, only a channel
+	   that can fragment has room for more */
+	SZ_Init(&send, send_buf, (chan->version >= NETCHAN_VERSION) ?
+			sizeof(send_buf) : MAX_MSGLEN);
 
 	w1 = (chan->outgoing_sequence & ~(1U << 31)) | (send_reliable << 31);
 	w2 =
@@ -267,6 +320,8 @@ Netchan_Transmit(netchan_t *chan, int length, byte *data)
 		MSG_WriteShort(&send, qport->value);
 	}
 
+	header = send.cursize;
+
 	/* copy the reliable message to the packet first */
 	if (send_reliable)
 	{
@@ -285,7 +340,14 @@ Netchan_Transmit(netchan_t *chan, int length, byte *data)
 	}
 
 	/* send the datagram */
-	NET_SendPacket(chan->sock, send.cursize, send.data, chan->remote_address);
+	if ((chan->version >= NETCHAN_VERSION) && (send.cursize >= MAX_MSGLEN))
+	{
+		Netchan_TransmitFragments(chan, &send, header, w1);
+	}
+	else
+	{
+		NET_SendPacket(chan->sock, send.cursize, send.data, chan->remote_address);
+	}
 
 	if (showpackets->value)
 	{
@@ -306,6 +368,94 @@ Netchan_Transmit(netchan_t *chan, int length, byte *data)
 	}
 }
 
+/*
+ * Stores a fragment of the message with the given sequence.
+ * Returns true once the last one is in, msg then holds the
+ * whole message behind the header. Fragments of an older
+ * message still being collected are thrown away.
+ */
+static qboolean
+Netchan_Reassemble(netchan_t *chan, sizebuf_t *msg, int sequence)
+{
+	int offset, length, count;
+	qboolean more;
+
+	offset = MSG_ReadShort(msg) & 0xffff;
+	more = (offset & FRAGMENT_MORE) != 0;
+	offset &= ~FRAGMENT_MORE;
+	length = msg->cursize - msg->readcount;
+
+	if ((length <= 0) || (offset % FRAGMENT_SIZE) ||
+		(more && (length != FRAGMENT_SIZE)) ||
+		(offset + length > (int)sizeof(chan->fragment_buf)) ||
+		(msg->readcount + offset + length > msg->maxsize))
+	{
+		if (showdrop->value)
+		{
+			Com_Printf("%s:Bad fragment at %i\n",
+					NET_AdrToString(chan->remote_address), sequence);
+		}
+
+		return false;
+	}
+
+	/* a late fragment of an older message must not
+	   throw away what's collected of a newer one */
+	if ((sequence < chan->fragment_sequence) && chan->fragment_received)
+	{
+		if (showdrop->value)
+		{
+			Com_Printf("%s:Out of order fragment %i at %i\n",
+					NET_AdrToString(chan->remote_address), sequence,
+					chan->fragment_sequence);
+		}
+
+		return false;
+	}
+
+	if (sequence != chan->fragment_sequence)
+	{
+		if (chan->fragment_received && showdrop->value)
+		{
+			Com_Printf("%s:Dropped incomplete message %i\n",
+					NET_AdrToString(chan->remote_address),
+					chan->fragment_sequence);
+		}
+
+		chan->fragment_sequence = sequence;
+		chan->fragment_length = 0;
+		chan->fragment_received = 0;
+	}
+
+	memcpy(chan->fragment_buf + offset, msg->data + msg->readcount, length);
+	chan->fragment_received |= 1U << (offset / FRAGMENT_SIZE);
+
+	if (!more)
+	{
+		chan->fragment_length = offset + length;
+	}
+
+	if (!chan->fragment_length)
+	{
+		return false;
+	}
+
+	count = (chan->fragment_length + FRAGMENT_SIZE - 1) / FRAGMENT_SIZE;
+
+	if (chan->fragment_received != (1U << count) - 1)
+	{
+		return false;
+	}
+
+	memcpy(msg->data + msg->readcount, chan->fragment_buf, chan->fragment_length);
+	msg->cursize = msg->readcount + chan->fragment_length;
+
+	chan->fragment_length = 0;
+	chan->fragment_received = 0;
+
+	return true;
+}
+
 /*
  * called when the current net_message is from remote_address
  * modifies net_message so that it points to the packet payload
@@ -315,6 +465,7 @@ Netchan_Process(netchan_t *chan, sizebuf_t *msg)
 {
 	unsigned sequence, sequence_ack;
 	unsigned reliable_ack, reliable_message;
+	qboolean fragment;
 
 	/* get sequence numbers */
 	MSG_BeginReading(msg);
@@ -329,10 +480,17 @@ Netchan_Process(netchan_t *chan, sizebuf_t *msg)
 
 	reliable_message = sequence >> 31;
 	reliable_ack = sequence_ack >> 31;
+	fragment = (chan->version >= NETCHAN_VERSION) &&
+		(sequence & FRAGMENT_BIT);
 
 	sequence &= ~(1U << 31);
 	sequence_ack &= ~(1U << 31);
 
+	if (fragment)
+	{
+		sequence &= ~FRAGMENT_BIT;
+	}
+
 	if (showpackets->value)
 	{
 		if (reliable_message)
@@ -363,6 +521,12 @@ Netchan_Process(netchan_t *chan, sizebuf_t *msg)
 		return false;
 	}
 
+	/* wait for the rest of the message */
+	if (fragment && !Netchan_Reassemble(chan, msg, sequence))
+	{
+		return false;
+	}
+
 	/* dropped packets don't keep the message from being used */
 	chan->dropped = sequence - (chan->incoming_sequence + 1);
 
@@ -399,3 +563,176 @@ Netchan_Process(netchan_t *chan, sizebuf_t *msg)
 	return true;
 }
 
+
+/*
+ * Writes a block of the test, a type, a number, a length
+ * and that many bytes that depend on the number.
+ */
+static void
+Netchan_WriteTestBlock(sizebuf_t *msg, int type, int number, int length)
+{
+	int i;
+
+	MSG_WriteByte(msg, type);
+	MSG_WriteLong(msg, number);
+	MSG_WriteShort(msg, length);
+
+	for (i = 0; i < length; i++)
+	{
+		MSG_WriteByte(msg, (number * 31 + i) & 0xff);
+	}
+}
+
+/*
+ * Reads a block of the test. Returns its
+ * type, or -1 if it isn't intact.
+ */
+static int
+Netchan_ReadTestBlock(sizebuf_t *msg, int *number)
+{
+	int type, length, i;
+
+	type = MSG_ReadByte(msg);
+	*number = MSG_ReadLong(msg);
+	length = MSG_ReadShort(msg);
+
+	if (((type != NETCHAN_TEST_RELIABLE) && (type != NETCHAN_TEST_UNRELIABLE)) ||
+		(length < 0) || (msg->readcount + length > msg->cursize))
+	{
+		return -1;
+	}
+
+	for (i = 0; i < length; i++)
+	{
+		if (msg->data[msg->readcount + i] != ((*number * 31 + i) & 0xff))
+		{
+			return -1;
+		}
+	}
+
+	msg->readcount += length;
+
+	return type;
+}
+
+/*
+ * Sends numbered reliable messages over the loopback, each
+ * in a datagram that's fragmented most of the time, and
+ * checks that all of them arrive intact and in order. Set
+ * up net_sim to lose and reorder datagrams. The loopback
+ * is the one of the server, so there must be none running.
+ */
+static void
+Netchan_Test_f(void)
+{
+	static netchan_t chans[2];
+	static int base;
+	sizebuf_t msg;
+	byte msg_buf[MAX_FRAGMENTED_MSGLEN - MAX_MSGLEN];
+	netadr_t adr;
+	int count, sent, received, unreliable, errors;
+	int number, type, start;
+
+	if (Cmd_Argc() > 2)
+	{
+		Com_Printf("Usage: netchan_test [messages]\n");
+		return;
+	}
+
+	if (!dedicated->value || Com_ServerState())
+	{
+		Com_Printf("%s: needs a dedicated server without a map\n", __func__);
+		return;
+	}
+
+	count = (Cmd_Argc() == 2) ? (int)strtol(Cmd_Argv(1), (char **)NULL, 10) : 100;
+	sent = received = unreliable = errors = 0;
+
+	memset(&adr, 0, sizeof(adr));
+	adr.type = NA_LOOPBACK;
+
+	Netchan_Setup(NS_CLIENT, &chans[0], adr, (int)qport->value);
+	Netchan_Setup(NS_SERVER, &chans[1], adr, (int)qport->value);
+	chans[0].version = chans[1].version = NETCHAN_VERSION;
+
+	/* datagrams left over from an earlier run are older */
+	chans[0].outgoing_sequence = chans[1].outgoing_sequence = base + 1;
+	chans[0].incoming_sequence = chans[1].incoming_sequence = base;
+
+	start = Sys_Milliseconds();
+
+	while ((received < count) && (Sys_Milliseconds() - start < 60000))
+	{
+		/* the next one once the last one got through */
+		if ((sent < count) && !chans[0].message.cursize &&
+			Netchan_CanReliable(&chans[0]))
+		{
+			Netchan_WriteTestBlock(&chans[0].message, NETCHAN_TEST_RELIABLE, sent,
+					randk() % (chans[0].message.maxsize - 7));
+			sent++;
+		}
+
+		SZ_Init(&msg, msg_buf, sizeof(msg_buf));
+		Netchan_WriteTestBlock(&msg, NETCHAN_TEST_UNRELIABLE,
+				chans[0].outgoing_sequence, randk() % (msg.maxsize - 7));
+		Netchan_Transmit(&chans[0], msg.cursize, msg.data);
+
+		/* give the simulated link time to deliver */
+		Sys_Nanosleep(1000000);
+
+		while (NET_GetPacket(NS_SERVER, &net_from, &net_message))
+		{
+			if ((net_from.type != NA_LOOPBACK) ||
+				!Netchan_Process(&chans[1], &net_message))
+			{
+				continue;
+			}
+
+			while (net_message.readcount < net_message.cursize)
+			{
+				type = Netchan_ReadTestBlock(&net_message, &number);
+
+				if (type == NETCHAN_TEST_UNRELIABLE)
+				{
+					unreliable++;
+				}
+				else if (type == NETCHAN_TEST_RELIABLE)
+				{
+					if (number != received)
+					{
+						Com_Printf("%s: reliable message %i arrived instead of %i\n",
+								__func__, number, received);
+						errors++;
+					}
+
+					received = number + 1;
+				}
+				else
+				{
+					Com_Printf("%s: message %i is broken\n", __func__,
+							chans[1].incoming_sequence);
+					errors++;
+					break;
+				}
+			}
+		}
+
+		/* the acknowledgements */
+		Netchan_Transmit(&chans[1], 0, NULL);
+
+		while (NET_GetPacket(NS_CLIENT, &net_from, &net_message))
+		{
+			if (net_from.type == NA_LOOPBACK)
+			{
+				Netchan_Process(&chans[0], &net_message);
+			}
+		}
+	}
+
+	Com_Printf("%i of %i reliable messages arrived in order in %i datagrams, "
+			"%i of them arrived, %i errors: %s\n", received, count,
+			chans[0].outgoing_sequence - base - 1, unreliable, errors,
+			((received == count) && !errors) ? "passed" : "FAILED");
+
+	base = Q_max(chans[0].outgoing_sequence, chans[1].outgoing_sequence);
+}
@@ -0,0 +1,445 @@
+/*
+ * Copyright (C) 1997-2001 Id Software, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ * =======================================================================
+ *
+ * Network impairment simulator. Sits between the platform network
+ * code and the rest of the engine and holds back, drops, duplicates
+ * and reorders datagrams as if they went over a bad link. It works
+ * the same for the loopback and for real sockets. Incoming and
+ * outgoing datagrams of the client and the server are four streams,
+ * each with its own random numbers seeded from net_sim_seed, so a
+ * given sequence of datagrams is always impaired the same way.
+ *
+ * =======================================================================
+ */
+
+#include "header/common.h"
+
+#define NETSIM_MAX_PACKETS 512
+#define NETSIM_MAX_BACKLOG 250000 /* usec a capped link may fall behind */
+
+enum
+{
+	NETSIM_IN = 1,
+	NETSIM_OUT = 2
+};
+
+typedef struct
+{
+	qboolean used;
+	int stream;
+	int order; /* keeps datagrams due at the same time in order */
+	long long due;
+	netadr_t adr;
+	int length;
+	byte data[MAX_MSGLEN];
+} netsimpacket_t;
+
+typedef struct
+{
+	unsigned int random;
+	long long lastdue;  /* latest delivery of an in order datagram */
+	long long linkfree; /* when the capped link has sent its backlog */
+
+	unsigned int packets;
+	unsigned int lost;
+	unsigned int duplicated;
+	unsigned int reordered;
+	unsigned int overflowed;
+} netsimstream_t;
+
+static cvar_t *net_sim;
+static cvar_t *net_sim_latency;
+static cvar_t *net_sim_jitter;
+static cvar_t *net_sim_loss;
+static cvar_t *net_sim_duplicate;
+static cvar_t *net_sim_reorder;
+static cvar_t *net_sim_bandwidth;
+static cvar_t *net_sim_seed;
+
+static netsimpacket_t netsim_packets[NETSIM_MAX_PACKETS];
+static netsimstream_t netsim_streams[4];
+static int netsim_queued;
+static int netsim_order;
+static qboolean netsim_releasing;
+
+/*
+ * Streams are numbered sock * 2 + outgoing.
+ */
+static int
+NET_SimStream(netsrc_t sock, int direction)
+{
+	return sock * 2 + (direction == NETSIM_OUT);
+}
+
+static void
+NET_SimSeed(void)
+{
+	int i;
+
+	memset(netsim_streams, 0, sizeof(netsim_streams));
+
+	for (i = 0; i < 4; i++)
+	{
+		/* xorshift must not start at 0 */
+		netsim_streams[i].random = ((unsigned int)net_sim_seed->value + i) * 2654435761U;
+
+		if (!netsim_streams[i].random)
+		{
+			netsim_streams[i].random = 1;
+		}
+	}
+
+	net_sim->modified = false;
+	net_sim_seed->modified = false;
+}
+
+/*
+ * Returns a random number between 0 and 1.
+ */
+static float
+NET_SimRandom(netsimstream_t *stream)
+{
+	unsigned int x = stream->random;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	stream->random = x;
+
+	return (x >> 8) / (float)(1 << 24);
+}
+
+static qboolean
+NET_SimChance(netsimstream_t *stream, cvar_t *percent)
+{
+	return (percent->value > 0) && (NET_SimRandom(stream) * 100.0f < percent->value);
+}
+
+static qboolean
+NET_SimActive(int direction)
+{
+	if (!net_sim)
+	{
+		return false;
+	}
+
+	if (net_sim->modified || net_sim_seed->modified)
+	{
+		NET_SimSeed();
+	}
+
+	return ((int)net_sim->value & direction) != 0;
+}
+
+/*
+ * Queues a copy of the datagram for the time it
+ * would arrive over the simulated link.
+ */
+static void
+NET_SimQueue(int stream, netadr_t adr, int length, const void *data,
+		qboolean duplicate)
+{
+	netsimstream_t *s = &netsim_streams[stream];
+	netsimpacket_t *p;
+	long long now, due;
+	int bandwidth;
+	int i;
+
+	now = Sys_Microseconds();
+	due = now;
+
+	/* a capped link sends one datagram after the other
+	   and drops what doesn't fit into its queue */
+	bandwidth = (int)net_sim_bandwidth->value;
+
+	if (bandwidth > 0)
+	{
+		if (s->linkfree - now > NETSIM_MAX_BACKLOG)
+		{
+			s->overflowed++;
+			return;
+		}
+
+		s->linkfree = Q_max(s->linkfree, now) + (long long)length * 1000000 / bandwidth;
+		due = s->linkfree;
+	}
+
+	due += (long long)(net_sim_latency->value * 1000);
+
+	if (net_sim_jitter->value > 0)
+	{
+		due += (long long)((NET_SimRandom(s) * 2 - 1) * net_sim_jitter->value * 1000);
+	}
+
+	/* jitter alone doesn't reorder, only datagrams
+	   picked for it overtake or get overtaken */
+	if (!duplicate && NET_SimChance(s, net_sim_reorder))
+	{
+		due += (long long)((NET_SimRandom(s) * (net_sim_jitter->value + 20) + 1) * 1000);
+		s->reordered++;
+	}
+	else
+	{
+		due = Q_max(due, s->lastdue);
+		s->lastdue = due;
+	}
+
+	for (i = 0; i < NETSIM_MAX_PACKETS; i++)
+	{
+		if (!netsim_packets[i].used)
+		{
+			break;
+		}
+	}
+
+	if ((i == NETSIM_MAX_PACKETS) || (length > MAX_MSGLEN))
+	{
+		s->overflowed++;
+		return;
+	}
+
+	p = &netsim_packets[i];
+	p->used = true;
+	p->stream = stream;
+	p->order = netsim_order++;
+	p->due = Q_max(due, now);
+	p->adr = adr;
+	p->length = length;
+	memcpy(p->data, data, length);
+
+	netsim_queued++;
+}
+
+/*
+ * Runs a datagram through the simulated link.
+ */
+static void
+NET_SimImpair(int stream, netadr_t adr, int length, const void *data)
+{
+	netsimstream_t *s = &netsim_streams[stream];
+
+	s->packets++;
+
+	if (NET_SimChance(s, net_sim_loss))
+	{
+		s->lost++;
+		return;
+	}
+
+	NET_SimQueue(stream, adr, length, data, false);
+
+	if (NET_SimChance(s, net_sim_duplicate))
+	{
+		s->duplicated++;
+		NET_SimQueue(stream, adr, length, data, true);
+	}
+}
+
+/*
+ * Returns the earliest queued datagram of the stream that's
+ * due, everything is due once the simulator was turned off.
+ */
+static netsimpacket_t *
+NET_SimNextDue(int stream, qboolean all)
+{
+	netsimpacket_t *p, *next;
+	long long now;
+	int i;
+
+	if (!netsim_queued)
+	{
+		return NULL;
+	}
+
+	now = Sys_Microseconds();
+	next = NULL;
+
+	for (i = 0, p = netsim_packets; i < NETSIM_MAX_PACKETS; i++, p++)
+	{
+		if (!p->used || (p->stream != stream) || (!all && (p->due > now)))
+		{
+			continue;
+		}
+
+		if (!next || (p->due < next->due) ||
+			((p->due == next->due) && (p->order < next->order)))
+		{
+			next = p;
+		}
+	}
+
+	return next;
+}
+
+static void
+NET_SimRelease(netsimpacket_t *p)
+{
+	p->used = false;
+	netsim_queued--;
+}
+
+/*
+ * Called by NET_SendPacket(). Returns true if the simulator
+ * took the datagram, it's then sent once it's due.
+ */
+qboolean
+NET_SimSendPacket(netsrc_t sock, int length, const void *data, netadr_t to)
+{
+	if (netsim_releasing || !NET_SimActive(NETSIM_OUT))
+	{
+		return false;
+	}
+
+	NET_SimImpair(NET_SimStream(sock, NETSIM_OUT), to, length, data);
+
+	return true;
+}
+
+/*
+ * Called by NET_GetPacket() for every datagram read from
+ * the network. Returns true if the simulator took it.
+ */
+qboolean
+NET_SimReceivedPacket(netsrc_t sock, netadr_t from, sizebuf_t *net_message)
+{
+	if (!NET_SimActive(NETSIM_IN))
+	{
+		return false;
+	}
+
+	NET_SimImpair(NET_SimStream(sock, NETSIM_IN), from, net_message->cursize,
+			net_message->data);
+
+	return true;
+}
+
+/*
+ * Called by NET_GetPacket() once there's nothing left to
+ * read from the network. Sends the outgoing datagrams that
+ * are due and returns the next incoming one.
+ */
+qboolean
+NET_SimGetPacket(netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message)
+{
+	netsimpacket_t *p;
+	int stream;
+
+	stream = NET_SimStream(sock, NETSIM_OUT);
+
+	while ((p = NET_SimNextDue(stream, !NET_SimActive(NETSIM_OUT))) != NULL)
+	{
+		netsim_releasing = true;
+		NET_SendPacket(sock, p->length, p->data, p->adr);
+		netsim_releasing = false;
+
+		NET_SimRelease(p);
+	}
+
+	stream = NET_SimStream(sock, NETSIM_IN);
+
+	if ((p = NET_SimNextDue(stream, !NET_SimActive(NETSIM_IN))) == NULL)
+	{
+		return false;
+	}
+
+	if (p->length > net_message->maxsize)
+	{
+		NET_SimRelease(p);
+		return false;
+	}
+
+	*net_from = p->adr;
+	memcpy(net_message->data, p->data, p->length);
+	net_message->cursize = p->length;
+
+	NET_SimRelease(p);
+
+	return true;
+}
+
+/*
+ * Returns how long NET_Sleep() may wait at most,
+ * so queued datagrams aren't held back any longer.
+ */
+int
+NET_SimTimeout(int usec)
+{
+	netsimpacket_t *p;
+	long long now;
+	int i;
+
+	if (!netsim_queued)
+	{
+		return usec;
+	}
+
+	now = Sys_Microseconds();
+
+	for (i = 0, p = netsim_packets; i < NETSIM_MAX_PACKETS; i++, p++)
+	{
+		if (p->used && (p->stream / 2 == NS_SERVER))
+		{
+			usec = (int)Q_max(0, Q_min(usec, p->due - now));
+		}
+	}
+
+	return usec;
+}
+
+static void
+NET_SimStats_f(void)
+{
+	static const char *names[4] = {
+		"client in", "client out", "server in", "server out"
+	};
+	netsimstream_t *s;
+	int i;
+
+	Com_Printf("stream      packets     lost duplicated reordered overflowed\n");
+	Com_Printf("---------- -------- -------- ---------- --------- ----------\n");
+
+	for (i = 0; i < 4; i++)
+	{
+		s = &netsim_streams[i];
+
+		Com_Printf("%-10s %8u %8u %10u %9u %10u\n", names[i], s->packets,
+				s->lost, s->duplicated, s->reordered, s->overflowed);
+	}
+
+	Com_Printf("%i datagrams queued\n", netsim_queued);
+}
+
+void
+NET_SimInit(void)
+{
+	net_sim = Cvar_Get("net_sim", "0", 0);
+	net_sim_latency = Cvar_Get("net_sim_latency", "0", 0);
+	net_sim_jitter = Cvar_Get("net_sim_jitter", "0", 0);
+	net_sim_loss = Cvar_Get("net_sim_loss", "0", 0);
+	net_sim_duplicate = Cvar_Get("net_sim_duplicate", "0", 0);
+	net_sim_reorder = Cvar_Get("net_sim_reorder", "0", 0);
+	net_sim_bandwidth = Cvar_Get("net_sim_bandwidth", "0", 0);
+	net_sim_seed = Cvar_Get("net_sim_seed", "0", 0);
+
+	NET_SimSeed();
+
+	Cmd_AddCommand("netsim", NET_SimStats_f);
+}
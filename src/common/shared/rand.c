@@ -15,6 +15,8 @@
 
 #include <stdint.h>
 
+#include "../header/shared.h"
+
 #define QSIZE 0x200000
 #define CNG (cng = 6906969069ULL * cng + 13579)
 #define XS (xs ^= (xs << 13), xs ^= (xs >> 17), xs ^= (xs << 43))
@@ -95,3 +97,60 @@ randk_seed(void)
 	}
 }
 
+/*
+ * Mixes entropy into the seed and seeds the
+ * PRNG again, for copies of a process that
+ * would draw the same numbers otherwise.
+ */
+void
+randk_reseed(unsigned int entropy)
+{
+	cng ^= entropy * 0x9e3779b97f4a7c15ULL;
+	xs ^= ((uint64_t)entropy << 32) | 362436069ULL;
+
+	/* XS never leaves 0 */
+	if (!xs)
+	{
+		xs = 362436069ULL;
+	}
+
+	randk_seed();
+}
+
+/*
+ * Remembers the state of the PRNG. Up to
+ * RANDK_MAX_REWIND numbers drawn after this
+ * are drawn again after randk_rewind().
+ */
+void
+randk_mark(randkmark_t *mark)
+{
+	int i;
+
+	mark->j = j;
+	mark->carry = carry;
+	mark->xs = xs;
+	mark->cng = cng;
+
+	/* each number replaces the next entry */
+	for (i = 0; i < RANDK_MAX_REWIND; i++)
+	{
+		mark->qary[i] = QARY[(j + 1 + i) & (QSIZE - 1)];
+	}
+}
+
+void
+randk_rewind(const randkmark_t *mark)
+{
+	int i;
+
+	j = mark->j;
+	carry = mark->carry;
+	xs = mark->xs;
+	cng = mark->cng;
+
+	for (i = 0; i < RANDK_MAX_REWIND; i++)
+	{
+		QARY[(j + 1 + i) & (QSIZE - 1)] = mark->qary[i];
+	}
+}
@@ -541,6 +541,8 @@ T_Damage(edict_t *targ, edict_t *inflictor, edict_t *attacker,
 		return;
 	}
 
+	G_WakeEdict(targ);
+
 	/* friendly fire avoidance if enabled you
 	   can't hurt teammates (but you can hurt
 	   yourself) knockback still occurs */
@@ -148,6 +148,7 @@ Q2_DLL_EXPORTED game_export_t *
 GetGameAPI(game_import_t *import)
 {
 	gi = *import;
+	G_HookThinkSchedule();
 
 	globals.apiversion = GAME_API_VERSION;
 	globals.Init = InitGame;
@@ -171,6 +172,7 @@ GetGameAPI(game_import_t *import)
 	globals.ServerCommand = ServerCommand;
 
 	globals.edict_size = sizeof(edict_t);
+	globals.SeedRandom = randk_reseed;
 
 	/* Initalize the PRNG */
 	randk_seed();
@@ -245,7 +247,7 @@ CreateTargetChangeLevel(char *map)
 	}
 
 	ent = G_Spawn();
-	ent->classname = "target_changelevel";
+	G_SetClassname(ent, "target_changelevel");
 	Com_sprintf(level.nextmap, sizeof(level.nextmap), "%s", map);
 	ent->map = level.nextmap;
 	return ent;
@@ -458,6 +460,8 @@ G_RunFrame(void)
 	gibsthisframe = 0;
 	debristhisframe = 0;
 
+	G_UpdateFindIndex();
+
 	/* choose a client for monsters to target this frame */
 	AI_SetSightClient();
 
@@ -470,13 +474,16 @@ G_RunFrame(void)
 
 	/* treat each object in turn
 	   even the world gets a chance
-	   to think */
-	ent = &g_edicts[0];
+	   to think, idle ones sleep */
+	G_WakeThinkers();
 
-	for (i = 0; i < globals.num_edicts; i++, ent++)
+	for (i = G_NextAwakeEdict(0); i < globals.num_edicts; i = G_NextAwakeEdict(i + 1))
 	{
+		ent = &g_edicts[i];
+
 		if (!ent->inuse)
 		{
+			G_SleepIfIdle(ent);
 			continue;
 		}
 
@@ -504,6 +511,7 @@ G_RunFrame(void)
 		}
 
 		G_RunEntity(ent);
+		G_SleepIfIdle(ent);
 	}
 
 	/* see if it is time to end a deathmatch */
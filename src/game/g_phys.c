@@ -157,11 +157,13 @@ SV_Impact(edict_t *e1, trace_t *trace)
 
 	if (e1->touch && (e1->solid != SOLID_NOT))
 	{
+		G_WakeEdict(e1);
 		e1->touch(e1, e2, &trace->plane, trace->surface);
 	}
 
 	if (e2->touch && (e2->solid != SOLID_NOT))
 	{
+		G_WakeEdict(e2);
 		e2->touch(e2, e1, NULL, NULL);
 	}
 }
@@ -1307,3 +1309,292 @@ G_RunEntity(edict_t *ent)
 			gi.error("%s: bad movetype %i", __func__, (int)ent->movetype);
 	}
 }
+
+/* ================================================================== */
+
+/* THINK SCHEDULER */
+
+/*
+ * Most entities of a map are lights, path corners, triggers
+ * and targets that don't move and think seldom or never.
+ * Once such an entity ran and won't think in the next frame
+ * it falls asleep and G_RunFrame() skips it. Sleepers with a
+ * nextthink wait in a heap ordered by it and wake up when
+ * it's due. Everything else that may change a sleeper goes
+ * through its use, touch, pain or die function, and whoever
+ * calls them wakes it up first. Code that moves a sleeper
+ * or changes how it moves relinks it, which wakes it up
+ * too. Awake entities still run in edict order, so nothing
+ * changes but the skipped work.
+ */
+static unsigned int think_awake[MAX_EDICTS / 32];
+static short think_heap[MAX_EDICTS];    /* edict numbers, earliest nextthink first */
+static short think_heappos[MAX_EDICTS]; /* by edict number, -1 if not in the heap */
+static float think_time[MAX_EDICTS];    /* the nextthink the edict fell asleep with */
+static int think_heapsize;
+static void (*think_linkentity)(edict_t *ent);
+
+static struct
+{
+	int ran;           /* edicts looked at last frame */
+	unsigned int woken; /* by G_WakeEdict() */
+} think_stats;
+
+static qboolean
+G_ThinkBefore(int a, int b)
+{
+	if (think_time[a] != think_time[b])
+	{
+		return think_time[a] < think_time[b];
+	}
+
+	return a < b;
+}
+
+static void
+G_ThinkHeapSet(int pos, int num)
+{
+	think_heap[pos] = num;
+	think_heappos[num] = pos;
+}
+
+static void
+G_ThinkHeapUp(int pos)
+{
+	int num = think_heap[pos];
+
+	while ((pos > 0) && G_ThinkBefore(num, think_heap[(pos - 1) / 2]))
+	{
+		G_ThinkHeapSet(pos, think_heap[(pos - 1) / 2]);
+		pos = (pos - 1) / 2;
+	}
+
+	G_ThinkHeapSet(pos, num);
+}
+
+static void
+G_ThinkHeapDown(int pos)
+{
+	int num = think_heap[pos];
+	int child;
+
+	while ((child = pos * 2 + 1) < think_heapsize)
+	{
+		if ((child + 1 < think_heapsize) &&
+			G_ThinkBefore(think_heap[child + 1], think_heap[child]))
+		{
+			child++;
+		}
+
+		if (!G_ThinkBefore(think_heap[child], num))
+		{
+			break;
+		}
+
+		G_ThinkHeapSet(pos, think_heap[child]);
+		pos = child;
+	}
+
+	G_ThinkHeapSet(pos, num);
+}
+
+static void
+G_ThinkHeapRemove(int num)
+{
+	int pos = think_heappos[num];
+
+	think_heappos[num] = -1;
+	think_heapsize--;
+
+	if (pos == think_heapsize)
+	{
+		return;
+	}
+
+	G_ThinkHeapSet(pos, think_heap[think_heapsize]);
+	G_ThinkHeapUp(pos);
+	G_ThinkHeapDown(think_heappos[think_heap[pos]]);
+}
+
+/*
+ * Wakes up all edicts, for when they were wiped.
+ */
+void
+G_ResetThinkSchedule(void)
+{
+	memset(think_awake, 0xff, sizeof(think_awake));
+	memset(think_heappos, -1, sizeof(think_heappos));
+	think_heapsize = 0;
+
+	memset(&think_stats, 0, sizeof(think_stats));
+}
+
+/*
+ * Makes sure the edict runs in the next frame, or
+ * in this one if G_RunFrame() didn't get to it yet.
+ */
+void
+G_WakeEdict(edict_t *ent)
+{
+	int num;
+
+	num = ent ? ent - g_edicts : MAX_EDICTS;
+
+	if ((num >= MAX_EDICTS) || (think_awake[num >> 5] & (1U << (num & 31))))
+	{
+		return;
+	}
+
+	if (think_heappos[num] >= 0)
+	{
+		G_ThinkHeapRemove(num);
+	}
+
+	think_awake[num >> 5] |= 1U << (num & 31);
+	think_stats.woken++;
+}
+
+/*
+ * Replaces gi.linkentity(), whatever relinks a
+ * sleeper may have given it something to do.
+ */
+static void
+G_LinkEdict(edict_t *ent)
+{
+	think_linkentity(ent);
+	G_WakeEdict(ent);
+}
+
+/*
+ * Hooks the imports the scheduler needs to
+ * see, called once the game got them.
+ */
+void
+G_HookThinkSchedule(void)
+{
+	think_linkentity = gi.linkentity;
+	gi.linkentity = G_LinkEdict;
+}
+
+/*
+ * Puts the entity that just ran to sleep if
+ * it's going to do nothing for a while.
+ */
+void
+G_SleepIfIdle(edict_t *ent)
+{
+	int num = ent - g_edicts;
+
+	if ((num <= game.maxclients) || (num >= MAX_EDICTS))
+	{
+		return;
+	}
+
+	/* G_InitEdict() wakes it up again */
+	if (!ent->inuse)
+	{
+		think_awake[num >> 5] &= ~(1U << (num & 31));
+		return;
+	}
+
+	/* while asleep the old origin isn't updated */
+	if ((ent->movetype != MOVETYPE_NONE) || ent->prethink || ent->groundentity ||
+		!VectorCompare(ent->s.origin, ent->s.old_origin))
+	{
+		return;
+	}
+
+	if ((ent->nextthink > 0) && (ent->nextthink <= level.time + FRAMETIME + 0.001))
+	{
+		return;
+	}
+
+	think_awake[num >> 5] &= ~(1U << (num & 31));
+
+	if (ent->nextthink > 0)
+	{
+		think_time[num] = ent->nextthink;
+		think_heapsize++;
+		think_heappos[num] = think_heapsize - 1;
+		think_heap[think_heapsize - 1] = num;
+		G_ThinkHeapUp(think_heapsize - 1);
+	}
+}
+
+/*
+ * Called at the start of a frame, wakes up
+ * the sleepers whose nextthink is due.
+ */
+void
+G_WakeThinkers(void)
+{
+	int num;
+
+	while ((think_heapsize > 0) &&
+		   (think_time[think_heap[0]] <= level.time + 0.001))
+	{
+		num = think_heap[0];
+		G_ThinkHeapRemove(num);
+
+		think_awake[num >> 5] |= 1U << (num & 31);
+	}
+
+	think_stats.ran = 0;
+}
+
+/*
+ * Returns the first edict from num on that's
+ * awake, globals.num_edicts if there is none.
+ */
+int
+G_NextAwakeEdict(int num)
+{
+	unsigned int bits;
+
+	while ((num < globals.num_edicts) && (num < MAX_EDICTS))
+	{
+		bits = think_awake[num >> 5] >> (num & 31);
+
+		if (bits)
+		{
+			while (!(bits & 1))
+			{
+				bits >>= 1;
+				num++;
+			}
+
+			break;
+		}
+
+		num = (num | 31) + 1;
+	}
+
+	num = Q_min(num, globals.num_edicts);
+
+	if (num < globals.num_edicts)
+	{
+		think_stats.ran++;
+	}
+
+	return num;
+}
+
+void
+G_ThinkStats(void)
+{
+	int asleep, i;
+
+	asleep = 0;
+
+	for (i = game.maxclients + 1; i < Q_min(globals.num_edicts, MAX_EDICTS); i++)
+	{
+		if (g_edicts[i].inuse && !(think_awake[i >> 5] & (1U << (i & 31))))
+		{
+			asleep++;
+		}
+	}
+
+	gi.cprintf(NULL, PRINT_HIGH, "%i edicts ran last frame, %i asleep, %i of them "
+			"waiting to think, %u woken up by others\n", think_stats.ran, asleep,
+			think_heapsize, think_stats.woken);
+}
@@ -616,6 +616,9 @@ SpawnEntities(const char *mapname, char *entities, const char *spawnpoint)
 
 	memset(&level, 0, sizeof(level));
 	memset(g_edicts, 0, game.maxentities * sizeof(g_edicts[0]));
+	G_ResetFindIndex();
+	G_ResetFreeEdicts();
+	G_ResetThinkSchedule();
 
 	Q_strlcpy(level.mapname, mapname, sizeof(level.mapname));
 	Q_strlcpy(game.spawnpoint, spawnpoint, sizeof(game.spawnpoint));
@@ -656,6 +659,7 @@ SpawnEntities(const char *mapname, char *entities, const char *spawnpoint)
 		}
 
 		entities = ED_ParseEdict(entities, ent);
+		G_IndexEdict(ent);
 
 		/* yet another map hack */
 		if (!Q_stricmp(level.mapname, "command") &&
@@ -702,6 +706,7 @@ SpawnEntities(const char *mapname, char *entities, const char *spawnpoint)
 		}
 
 		ED_CallSpawn(ent);
+		G_IndexEdict(ent);
 	}
 
 	/* in case the last entity in the entstring has spawntemp fields */
@@ -712,6 +717,8 @@ SpawnEntities(const char *mapname, char *entities, const char *spawnpoint)
 	G_FindTeams();
 
 	PlayerTrail_Init();
+
+	G_ResetFreeEdicts();
 }
 
 /* =================================================================== */
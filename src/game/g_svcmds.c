@@ -344,6 +344,15 @@ ServerCommand(void)
 	{
 		SVCmd_WriteIP_f();
 	}
+	else if (Q_stricmp(cmd, "edicts") == 0)
+	{
+		G_EdictStats();
+		G_ThinkStats();
+	}
+	else if (Q_stricmp(cmd, "findbench") == 0)
+	{
+		G_FindBenchmark((gi.argc() > 2) ? atoi(gi.argv(2)) : 100);
+	}
 	else
 	{
 		gi.cprintf(NULL, PRINT_HIGH, "Unknown server command \"%s\"\n", cmd);
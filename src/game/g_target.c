@@ -624,7 +624,7 @@ use_target_spawner(edict_t *self, edict_t *other /* unused */, edict_t *activato
 	}
 
 	ent = G_Spawn();
-	ent->classname = self->target;
+	G_SetClassname(ent, self->target);
 	VectorCopy(self->s.origin, ent->s.origin);
 	VectorCopy(self->s.angles, ent->s.angles);
 	ED_CallSpawn(ent);
@@ -24,6 +24,8 @@
  * =======================================================================
  */
 
+#include <time.h>
+
 #include "header/local.h"
 
 #define MAXCHOICES 8
@@ -38,6 +40,246 @@ G_ProjectSource(const vec3_t point, const vec3_t distance, const vec3_t forward,
 				distance[2];
 }
 
+/*
+ * Every edict is kept in a hash chain by its classname and
+ * by its targetname, each chain sorted by edict number, so
+ * G_Find() only looks at the edicts with that name. The
+ * chains are updated when an edict is spawned, freed or one
+ * of the names is set through G_SetClassname() and
+ * G_SetTargetname(). Once a frame all edicts are checked
+ * for names that were changed some other way.
+ */
+#define FIND_HASH_SIZE 256
+
+typedef struct
+{
+	size_t fieldofs;
+	short heads[FIND_HASH_SIZE];  /* first edict of each chain, -1 if empty */
+	short next[MAX_EDICTS];
+	short prev[MAX_EDICTS];
+	const char *keys[MAX_EDICTS]; /* the name the edict is chained by */
+	byte hashes[MAX_EDICTS];
+} findindex_t;
+
+static findindex_t find_indexes[2];
+
+static struct
+{
+	unsigned int indexed;  /* G_Find() calls that used a chain */
+	unsigned int scanned;  /* G_Find() calls that had to scan */
+	unsigned int visited;  /* edicts looked at by chained calls */
+	unsigned int reindexed;
+} find_stats;
+
+static unsigned int
+G_FindHash(const char *name)
+{
+	unsigned int hash = 0;
+	int c;
+
+	/* case insensitive like Q_stricmp() */
+	while ((c = *name++) != 0)
+	{
+		if ((c >= 'A') && (c <= 'Z'))
+		{
+			c += 'a' - 'A';
+		}
+
+		hash = hash * 31 + c;
+	}
+
+	return hash & (FIND_HASH_SIZE - 1);
+}
+
+static findindex_t *
+G_FindIndexFor(size_t fieldofs)
+{
+	int i;
+
+	for (i = 0; i < 2; i++)
+	{
+		if (find_indexes[i].fieldofs == fieldofs)
+		{
+			return &find_indexes[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void
+G_UnchainEdict(findindex_t *index, int num)
+{
+	if (index->prev[num] >= 0)
+	{
+		index->next[index->prev[num]] = index->next[num];
+	}
+	else
+	{
+		index->heads[index->hashes[num]] = index->next[num];
+	}
+
+	if (index->next[num] >= 0)
+	{
+		index->prev[index->next[num]] = index->prev[num];
+	}
+
+	index->keys[num] = NULL;
+}
+
+static void
+G_ChainEdict(findindex_t *index, int num, const char *key)
+{
+	int hash, prev, next;
+
+	hash = G_FindHash(key);
+	prev = -1;
+	next = index->heads[hash];
+
+	while ((next >= 0) && (next < num))
+	{
+		prev = next;
+		next = index->next[next];
+	}
+
+	index->next[num] = next;
+	index->prev[num] = prev;
+
+	if (prev >= 0)
+	{
+		index->next[prev] = num;
+	}
+	else
+	{
+		index->heads[hash] = num;
+	}
+
+	if (next >= 0)
+	{
+		index->prev[next] = num;
+	}
+
+	index->keys[num] = key;
+	index->hashes[num] = hash;
+}
+
+/*
+ * Moves the edict to the chains of its current names.
+ */
+void
+G_IndexEdict(edict_t *ent)
+{
+	findindex_t *index;
+	const char *key;
+	int num, i;
+
+	num = ent ? ent - g_edicts : MAX_EDICTS;
+
+	if (num >= MAX_EDICTS)
+	{
+		return;
+	}
+
+	for (i = 0; i < 2; i++)
+	{
+		index = &find_indexes[i];
+		key = *(char **)((byte *)ent + index->fieldofs);
+
+		if (key == index->keys[num])
+		{
+			continue;
+		}
+
+		if (index->keys[num])
+		{
+			G_UnchainEdict(index, num);
+		}
+
+		if (key)
+		{
+			G_ChainEdict(index, num, key);
+		}
+
+		find_stats.reindexed++;
+	}
+}
+
+/*
+ * Empties the chains, for when all edicts were wiped.
+ */
+void
+G_ResetFindIndex(void)
+{
+	int i;
+
+	memset(find_indexes, 0, sizeof(find_indexes));
+
+	for (i = 0; i < 2; i++)
+	{
+		memset(find_indexes[i].heads, -1, sizeof(find_indexes[i].heads));
+	}
+
+	find_indexes[0].fieldofs = FOFS(classname);
+	find_indexes[1].fieldofs = FOFS(targetname);
+}
+
+/*
+ * Catches the names that were changed without
+ * G_SetClassname() or G_SetTargetname().
+ */
+void
+G_UpdateFindIndex(void)
+{
+	int i;
+
+	for (i = 0; i < Q_min(game.maxentities, MAX_EDICTS); i++)
+	{
+		G_IndexEdict(&g_edicts[i]);
+	}
+}
+
+void
+G_SetClassname(edict_t *ent, char *classname)
+{
+	ent->classname = classname;
+	G_IndexEdict(ent);
+}
+
+void
+G_SetTargetname(edict_t *ent, char *targetname)
+{
+	ent->targetname = targetname;
+	G_IndexEdict(ent);
+}
+
+static edict_t *
+G_FindLinear(edict_t *from, int fieldofs, const char *match)
+{
+	char *s;
+
+	for ( ; from < &g_edicts[globals.num_edicts]; from++)
+	{
+		if (!from->inuse)
+		{
+			continue;
+		}
+
+		s = *(char **)((byte *)from + fieldofs);
+
+		if (!s)
+		{
+			continue;
+		}
+
+		if (!Q_stricmp(s, match))
+		{
+			return from;
+		}
+	}
+
+	return NULL;
+}
+
 /*
  * Searches all active entities for the next
  * one that holds the matching string at fieldofs
@@ -50,39 +292,66 @@ G_ProjectSource(const vec3_t point, const vec3_t distance, const vec3_t forward,
 edict_t *
 G_Find(edict_t *from, int fieldofs, const char *match)
 {
+	findindex_t *index;
+	const char *key;
+	edict_t *ent;
 	char *s;
+	int num, start;
 
 	if (!match)
 	{
 		return NULL;
 	}
 
-	if (!from)
+	start = from ? from - g_edicts + 1 : 0;
+	index = G_FindIndexFor((size_t)fieldofs);
+
+	/* the chains only hold MAX_EDICTS edicts */
+	if (!index || (globals.num_edicts > MAX_EDICTS))
+	{
+		find_stats.scanned++;
+		return G_FindLinear(g_edicts + start, fieldofs, match);
+	}
+
+	find_stats.indexed++;
+	key = from ? index->keys[start - 1] : NULL;
+
+	/* when going through all matches from is in
+	   the chain, so carry on from there */
+	if (key && ((key == match) || !Q_stricmp(key, match)))
 	{
-		from = g_edicts;
+		num = index->next[start - 1];
 	}
 	else
 	{
-		from++;
+		num = index->heads[G_FindHash(match)];
 	}
 
-	for ( ; from < &g_edicts[globals.num_edicts]; from++)
+	for ( ; num >= 0; num = index->next[num])
 	{
-		if (!from->inuse)
+		if (num >= globals.num_edicts)
+		{
+			break;
+		}
+
+		if (num < start)
 		{
 			continue;
 		}
 
-		s = *(char **)((byte *)from + fieldofs);
+		find_stats.visited++;
+		ent = &g_edicts[num];
 
-		if (!s)
+		if (!ent->inuse)
 		{
 			continue;
 		}
 
-		if (!Q_stricmp(s, match))
+		s = *(char **)((byte *)ent + fieldofs);
+
+		if (s && ((s == match) || !Q_stricmp(s, match)))
 		{
-			return from;
+			return ent;
 		}
 	}
 
@@ -90,50 +359,215 @@ G_Find(edict_t *from, int fieldofs, const char *match)
 }
 
 /*
- * Returns entities that have origins
- * within a spherical area
+ * Looks up every targetname and classname of the map
+ * the given number of times, through the chains and
+ * by scanning all edicts, and prints how long it took.
  */
-edict_t *
-findradius(edict_t *from, vec3_t org, float rad)
+void
+G_FindBenchmark(int passes)
+{
+	clock_t start, chained, scanned;
+	edict_t *ent, *found;
+	int pass, i, j, matches[2];
+	size_t fields[2];
+
+	fields[0] = FOFS(classname);
+	fields[1] = FOFS(targetname);
+
+	G_UpdateFindIndex();
+
+	for (j = 0; j < 2; j++)
+	{
+		start = clock();
+		matches[0] = 0;
+
+		for (pass = 0; pass < passes; pass++)
+		{
+			for (i = 0, ent = g_edicts; i < globals.num_edicts; i++, ent++)
+			{
+				const char *name = *(char **)((byte *)ent + fields[j]);
+
+				if (!ent->inuse || !name)
+				{
+					continue;
+				}
+
+				for (found = NULL; (found = G_Find(found, fields[j], name)) != NULL; )
+				{
+					matches[0]++;
+				}
+			}
+		}
+
+		chained = clock() - start;
+		start = clock();
+		matches[1] = 0;
+
+		for (pass = 0; pass < passes; pass++)
+		{
+			for (i = 0, ent = g_edicts; i < globals.num_edicts; i++, ent++)
+			{
+				const char *name = *(char **)((byte *)ent + fields[j]);
+
+				if (!ent->inuse || !name)
+				{
+					continue;
+				}
+
+				for (found = g_edicts; (found = G_FindLinear(found, fields[j], name)) != NULL; found++)
+				{
+					matches[1]++;
+				}
+			}
+		}
+
+		scanned = clock() - start;
+
+		gi.cprintf(NULL, PRINT_HIGH, "%s: %i matches, %.1f msec chained, %i matches, "
+				"%.1f msec scanning all %i edicts\n", j ? "targetname" : "classname",
+				matches[0], chained * 1000.0 / CLOCKS_PER_SEC, matches[1],
+				scanned * 1000.0 / CLOCKS_PER_SEC, globals.num_edicts);
+	}
+
+	gi.cprintf(NULL, PRINT_HIGH, "%u lookups chained looking at %u edicts, %u scanned, "
+			"%u names changed\n", find_stats.indexed, find_stats.visited,
+			find_stats.scanned, find_stats.reindexed);
+}
+
+/*
+ * The edicts found by the last radius query. Going through
+ * them with findradius() takes only one query, unless an
+ * edict was spawned in the meantime.
+ */
+static edict_t *radius_list[MAX_EDICTS];
+static int radius_count;
+static int radius_next;
+static vec3_t radius_org;
+static float radius_rad;
+static unsigned int radius_spawned;
+static unsigned int edicts_spawned;
+
+static qboolean
+G_InRadius(edict_t *ent, vec3_t org, float rad)
 {
 	vec3_t eorg;
 	int j;
 
-	if (!from)
+	if (!ent->inuse || (ent->solid == SOLID_NOT))
 	{
-		from = g_edicts;
+		return false;
 	}
-	else
+
+	for (j = 0; j < 3; j++)
 	{
-		from++;
+		eorg[j] = org[j] - (ent->s.origin[j] +
+				   (ent->mins[j] + ent->maxs[j]) * 0.5);
 	}
 
-	for ( ; from < &g_edicts[globals.num_edicts]; from++)
+	return DotProduct(eorg, eorg) <= rad * rad;
+}
+
+static int
+G_CompareEdicts(const void *a, const void *b)
+{
+	edict_t *ea = *(edict_t *const *)a;
+	edict_t *eb = *(edict_t *const *)b;
+
+	return (ea > eb) - (ea < eb);
+}
+
+/*
+ * Collects the solid and trigger edicts in the box
+ * around the sphere and keeps those whose center is
+ * inside it, in edict order. Edicts that aren't
+ * linked into the world are never found.
+ */
+static int
+G_RadiusEdicts(vec3_t org, float rad, edict_t **list, int maxcount)
+{
+	vec3_t mins, maxs;
+	int i, num, count;
+
+	for (i = 0; i < 3; i++)
 	{
-		if (!from->inuse)
-		{
-			continue;
-		}
+		mins[i] = org[i] - rad;
+		maxs[i] = org[i] + rad;
+	}
+
+	/* the center is inside the absolute box, so the
+	   box touches the one around the sphere */
+	num = gi.BoxEdicts(mins, maxs, list, maxcount, AREA_SOLID);
+	num += gi.BoxEdicts(mins, maxs, list + num, maxcount - num, AREA_TRIGGERS);
 
-		if (from->solid == SOLID_NOT)
+	count = 0;
+
+	for (i = 0; i < num; i++)
+	{
+		if (G_InRadius(list[i], org, rad))
 		{
-			continue;
+			list[count++] = list[i];
 		}
+	}
+
+	qsort(list, count, sizeof(list[0]), G_CompareEdicts);
+
+	return count;
+}
+
+/*
+ * Returns entities that have origins
+ * within a spherical area
+ */
+edict_t *
+findradius(edict_t *from, vec3_t org, float rad)
+{
+	edict_t *ent;
+	int i;
+
+	/* a nested search may have replaced the list */
+	if (!from || !VectorCompare(org, radius_org) || (rad != radius_rad) ||
+		(radius_spawned != edicts_spawned))
+	{
+		radius_count = G_RadiusEdicts(org, rad, radius_list, MAX_EDICTS);
+		radius_next = 0;
+		radius_spawned = edicts_spawned;
+		VectorCopy(org, radius_org);
+		radius_rad = rad;
+	}
+
+	/* the world isn't linked, it comes first */
+	if (!from && G_InRadius(g_edicts, org, rad))
+	{
+		return g_edicts;
+	}
 
-		for (j = 0; j < 3; j++)
+	if (from && ((radius_next == 0) || (radius_list[radius_next - 1] != from)))
+	{
+		for (radius_next = 0; radius_next < radius_count; radius_next++)
 		{
-			eorg[j] = org[j] - (from->s.origin[j] +
-					   (from->mins[j] + from->maxs[j]) * 0.5);
+			if (radius_list[radius_next] > from)
+			{
+				break;
+			}
 		}
+	}
+
+	/* entities may have been freed or
+	   moved since the list was made */
+	for (i = radius_next; i < radius_count; i++)
+	{
+		ent = radius_list[i];
 
-		if (VectorLength(eorg) > rad)
+		if (G_InRadius(ent, org, rad))
 		{
-			continue;
-		}
+			radius_next = i + 1;
 
-		return from;
+			return ent;
+		}
 	}
 
+	radius_next = radius_count;
+
 	return NULL;
 }
 
@@ -226,7 +660,7 @@ G_UseTargets(edict_t *ent, edict_t *activator)
 	{
 		/* create a temp object to fire at a later time */
 		t = G_Spawn();
-		t->classname = "DelayedUse";
+		G_SetClassname(t, "DelayedUse");
 		t->nextthink = level.time + ent->delay;
 		t->think = Think_Delay;
 		t->activator = activator;
@@ -315,6 +749,7 @@ G_UseTargets(edict_t *ent, edict_t *activator)
 			{
 				if (t->use)
 				{
+					G_WakeEdict(t);
 					t->use(t, ent, activator);
 				}
 			}
@@ -504,11 +939,110 @@ G_InitEdict(edict_t *e)
 	}
 
 	e->inuse = true;
-	e->classname = "noclass";
+	G_SetClassname(e, "noclass");
+	G_WakeEdict(e);
+	edicts_spawned++;
 	e->gravity = 1.0;
 	e->s.number = e - g_edicts;
 }
 
+/*
+ * Free edicts wait in a queue ordered by the time they were
+ * freed, so the head is the first one that may be reused.
+ * Edicts that were freed without G_FreeEdict() aren't in
+ * it, they're only found when nothing else is left.
+ */
+static short freequeue_next[MAX_EDICTS];
+static short freequeue_prev[MAX_EDICTS];
+static qboolean freequeue_queued[MAX_EDICTS];
+static int freequeue_head = -1;
+static int freequeue_tail = -1;
+
+static struct
+{
+	unsigned int allocated;
+	unsigned int reused;
+	unsigned int desperate; /* reused before the delay was over */
+	float waited;           /* seconds reused edicts were free */
+	float maxwait;
+	int inuse;
+	int highwater;
+} edict_stats;
+
+static void
+G_QueueFreeEdict(int num)
+{
+	freequeue_next[num] = -1;
+	freequeue_prev[num] = freequeue_tail;
+
+	if (freequeue_tail >= 0)
+	{
+		freequeue_next[freequeue_tail] = num;
+	}
+	else
+	{
+		freequeue_head = num;
+	}
+
+	freequeue_tail = num;
+	freequeue_queued[num] = true;
+}
+
+static void
+G_UnqueueFreeEdict(int num)
+{
+	if (freequeue_prev[num] >= 0)
+	{
+		freequeue_next[freequeue_prev[num]] = freequeue_next[num];
+	}
+	else
+	{
+		freequeue_head = freequeue_next[num];
+	}
+
+	if (freequeue_next[num] >= 0)
+	{
+		freequeue_prev[freequeue_next[num]] = freequeue_prev[num];
+	}
+	else
+	{
+		freequeue_tail = freequeue_prev[num];
+	}
+
+	freequeue_queued[num] = false;
+}
+
+/*
+ * Queues all free edicts by their number and starts the
+ * statistics over. Called once the edicts of a level were
+ * spawned or loaded, they were all freed at the same time.
+ */
+void
+G_ResetFreeEdicts(void)
+{
+	int i, last;
+
+	freequeue_head = freequeue_tail = -1;
+	memset(freequeue_queued, 0, sizeof(freequeue_queued));
+	memset(&edict_stats, 0, sizeof(edict_stats));
+
+	last = Q_min(globals.num_edicts, MAX_EDICTS);
+
+	for (i = game.maxclients + 1; i < last; i++)
+	{
+		if (g_edicts[i].inuse)
+		{
+			edict_stats.inuse++;
+		}
+		else
+		{
+			G_QueueFreeEdict(i);
+		}
+	}
+
+	edict_stats.highwater = edict_stats.inuse;
+}
+
 /*
  * Either finds a free edict, or allocates a
  * new one.  Try to avoid reusing an entity
@@ -525,14 +1059,55 @@ static edict_t *
 G_FindFreeEdict(int policy)
 {
 	edict_t *e;
+	int num;
 
-	for (e = g_edicts + game.maxclients + 1 ; e < &g_edicts[globals.num_edicts] ; e++)
+	while ((num = freequeue_head) >= 0)
 	{
+		e = &g_edicts[num];
+
 		/* the first couple seconds of server time can involve a lot of
-		   freeing and allocating, so relax the replacement policy
+		   freeing and allocating, so relax the replacement policy.
+		   If the head may not be reused yet, nothing after it may.
 		*/
-		if (!e->inuse && (policy == POLICY_DESPERATE || e->freetime < 2.0f || (level.time - e->freetime) > 0.5f))
+		if (!e->inuse && (policy != POLICY_DESPERATE) && (e->freetime >= 2.0f) &&
+			((level.time - e->freetime) <= 0.5f))
+		{
+			return NULL;
+		}
+
+		G_UnqueueFreeEdict(num);
+
+		/* in use again without G_Spawn() */
+		if (e->inuse)
+		{
+			continue;
+		}
+
+		edict_stats.reused++;
+		edict_stats.waited += level.time - e->freetime;
+		edict_stats.maxwait = Q_max(edict_stats.maxwait, level.time - e->freetime);
+
+		if ((e->freetime >= 2.0f) && ((level.time - e->freetime) <= 0.5f))
+		{
+			edict_stats.desperate++;
+		}
+
+		G_InitEdict (e);
+		return e;
+	}
+
+	if (policy != POLICY_DESPERATE)
+	{
+		return NULL;
+	}
+
+	for (e = g_edicts + game.maxclients + 1 ; e < &g_edicts[globals.num_edicts] ; e++)
+	{
+		if (!e->inuse)
 		{
+			edict_stats.reused++;
+			edict_stats.desperate++;
+
 			G_InitEdict (e);
 			return e;
 		}
@@ -546,22 +1121,45 @@ G_SpawnOptional(void)
 {
 	edict_t	*e = G_FindFreeEdict (POLICY_DEFAULT);
 
-	if (e)
+	if (!e)
 	{
-		return e;
+		if (globals.num_edicts >= game.maxentities)
+		{
+			e = G_FindFreeEdict (POLICY_DESPERATE);
+		}
+		else
+		{
+			e = &g_edicts[globals.num_edicts++];
+			G_InitEdict (e);
+		}
 	}
 
-	if (globals.num_edicts >= game.maxentities)
+	if (e)
 	{
-		return G_FindFreeEdict (POLICY_DESPERATE);
+		edict_stats.allocated++;
+		edict_stats.inuse++;
+		edict_stats.highwater = Q_max(edict_stats.highwater, edict_stats.inuse);
 	}
 
-	e = &g_edicts[globals.num_edicts++];
-	G_InitEdict (e);
-
 	return e;
 }
 
+/*
+ * Prints how edicts were allocated since the level started.
+ */
+void
+G_EdictStats(void)
+{
+	gi.cprintf(NULL, PRINT_HIGH, "%u edicts allocated, %u reused, %u of them early\n",
+			edict_stats.allocated, edict_stats.reused, edict_stats.desperate);
+	gi.cprintf(NULL, PRINT_HIGH, "reused edicts were free %.2f sec on average, %.2f sec at most\n",
+			edict_stats.reused ? edict_stats.waited / edict_stats.reused : 0.0f,
+			edict_stats.maxwait);
+	gi.cprintf(NULL, PRINT_HIGH, "%i edicts besides the clients in use, %i at most, %i of %i slots used\n",
+			edict_stats.inuse, edict_stats.highwater, globals.num_edicts,
+			game.maxentities);
+}
+
 edict_t *
 G_Spawn(void)
 {
@@ -603,10 +1201,29 @@ G_FreeEdict(edict_t *ed)
 		}
 	}
 
+	if (ed->inuse)
+	{
+		edict_stats.inuse--;
+	}
+
+	/* out of the think schedule */
+	G_WakeEdict(ed);
+
 	memset(ed, 0, sizeof(*ed));
-	ed->classname = "freed";
+	G_SetClassname(ed, "freed");
 	ed->freetime = level.time;
 	ed->inuse = false;
+
+	/* freed again, it goes to the end */
+	if ((ed - g_edicts) < MAX_EDICTS)
+	{
+		if (freequeue_queued[ed - g_edicts])
+		{
+			G_UnqueueFreeEdict(ed - g_edicts);
+		}
+
+		G_QueueFreeEdict(ed - g_edicts);
+	}
 }
 
 void
@@ -645,6 +1262,7 @@ G_TouchTriggers(edict_t *ent)
 			continue;
 		}
 
+		G_WakeEdict(hit);
 		hit->touch(hit, ent, NULL, NULL);
 	}
 }
@@ -682,6 +1300,7 @@ G_TouchSolids(edict_t *ent)
 
 		if (ent->touch)
 		{
+			G_WakeEdict(hit);
 			ent->touch(hit, ent, NULL, NULL);
 		}
 
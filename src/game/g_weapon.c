@@ -26,6 +26,8 @@
 
 #include "header/local.h"
 
+#define MAX_PELLETS 32 /* pellets traced in one batch */
+
 /*
  * This is a support routine used when a client is firing
  * a non-instant attack weapon.  It checks to see if a
@@ -166,6 +168,153 @@ fire_hit(edict_t *self, vec3_t aim, int damage, int kick)
 	return true;
 }
 
+/*
+ * Handles a bullet that hit water: spawns the splash,
+ * changes its course and traces it again, ignoring
+ * the water this time.
+ */
+static void
+fire_lead_water(vec3_t start, vec3_t end, edict_t *self, int hspread,
+		int vspread, trace_t *tr, qboolean *water, vec3_t water_start)
+{
+	vec3_t dir;
+	vec3_t forward, right, up;
+	float r;
+	float u;
+
+	if (!(tr->contents & MASK_WATER))
+	{
+		return;
+	}
+
+	*water = true;
+	VectorCopy(tr->endpos, water_start);
+
+	if (!VectorCompare(start, tr->endpos))
+	{
+		int color;
+
+		if (tr->contents & CONTENTS_WATER)
+		{
+			if (strcmp(tr->surface->name, "*brwater") == 0)
+			{
+				color = SPLASH_BROWN_WATER;
+			}
+			else
+			{
+				color = SPLASH_BLUE_WATER;
+			}
+		}
+		else if (tr->contents & CONTENTS_SLIME)
+		{
+			color = SPLASH_SLIME;
+		}
+		else if (tr->contents & CONTENTS_LAVA)
+		{
+			color = SPLASH_LAVA;
+		}
+		else
+		{
+			color = SPLASH_UNKNOWN;
+		}
+
+		if (color != SPLASH_UNKNOWN)
+		{
+			gi.WriteByte(svc_temp_entity);
+			gi.WriteByte(TE_SPLASH);
+			gi.WriteByte(8);
+			gi.WritePosition(tr->endpos);
+			gi.WriteDir(tr->plane.normal);
+			gi.WriteByte(color);
+			gi.multicast(tr->endpos, MULTICAST_PVS);
+		}
+
+		/* change bullet's course when it enters water */
+		VectorSubtract(end, start, dir);
+		vectoangles(dir, dir);
+		AngleVectors(dir, forward, right, up);
+		r = crandom() * hspread * 2;
+		u = crandom() * vspread * 2;
+		VectorMA(water_start, 8192, forward, end);
+		VectorMA(end, r, right, end);
+		VectorMA(end, u, up, end);
+	}
+
+	/* re-trace ignoring water this time */
+	*tr = gi.trace(water_start, NULL, NULL, end, self, MASK_SHOT);
+}
+
+/*
+ * Sends the gun puff or damages whatever
+ * the bullet hit and draws the bubble trail
+ * if it went through water.
+ */
+static void
+fire_lead_impact(edict_t *self, vec3_t aimdir, int damage, int kick,
+		int te_impact, int mod, trace_t *tr, qboolean water,
+		vec3_t water_start)
+{
+	vec3_t dir;
+
+	/* send gun puff / flash */
+	if (!((tr->surface) && (tr->surface->flags & SURF_SKY)))
+	{
+		if (tr->fraction < 1.0)
+		{
+			if (tr->ent->takedamage)
+			{
+				T_Damage(tr->ent, self, self, aimdir, tr->endpos, tr->plane.normal,
+						damage, kick, DAMAGE_BULLET, mod);
+			}
+			else
+			{
+				if (tr->surface && strncmp(tr->surface->name, "sky", 3) != 0)
+				{
+					gi.WriteByte(svc_temp_entity);
+					gi.WriteByte(te_impact);
+					gi.WritePosition(tr->endpos);
+					gi.WriteDir(tr->plane.normal);
+					gi.multicast(tr->endpos, MULTICAST_PVS);
+
+					if (self->client)
+					{
+						PlayerNoise(self, tr->endpos, PNOISE_IMPACT);
+					}
+				}
+			}
+		}
+	}
+
+	/* if went through water, determine
+	   where the end and make a bubble trail */
+	if (water)
+	{
+		vec3_t pos;
+
+		VectorSubtract(tr->endpos, water_start, dir);
+		VectorNormalize(dir);
+		VectorMA(tr->endpos, -2, dir, pos);
+
+		if (gi.pointcontents(pos) & MASK_WATER)
+		{
+			VectorCopy(pos, tr->endpos);
+		}
+		else
+		{
+			*tr = gi.trace(pos, NULL, NULL, water_start, tr->ent, MASK_WATER);
+		}
+
+		VectorAdd(water_start, tr->endpos, pos);
+		VectorScale(pos, 0.5, pos);
+
+		gi.WriteByte(svc_temp_entity);
+		gi.WriteByte(TE_BUBBLETRAIL);
+		gi.WritePosition(water_start);
+		gi.WritePosition(tr->endpos);
+		gi.multicast(pos, MULTICAST_PVS);
+	}
+}
+
 /*
  * This is an internal support routine
  * used for bullet/pellet based weapons.
@@ -212,122 +361,137 @@ fire_lead(edict_t *self, vec3_t start, vec3_t aimdir, int damage, int kick,
 		tr = gi.trace(start, NULL, NULL, end, self, content_mask);
 
 		/* see if we hit water */
-		if (tr.contents & MASK_WATER)
-		{
-			int color;
+		fire_lead_water(start, end, self, hspread, vspread,
+				&tr, &water, water_start);
+	}
 
-			water = true;
-			VectorCopy(tr.endpos, water_start);
+	fire_lead_impact(self, aimdir, damage, kick, te_impact, mod,
+			&tr, water, water_start);
+}
 
-			if (!VectorCompare(start, tr.endpos))
-			{
-				if (tr.contents & CONTENTS_WATER)
-				{
-					if (strcmp(tr.surface->name, "*brwater") == 0)
-					{
-						color = SPLASH_BROWN_WATER;
-					}
-					else
-					{
-						color = SPLASH_BLUE_WATER;
-					}
-				}
-				else if (tr.contents & CONTENTS_SLIME)
-				{
-					color = SPLASH_SLIME;
-				}
-				else if (tr.contents & CONTENTS_LAVA)
-				{
-					color = SPLASH_LAVA;
-				}
-				else
-				{
-					color = SPLASH_UNKNOWN;
-				}
+/*
+ * Draws the direction of a pellet like fire_lead() does.
+ */
+static void
+fire_lead_end(vec3_t start, vec3_t forward, vec3_t right, vec3_t up,
+		int hspread, int vspread, vec3_t end)
+{
+	float r;
+	float u;
 
-				if (color != SPLASH_UNKNOWN)
-				{
-					gi.WriteByte(svc_temp_entity);
-					gi.WriteByte(TE_SPLASH);
-					gi.WriteByte(8);
-					gi.WritePosition(tr.endpos);
-					gi.WriteDir(tr.plane.normal);
-					gi.WriteByte(color);
-					gi.multicast(tr.endpos, MULTICAST_PVS);
-				}
+	r = crandom() * hspread;
+	u = crandom() * vspread;
+	VectorMA(start, 8192, forward, end);
+	VectorMA(end, r, right, end);
+	VectorMA(end, u, up, end);
+}
 
-				/* change bullet's course when it enters water */
-				VectorSubtract(end, start, dir);
-				vectoangles(dir, dir);
-				AngleVectors(dir, forward, right, up);
-				r = crandom() * hspread * 2;
-				u = crandom() * vspread * 2;
-				VectorMA(water_start, 8192, forward, end);
-				VectorMA(end, r, right, end);
-				VectorMA(end, u, up, end);
-			}
+/*
+ * Like fire_lead(), but for a whole spread of
+ * pellets. The pellets are traced in one batch
+ * before any of them is handled.
+ */
+static void
+fire_lead_spread(edict_t *self, vec3_t start, vec3_t aimdir, int damage,
+		int kick, int te_impact, int hspread, int vspread, int count,
+		int mod)
+{
+	traceray_t rays[MAX_PELLETS];
+	trace_t traces[MAX_PELLETS];
+	int linkcounts[MAX_PELLETS];
+	trace_t tr;
+	randkmark_t mark;
+	vec3_t dir, end;
+	vec3_t forward, right, up;
+	vec3_t water_start;
+	qboolean water;
+	qboolean inwater = false;
+	int content_mask = MASK_SHOT | MASK_WATER;
+	int i;
 
-			/* re-trace ignoring water this time */
-			tr = gi.trace(water_start, NULL, NULL, end, self, MASK_SHOT);
+	tr = gi.trace(self->s.origin, NULL, NULL, start, self, MASK_SHOT);
+
+	if (tr.fraction < 1.0)
+	{
+		/* the muzzle is blocked, that's rare
+		   enough to handle pellet by pellet */
+		for (i = 0; i < count; i++)
+		{
+			fire_lead(self, start, aimdir, damage, kick, te_impact,
+					hspread, vspread, mod);
 		}
+
+		return;
 	}
 
-	/* send gun puff / flash */
-	if (!((tr.surface) && (tr.surface->flags & SURF_SKY)))
+	vectoangles(aimdir, dir);
+	AngleVectors(dir, forward, right, up);
+
+	if (gi.pointcontents(start) & MASK_WATER)
 	{
-		if (tr.fraction < 1.0)
-		{
-			if (tr.ent->takedamage)
-			{
-				T_Damage(tr.ent, self, self, aimdir, tr.endpos, tr.plane.normal,
-						damage, kick, DAMAGE_BULLET, mod);
-			}
-			else
-			{
-				if (tr.surface && strncmp(tr.surface->name, "sky", 3) != 0)
-				{
-					gi.WriteByte(svc_temp_entity);
-					gi.WriteByte(te_impact);
-					gi.WritePosition(tr.endpos);
-					gi.WriteDir(tr.plane.normal);
-					gi.multicast(tr.endpos, MULTICAST_PVS);
+		inwater = true;
+		content_mask &= ~MASK_WATER;
+	}
 
-					if (self->client)
-					{
-						PlayerNoise(self, tr.endpos, PNOISE_IMPACT);
-					}
-				}
-			}
-		}
+	/* the directions are drawn ahead for the batch and then
+	   once more pellet by pellet, so the random numbers are
+	   drawn in the same order as by fire_lead(). A pellet
+	   whose direction changed because an earlier one drew
+	   numbers, for example by hurting a monster, is traced
+	   on its own. */
+	randk_mark(&mark);
+
+	for (i = 0; i < count; i++)
+	{
+		fire_lead_end(start, forward, right, up, hspread, vspread,
+				rays[i].end);
+
+		VectorCopy(start, rays[i].start);
+		VectorClear(rays[i].mins);
+		VectorClear(rays[i].maxs);
+		rays[i].passent = self;
+		rays[i].contentmask = content_mask;
 	}
 
-	/* if went through water, determine
-	   where the end and make a bubble trail */
-	if (water)
+	gi.trace_batch(rays, traces, count);
+	randk_rewind(&mark);
+
+	for (i = 0; i < count; i++)
 	{
-		vec3_t pos;
+		linkcounts[i] = traces[i].ent ? traces[i].ent->linkcount : 0;
+	}
 
-		VectorSubtract(tr.endpos, water_start, dir);
-		VectorNormalize(dir);
-		VectorMA(tr.endpos, -2, dir, pos);
+	for (i = 0; i < count; i++)
+	{
+		fire_lead_end(start, forward, right, up, hspread, vspread, end);
 
-		if (gi.pointcontents(pos) & MASK_WATER)
+		if (!VectorCompare(end, rays[i].end))
 		{
-			VectorCopy(pos, tr.endpos);
+			tr = gi.trace(start, NULL, NULL, end, self, content_mask);
 		}
 		else
 		{
-			tr = gi.trace(pos, NULL, NULL, water_start, tr.ent, MASK_WATER);
+			tr = traces[i];
+
+			/* an earlier pellet may have gibbed or removed
+			   what this one hit, or killed it and so shrunk
+			   its box, which relinks it */
+			if (tr.ent && (!tr.ent->inuse || (tr.ent->solid == SOLID_NOT) ||
+						   (tr.ent->linkcount != linkcounts[i])))
+			{
+				tr = gi.trace(start, NULL, NULL, end, self, content_mask);
+			}
 		}
 
-		VectorAdd(water_start, tr.endpos, pos);
-		VectorScale(pos, 0.5, pos);
+		water = inwater;
+		VectorCopy(start, water_start);
 
-		gi.WriteByte(svc_temp_entity);
-		gi.WriteByte(TE_BUBBLETRAIL);
-		gi.WritePosition(water_start);
-		gi.WritePosition(tr.endpos);
-		gi.multicast(pos, MULTICAST_PVS);
+		/* see if we hit water */
+		fire_lead_water(start, end, self, hspread, vspread,
+				&tr, &water, water_start);
+
+		fire_lead_impact(self, aimdir, damage, kick, te_impact, mod,
+				&tr, water, water_start);
 	}
 }
 
@@ -356,17 +520,22 @@ void
 fire_shotgun(edict_t *self, vec3_t start, vec3_t aimdir, int damage,
 		int kick, int hspread, int vspread, int count, int mod)
 {
-	int i;
+	int i, num;
+
+	/* fire_lead_spread() draws the numbers of a batch twice */
+	YQ2_STATIC_ASSERT(MAX_PELLETS * 2 <= RANDK_MAX_REWIND,
+			"MAX_PELLETS is too large for randk_rewind()");
 
 	if (!self)
 	{
 		return;
 	}
 
-	for (i = 0; i < count; i++)
+	for (i = 0; i < count; i += num)
 	{
-		fire_lead(self, start, aimdir, damage, kick, TE_SHOTGUN,
-				hspread, vspread, mod);
+		num = Q_min(count - i, MAX_PELLETS);
+		fire_lead_spread(self, start, aimdir, damage, kick, TE_SHOTGUN,
+				hspread, vspread, num, mod);
 	}
 }
 
@@ -484,7 +653,7 @@ fire_blaster(edict_t *self, vec3_t start, vec3_t dir, int damage,
 	bolt->nextthink = level.time + 2;
 	bolt->think = G_FreeEdict;
 	bolt->dmg = damage;
-	bolt->classname = "bolt";
+	G_SetClassname(bolt, "bolt");
 
 	if (hyper)
 	{
@@ -678,7 +847,7 @@ fire_grenade(edict_t *self, vec3_t start, vec3_t aimdir, int damage, int speed,
 	grenade->think = Grenade_Explode;
 	grenade->dmg = damage;
 	grenade->dmg_radius = damage_radius;
-	grenade->classname = "grenade";
+	G_SetClassname(grenade, "grenade");
 
 	gi.linkentity(grenade);
 }
@@ -718,7 +887,7 @@ fire_grenade2(edict_t *self, vec3_t start, vec3_t aimdir, int damage,
 	grenade->think = Grenade_Explode;
 	grenade->dmg = damage;
 	grenade->dmg_radius = damage_radius;
-	grenade->classname = "hgrenade";
+	G_SetClassname(grenade, "hgrenade");
 
 	if (held)
 	{
@@ -857,7 +1026,7 @@ fire_rocket(edict_t *self, vec3_t start, vec3_t dir, int damage,
 	rocket->radius_dmg = radius_damage;
 	rocket->dmg_radius = damage_radius;
 	rocket->s.sound = gi.soundindex("weapons/rockfly.wav");
-	rocket->classname = "rocket";
+	G_SetClassname(rocket, "rocket");
 
 	if (self->client)
 	{
@@ -1214,7 +1383,7 @@ fire_bfg(edict_t *self, vec3_t start, vec3_t dir, int damage,
 	bfg->think = G_FreeEdict;
 	bfg->radius_dmg = damage;
 	bfg->dmg_radius = damage_radius;
-	bfg->classname = "bfg blast";
+	G_SetClassname(bfg, "bfg blast");
 	bfg->s.sound = gi.soundindex("weapons/bfg__l1a.wav");
 
 	bfg->think = bfg_think;
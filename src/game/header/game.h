@@ -34,7 +34,12 @@
  * !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
  */
 
-#define GAME_API_VERSION 3
+#define GAME_API_VERSION 4
+
+/* Version 4 only adds to the end of game_import_t and
+   game_export_t, so the engine still runs games of the
+   old version. */
+#define GAME_API_VERSION_OLD 3
 
 #define SVF_NOCLIENT 0x00000001 /* don't send entity to clients, even if it has effects */
 #define SVF_DEADMONSTER 0x00000002 /* treat as CONTENTS_DEADMONSTER for collision */
@@ -101,6 +106,17 @@ struct edict_s
 
 /* =============================================================== */
 
+/* a single ray for trace_batch, mins and maxs
+   are all zero for point traces */
+typedef struct
+{
+	vec3_t start;
+	vec3_t mins, maxs;
+	vec3_t end;
+	edict_t *passent;
+	int contentmask;
+} traceray_t;
+
 /* functions provided by the main engine */
 typedef struct
 {
@@ -181,6 +197,11 @@ typedef struct
 	void (*AddCommandString)(char *text);
 
 	void (*DebugGraph)(float value, int color);
+
+	/* traces count independent rays at once, as if trace was
+	   called for each of them in order, and writes the results
+	   to traces. Added with GAME_API_VERSION 4. */
+	void (*trace_batch)(traceray_t *rays, trace_t *traces, int count);
 } game_import_t;
 
 /* functions exported by the game subsystem */
@@ -234,4 +255,8 @@ typedef struct
 	int edict_size;
 	int num_edicts;             /* current number, <= max_edicts */
 	int max_edicts;
+
+	/* mixes entropy into the seed of the game's random
+	   numbers. Added with GAME_API_VERSION 4. */
+	void (*SeedRandom)(unsigned int entropy);
 } game_export_t;
@@ -635,12 +635,20 @@ qboolean KillBox(edict_t *ent);
 void G_ProjectSource(const vec3_t point, const vec3_t distance, const vec3_t forward,
 		const vec3_t right, vec3_t result);
 edict_t *G_Find(edict_t *from, int fieldofs, const char *match);
+void G_IndexEdict(edict_t *ent);
+void G_ResetFindIndex(void);
+void G_UpdateFindIndex(void);
+void G_SetClassname(edict_t *ent, char *classname);
+void G_SetTargetname(edict_t *ent, char *targetname);
+void G_FindBenchmark(int passes);
 edict_t *findradius(edict_t *from, vec3_t org, float rad);
 edict_t *G_PickTarget(char *targetname);
 void G_UseTargets(edict_t *ent, edict_t *activator);
 void G_SetMovedir(vec3_t angles, vec3_t movedir);
 
 void G_InitEdict(edict_t *e);
+void G_ResetFreeEdicts(void);
+void G_EdictStats(void);
 edict_t *G_SpawnOptional(void);
 edict_t *G_Spawn(void);
 void G_FreeEdict(edict_t *e);
@@ -807,6 +815,13 @@ void M_ChangeYaw(edict_t *ent);
 
 /* g_phys.c */
 void G_RunEntity(edict_t *ent);
+void G_ResetThinkSchedule(void);
+void G_HookThinkSchedule(void);
+void G_WakeEdict(edict_t *ent);
+void G_SleepIfIdle(edict_t *ent);
+void G_WakeThinkers(void);
+int G_NextAwakeEdict(int num);
+void G_ThinkStats(void);
 
 /* g_main.c */
 void SaveClientData(void);
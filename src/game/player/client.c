@@ -74,7 +74,7 @@ SP_FixCoopSpots(edict_t *self)
 		{
 			if ((!self->targetname) || (Q_stricmp(self->targetname, spot->targetname) != 0))
 			{
-				self->targetname = spot->targetname;
+				G_SetTargetname(self, spot->targetname);
 			}
 
 			return;
@@ -101,27 +101,27 @@ SP_CreateCoopSpots(edict_t *self)
 	if (Q_stricmp(level.mapname, "security") == 0)
 	{
 		spot = G_Spawn();
-		spot->classname = "info_player_coop";
+		G_SetClassname(spot, "info_player_coop");
 		spot->s.origin[0] = 188 - 64;
 		spot->s.origin[1] = -164;
 		spot->s.origin[2] = 80;
-		spot->targetname = "jail3";
+		G_SetTargetname(spot, "jail3");
 		spot->s.angles[1] = 90;
 
 		spot = G_Spawn();
-		spot->classname = "info_player_coop";
+		G_SetClassname(spot, "info_player_coop");
 		spot->s.origin[0] = 188 + 64;
 		spot->s.origin[1] = -164;
 		spot->s.origin[2] = 80;
-		spot->targetname = "jail3";
+		G_SetTargetname(spot, "jail3");
 		spot->s.angles[1] = 90;
 
 		spot = G_Spawn();
-		spot->classname = "info_player_coop";
+		G_SetClassname(spot, "info_player_coop");
 		spot->s.origin[0] = 188 + 128;
 		spot->s.origin[1] = -164;
 		spot->s.origin[2] = 80;
-		spot->targetname = "jail3";
+		G_SetTargetname(spot, "jail3");
 		spot->s.angles[1] = 90;
 
 		return;
@@ -159,7 +159,7 @@ CreateUnnamedSpawnpoint(const edict_t *self, const char *mapname, const char *sp
 		return;
 	}
 
-	spot->classname = "info_player_start";
+	G_SetClassname(spot, "info_player_start");
 
 	VectorCopy(self->s.origin, spot->s.origin);
 	spot->s.angles[1] = self->s.angles[1];
@@ -1308,7 +1308,7 @@ InitBodyQue(void)
 		for (i = 0; i < BODY_QUEUE_SIZE; i++)
 		{
 			ent = G_Spawn();
-			ent->classname = "bodyque";
+			G_SetClassname(ent, "bodyque");
 		}
 	}
 }
@@ -1375,6 +1375,8 @@ CopyToBodyQue(edict_t *ent)
 	body->die = body_die;
 	body->takedamage = DAMAGE_YES;
 
+	/* it slept as a MOVETYPE_NONE placeholder */
+	G_WakeEdict(body);
 	gi.linkentity(body);
 }
 
@@ -1604,7 +1606,7 @@ PutClientInServer(edict_t *ent)
 	ent->movetype = MOVETYPE_WALK;
 	ent->viewheight = 22;
 	ent->inuse = true;
-	ent->classname = "player";
+	G_SetClassname(ent, "player");
 	ent->mass = 200;
 	ent->solid = SOLID_BBOX;
 	ent->deadflag = DEAD_NO;
@@ -1788,7 +1790,7 @@ ClientBegin(edict_t *ent)
 		   except for the persistant data that was initialized at
 		   ClientConnect() time */
 		G_InitEdict(ent);
-		ent->classname = "player";
+		G_SetClassname(ent, "player");
 		InitClientResp(ent->client);
 		PutClientInServer(ent);
 	}
@@ -2026,7 +2028,7 @@ ClientDisconnect(edict_t *ent)
 	ent->s.modelindex = 0;
 	ent->solid = SOLID_NOT;
 	ent->inuse = false;
-	ent->classname = "disconnected";
+	G_SetClassname(ent, "disconnected");
 	ent->client->pers.connected = false;
 
 	playernum = ent - g_edicts - 1;
@@ -2254,6 +2256,7 @@ ClientThink(edict_t *ent, usercmd_t *ucmd)
 				continue;
 			}
 
+			G_WakeEdict(other);
 			other->touch(other, ent, NULL, NULL);
 		}
 	}
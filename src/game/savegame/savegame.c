@@ -181,6 +181,8 @@ static field_t clientfields[] = {
 
 /* ========================================================= */
 
+static void InitSaveTables(void);
+
 static void
 InitAllocations(void)
 {
@@ -201,6 +203,7 @@ InitAllocations(void)
 
 	g_edicts = gi.TagMalloc (num_e * sizeof(g_edicts[0]), TAG_GAME);
 	game.maxentities = num_e;
+	G_ResetFindIndex();
 
 	globals.edicts = g_edicts;
 	globals.num_edicts = num_c + 1;
@@ -281,6 +284,7 @@ InitGame(void)
 	memset(&game, 0, sizeof(game));
 
 	InitItems();
+	InitSaveTables();
 
 	/* initialize entities and clients arrays */
 	InitAllocations();
@@ -289,26 +293,182 @@ InitGame(void)
 /* ========================================================= */
 
 /*
- * Helper function to get
- * the human readable function
- * definition by an address.
- * Called by WriteField1 and
- * WriteField2.
+ * The lists are searched for every function and mmove_t
+ * pointer of every edict and client that's saved or loaded,
+ * so they're put into hash tables when the game is loaded.
+ * The tables use open addressing, a slot holds the index
+ * into the list plus one and 0 marks a free slot. They're
+ * at least twice as large as the lists to keep the probe
+ * sequences short.
  */
-static functionList_t *
-GetFunctionByAddress(byte *adr)
+#define FUNCTION_HASH_SIZE 2048
+#define MMOVE_HASH_SIZE 1024
+
+static unsigned short functionByAddress[FUNCTION_HASH_SIZE];
+static unsigned short functionByName[FUNCTION_HASH_SIZE];
+static unsigned short mmoveByAddress[MMOVE_HASH_SIZE];
+static unsigned short mmoveByName[MMOVE_HASH_SIZE];
+
+static unsigned int
+HashPointer(const void *ptr)
+{
+	unsigned long long v = (size_t)ptr;
+	unsigned int h = (unsigned int)(v ^ (v >> 32));
+
+	/* functions are aligned, so mix
+	   the upper bits into the lower */
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+
+	return h;
+}
+
+static unsigned int
+HashString(const char *str)
+{
+	unsigned int h = 2166136261U;
+
+	while (*str)
+	{
+		h = (h ^ (byte)*str++) * 16777619U;
+	}
+
+	return h;
+}
+
+/*
+ * Each of these returns the slot that holds the
+ * entry for the key, or the free slot where it
+ * would be inserted.
+ */
+static unsigned int
+FunctionSlotByAddress(byte *adr)
+{
+	unsigned int slot = HashPointer(adr) & (FUNCTION_HASH_SIZE - 1);
+
+	while (functionByAddress[slot] &&
+			(functionList[functionByAddress[slot] - 1].funcPtr != adr))
+	{
+		slot = (slot + 1) & (FUNCTION_HASH_SIZE - 1);
+	}
+
+	return slot;
+}
+
+static unsigned int
+FunctionSlotByName(const char *name)
+{
+	unsigned int slot = HashString(name) & (FUNCTION_HASH_SIZE - 1);
+
+	while (functionByName[slot] &&
+			strcmp(functionList[functionByName[slot] - 1].funcStr, name))
+	{
+		slot = (slot + 1) & (FUNCTION_HASH_SIZE - 1);
+	}
+
+	return slot;
+}
+
+static unsigned int
+MmoveSlotByAddress(mmove_t *adr)
+{
+	unsigned int slot = HashPointer(adr) & (MMOVE_HASH_SIZE - 1);
+
+	while (mmoveByAddress[slot] &&
+			(mmoveList[mmoveByAddress[slot] - 1].mmovePtr != adr))
+	{
+		slot = (slot + 1) & (MMOVE_HASH_SIZE - 1);
+	}
+
+	return slot;
+}
+
+static unsigned int
+MmoveSlotByName(const char *name)
+{
+	unsigned int slot = HashString(name) & (MMOVE_HASH_SIZE - 1);
+
+	while (mmoveByName[slot] &&
+			strcmp(mmoveList[mmoveByName[slot] - 1].mmoveStr, name))
+	{
+		slot = (slot + 1) & (MMOVE_HASH_SIZE - 1);
+	}
+
+	return slot;
+}
+
+/*
+ * Fills the hash tables. Called by InitGame.
+ */
+static void
+InitSaveTables(void)
 {
+	unsigned int slot;
 	int i;
 
+	YQ2_STATIC_ASSERT(sizeof(functionList) / sizeof(functionList[0]) <= FUNCTION_HASH_SIZE / 2,
+			"FUNCTION_HASH_SIZE is too small for functionList");
+	YQ2_STATIC_ASSERT(sizeof(mmoveList) / sizeof(mmoveList[0]) <= MMOVE_HASH_SIZE / 2,
+			"MMOVE_HASH_SIZE is too small for mmoveList");
+
+	memset(functionByAddress, 0, sizeof(functionByAddress));
+	memset(functionByName, 0, sizeof(functionByName));
+	memset(mmoveByAddress, 0, sizeof(mmoveByAddress));
+	memset(mmoveByName, 0, sizeof(mmoveByName));
+
+	/* if a key is listed twice the first
+	   entry wins, like in a linear search */
 	for (i = 0; functionList[i].funcStr; i++)
 	{
-		if (functionList[i].funcPtr == adr)
+		slot = FunctionSlotByAddress(functionList[i].funcPtr);
+
+		if (!functionByAddress[slot])
+		{
+			functionByAddress[slot] = i + 1;
+		}
+
+		slot = FunctionSlotByName(functionList[i].funcStr);
+
+		if (!functionByName[slot])
+		{
+			functionByName[slot] = i + 1;
+		}
+	}
+
+	for (i = 0; mmoveList[i].mmoveStr; i++)
+	{
+		slot = MmoveSlotByAddress(mmoveList[i].mmovePtr);
+
+		if (!mmoveByAddress[slot])
 		{
-			return &functionList[i];
+			mmoveByAddress[slot] = i + 1;
+		}
+
+		slot = MmoveSlotByName(mmoveList[i].mmoveStr);
+
+		if (!mmoveByName[slot])
+		{
+			mmoveByName[slot] = i + 1;
 		}
 	}
+}
+
+/*
+ * Helper function to get
+ * the human readable function
+ * definition by an address.
+ * Called by WriteField1 and
+ * WriteField2.
+ */
+static functionList_t *
+GetFunctionByAddress(byte *adr)
+{
+	int i = functionByAddress[FunctionSlotByAddress(adr)];
 
-	return NULL;
+	return i ? &functionList[i - 1] : NULL;
 }
 
 /*
@@ -321,17 +481,9 @@ GetFunctionByAddress(byte *adr)
 static byte *
 FindFunctionByName(char *name)
 {
-	int i;
+	int i = functionByName[FunctionSlotByName(name)];
 
-	for (i = 0; functionList[i].funcStr; i++)
-	{
-		if (!strcmp(name, functionList[i].funcStr))
-		{
-			return functionList[i].funcPtr;
-		}
-	}
-
-	return NULL;
+	return i ? functionList[i - 1].funcPtr : NULL;
 }
 
 /*
@@ -342,17 +494,9 @@ FindFunctionByName(char *name)
 static mmoveList_t *
 GetMmoveByAddress(mmove_t *adr)
 {
-	int i;
-
-	for (i = 0; mmoveList[i].mmoveStr; i++)
-	{
-		if (mmoveList[i].mmovePtr == adr)
-		{
-			return &mmoveList[i];
-		}
-	}
+	int i = mmoveByAddress[MmoveSlotByAddress(adr)];
 
-	return NULL;
+	return i ? &mmoveList[i - 1] : NULL;
 }
 
 /*
@@ -363,17 +507,9 @@ GetMmoveByAddress(mmove_t *adr)
 static mmove_t *
 FindMmoveByName(char *name)
 {
-	int i;
+	int i = mmoveByName[MmoveSlotByName(name)];
 
-	for (i = 0; mmoveList[i].mmoveStr; i++)
-	{
-		if (!strcmp(name, mmoveList[i].mmoveStr))
-		{
-			return mmoveList[i].mmovePtr;
-		}
-	}
-
-	return NULL;
+	return i ? mmoveList[i - 1].mmovePtr : NULL;
 }
 
 
@@ -1195,6 +1331,7 @@ ReadLevel(const char *filename)
 	/* wipe all the entities */
 	memset(g_edicts, 0, game.maxentities * sizeof(g_edicts[0]));
 	globals.num_edicts = maxclients->value + 1;
+	G_ResetFindIndex();
 
 	/* check edict size */
 	if (fread(&i, sizeof(i), 1, f) != 1)
@@ -1250,6 +1387,10 @@ ReadLevel(const char *filename)
 
 	fclose(f);
 
+	G_UpdateFindIndex();
+	G_ResetFreeEdicts();
+	G_ResetThinkSchedule();
+
 	/* mark all clients as unconnected */
 	for (i = 0; i < maxclients->value; i++)
 	{
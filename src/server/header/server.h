@@ -27,12 +27,13 @@
 #ifndef SV_SERVER_H
 #define SV_SERVER_H
 
+#include <stdint.h>
+
 #include "../../common/header/common.h"
 #include "../../game/header/game.h"
 
 #define MAX_MASTERS 8
 #define LATENCY_COUNTS 16
-#define RATE_MESSAGES 10
 
 /* MAX_CHALLENGES is made large to prevent a denial
    of service attack that could cycle all of them
@@ -107,6 +108,8 @@ typedef struct
 	int num_entities;
 	int first_entity;                       /* into the circular sv_packet_entities[] */
 	int senttime;                           /* for ping calculations */
+	int framenum;
+	qboolean acked;                         /* the client has it, can delta from it */
 } client_frame_t;
 
 typedef struct client_s
@@ -116,6 +119,7 @@ typedef struct client_s
 	char userinfo[MAX_INFO_STRING];     /* name, etc */
 
 	int lastframe;                      /* for delta compression */
+	int lossframe;                      /* sv.framenum when its packets last went missing, or 0 */
 	usercmd_t lastcmd;                  /* for filling in big drops */
 
 	int commandMsec;                    /* every seconds this is reset, if user */
@@ -124,10 +128,27 @@ typedef struct client_s
 	int frame_latency[LATENCY_COUNTS];
 	int ping;
 
-	int message_size[RATE_MESSAGES];    /* used to rate drop packets */
 	int rate;
+	int ratetokens;                     /* bytes that may be sent now, see SV_RateAllows() */
+	int ratetime;                       /* svs.realtime ratetokens were last refilled */
 	int surpressCount;                  /* number of messages rate supressed */
 
+	/* send statistics */
+	unsigned long long bytes_sent;      /* frames and downloads */
+	unsigned long long download_bytes;
+	unsigned int frames_suppressed;     /* not sent, rate exhausted */
+	unsigned int frames_trimmed;        /* some entities deferred to fit the rate */
+	unsigned int entities_deferred;
+
+	/* frame sizes, see SV_WriteFrameToClient() */
+	unsigned int frames_sent;
+	unsigned int frames_olderbase;      /* delta'd from an older acked frame */
+	unsigned int frames_nodelta;        /* delta'd from the baselines */
+	unsigned long long frame_bytes;
+	unsigned long long frame_bytes_lastack; /* had they been delta'd from lastframe */
+	unsigned int deltas_cached;         /* entity deltas copied from the frame's cache */
+	unsigned int deltas_encoded;
+
 	char name[32];                      /* extracted from userinfo, high bits masked */
 
 	/* The datagram is written to by sound calls, prints,
@@ -140,6 +161,12 @@ typedef struct client_s
 	byte *download;                     /* file being downloaded */
 	int downloadsize;                   /* total bytes (can't use EOF because of paks) */
 	int downloadcount;                  /* bytes sent */
+	char downloadname[MAX_QPATH];
+	int downloadwindow;                 /* bytes sent ahead of downloadacked, 0 for one block per nextdl */
+	int downloadacked;                  /* bytes the client has */
+	int downloadtime;                   /* svs.realtime the download last made progress */
+	int downloadcredit;                 /* bytes sv_downloadrate allows to send */
+	int downloadcredittime;
 
 	int lastmessage;                    /* sv.framenum when packet was last received */
 	int lastconnect;
@@ -147,8 +174,31 @@ typedef struct client_s
 	int challenge;                      /* challenge of this user, randomly generated */
 
 	netchan_t netchan;
+
+	struct client_s *hashnext;          /* next client in the same svs.clienthash chain */
 } client_t;
 
+/* Per client scratch space for building and encoding a frame.
+   Filled by SV_SetupClientFrame() on the main thread, read and
+   written by exactly one worker afterwards. */
+typedef struct
+{
+	qboolean valid;                     /* false if not in game yet */
+	vec3_t org;
+	int clientarea;
+	int32_t fatpvs[65536 / 32];
+	int32_t phs[65536 / 32];
+	int numentities;
+	short entities[MAX_EDICTS];         /* visible edict numbers, ascending */
+	int budget;                         /* bytes the frame may take */
+	int numdeferred;
+	const entity_state_t *oldstates[MAX_EDICTS]; /* per entities[] slot, the last sent state if held back */
+	byte entityage[MAX_EDICTS];         /* by edict number, frames its update was held back */
+	sizebuf_t msg;
+	byte msg_buf[MAX_FRAGMENTED_MSGLEN - MAX_MSGLEN]; /* leave room for the reliable part */
+	byte trial_buf[MAX_FRAGMENTED_MSGLEN - MAX_MSGLEN]; /* frame delta'd from another base */
+} client_view_t;
+
 typedef struct
 {
 	netadr_t adr;
@@ -156,10 +206,13 @@ typedef struct
 	int time;
 } challenge_t;
 
+#define CLIENT_HASH_SIZE 512
+
 typedef struct
 {
 	qboolean initialized;               /* sv_init has completed */
 	int realtime;                       /* always increasing, no clamping, etc */
+	int realtime_usec;                  /* microseconds not yet added to realtime */
 
 	char mapcmd[MAX_SAVE_TOKEN_CHARS];  /* ie: *intro.cin+base */
 
@@ -170,6 +223,15 @@ typedef struct
 	int num_client_entities;            /* maxclients->value*UPDATE_BACKUP*MAX_PACKET_ENTITIES */
 	int next_client_entities;           /* next client_entity to use */
 	entity_state_t *client_entities;    /* [num_client_entities] */
+	client_view_t *client_views;        /* [maxclients->value] */
+	client_t *clienthash[CLIENT_HASH_SIZE]; /* non-free clients by base address and qport */
+
+	int packets_dispatched;             /* handed to a client's netchan */
+	int packets_dropped;                /* unknown source or too short */
+
+	int frames_run;                     /* game frames since startup */
+	long long frame_late_total;         /* usec they started after sv.time */
+	int frame_late_max;
 
 	int last_heartbeat;
 
@@ -201,6 +263,7 @@ extern cvar_t *sv_noreload;                 /* don't reload level state when ree
 extern cvar_t *sv_airaccelerate;            /* don't reload level state when reentering */
 											/* development tool */
 extern cvar_t *sv_enforcetime;
+extern cvar_t *sv_downloadrate;
 extern cvar_t *sv_downloadserver;			/* Download server. */
 
 extern client_t *sv_client;
@@ -208,6 +271,8 @@ extern edict_t *sv_player;
 
 void SV_FinalMessage(char *message, qboolean reconnect);
 void SV_DropClient(client_t *drop);
+void SV_HashClient(client_t *cl);
+void SV_UnhashClient(client_t *cl);
 
 int SV_ModelIndex(char *name);
 int SV_SoundIndex(char *name);
@@ -253,7 +318,19 @@ void SV_ReadLevelFile(void);
 
 void SV_WriteFrameToClient(client_t *client, sizebuf_t *msg);
 void SV_RecordDemoMessage(void);
-void SV_BuildClientFrame(client_t *client);
+qboolean SV_SetupClientFrame(client_t *client, client_view_t *view);
+void SV_CullClientEntities(client_t *client, client_view_t *view);
+void SV_StoreClientFrame(client_t *client, client_view_t *view);
+void SV_BuildDeltaCache(client_t **clients, int count);
+
+/* worker pool for per client work */
+void SV_InitWorkers(void);
+void SV_ShutdownWorkers(void);
+
+void SV_InitInstances(void);
+void SV_ForkInstances(void);
+void SV_RunJobs(void (*func)(int index), int count);
+void SV_JobWarning(const char *warning);
 
 extern game_export_t *ge;
 
@@ -271,6 +348,8 @@ void SV_Savegame_f(void);
 
 /* high level object sorting to reduce interaction tests */
 void SV_ClearWorld(void);
+void SV_ShutdownWorld(void);
+qboolean SV_EdictClustersVisible(edict_t *ent, const int32_t *visbits);
 
 /* called after the world model has been loaded, before linking any entities */
 void SV_UnlinkEdict(edict_t *ent);
@@ -287,9 +366,11 @@ int SV_AreaEdicts(vec3_t mins, vec3_t maxs, edict_t **list,
 		int maxcount, int areatype);
 
 int SV_PointContents(vec3_t p);
+void SV_AreaBench_f(void);
 
 trace_t SV_Trace(vec3_t start, vec3_t mins, vec3_t maxs,
 		vec3_t end, edict_t *passedict, int contentmask);
+void SV_TraceBatch(traceray_t *rays, trace_t *traces, int count);
 
 /* loadtime optimizations */
 
@@ -453,6 +453,119 @@ SV_Status_f(void)
 	Com_Printf("\n");
 }
 
+static void
+SV_Netstats_f(void)
+{
+	const client_t *cl;
+	int i, clients, chain, longest;
+
+	if (!svs.initialized)
+	{
+		Com_Printf("No server running.\n");
+		return;
+	}
+
+	clients = 0;
+	longest = 0;
+
+	for (i = 0; i < CLIENT_HASH_SIZE; i++)
+	{
+		chain = 0;
+
+		for (cl = svs.clienthash[i]; cl; cl = cl->hashnext)
+		{
+			chain++;
+		}
+
+		clients += chain;
+		longest = Q_max(longest, chain);
+	}
+
+	Com_Printf("packets: %i dispatched, %i dropped\n",
+			svs.packets_dispatched, svs.packets_dropped);
+	Com_Printf("client lookup: %i clients, longest chain %i\n",
+			clients, longest);
+	Com_Printf("received: %u packets in %u calls, %.2f per call\n",
+			net_stats.packets_received, net_stats.recv_calls,
+			net_stats.recv_calls ? (float)net_stats.packets_received / net_stats.recv_calls : 0.0f);
+	Com_Printf("sent: %u packets in %u calls, %.2f per call\n",
+			net_stats.packets_sent, net_stats.send_calls,
+			net_stats.send_calls ? (float)net_stats.packets_sent / net_stats.send_calls : 0.0f);
+	Com_Printf("sleeps: %u, %u until the deadline, woke up %.0f usec late on average, %u max, %u over 1 msec\n",
+			net_stats.sleeps, net_stats.timer_wakeups,
+			net_stats.timer_wakeups ? (double)net_stats.wakeup_late_total / net_stats.timer_wakeups : 0.0,
+			net_stats.wakeup_late_max, net_stats.late_wakeups);
+	Com_Printf("frames: %i run, started %.0f usec late on average, %i max\n",
+			svs.frames_run,
+			svs.frames_run ? (double)svs.frame_late_total / svs.frames_run : 0.0,
+			svs.frame_late_max);
+}
+
+/*
+ * Prints how large the frames sent to each client were and
+ * how much picking the best frame to delta from saved.
+ */
+static void
+SV_Bandwidth_f(void)
+{
+	const client_t *cl;
+	unsigned long long bytes, lastack;
+	unsigned int cached, encoded;
+	int i;
+
+	if (!svs.clients)
+	{
+		Com_Printf("No server running.\n");
+		return;
+	}
+
+	bytes = lastack = 0;
+	cached = encoded = 0;
+
+	Com_Printf("num name            frames  kB sent avg size older nodelta saved\n");
+	Com_Printf("--- --------------- ------ -------- -------- ----- ------- -----\n");
+
+	for (i = 0, cl = svs.clients; i < maxclients->value; i++, cl++)
+	{
+		if (!cl->state || !cl->frames_sent)
+		{
+			continue;
+		}
+
+		Com_Printf("%3i %-15.15s %6u %8llu %8llu %5u %7u %4.1f%%\n", i, cl->name,
+				cl->frames_sent, cl->frame_bytes / 1024,
+				cl->frame_bytes / cl->frames_sent, cl->frames_olderbase,
+				cl->frames_nodelta, cl->frame_bytes_lastack ?
+				100.0 - 100.0 * cl->frame_bytes / cl->frame_bytes_lastack : 0.0);
+
+		bytes += cl->frame_bytes;
+		lastack += cl->frame_bytes_lastack;
+		cached += cl->deltas_cached;
+		encoded += cl->deltas_encoded;
+	}
+
+	Com_Printf("total: %llu kB, %llu kB delta'd from the last acked frame only\n",
+			bytes / 1024, lastack / 1024);
+	Com_Printf("entity deltas: %u copied from the frame's cache, %u encoded\n",
+			cached, encoded);
+
+	Com_Printf("\nnum  rate  kB sent download suppressed trimmed deferred\n");
+	Com_Printf("--- ----- -------- -------- ---------- ------- --------\n");
+
+	for (i = 0, cl = svs.clients; i < maxclients->value; i++, cl++)
+	{
+		if (!cl->state || !cl->bytes_sent)
+		{
+			continue;
+		}
+
+		Com_Printf("%3i %5i %8llu %8llu %10u %7u %8u\n", i, cl->rate,
+				cl->bytes_sent / 1024, cl->download_bytes / 1024,
+				cl->frames_suppressed, cl->frames_trimmed,
+				cl->entities_deferred);
+	}
+}
+
 static void
 SV_ConSay_f(void)
 {
@@ -764,6 +877,8 @@ SV_InitOperatorCommands(void)
 	Cmd_AddCommand("status", SV_Status_f);
 	Cmd_AddCommand("serverinfo", SV_Serverinfo_f);
 	Cmd_AddCommand("dumpuser", SV_DumpUser_f);
+	Cmd_AddCommand("netstats", SV_Netstats_f);
+	Cmd_AddCommand("bandwidth", SV_Bandwidth_f);
 
 	Cmd_AddCommand("map", SV_Map_f);
 	Cmd_AddCommand("listmaps", SV_ListMaps_f);
@@ -785,5 +900,7 @@ SV_InitOperatorCommands(void)
 	Cmd_AddCommand("killserver", SV_KillServer_f);
 
 	Cmd_AddCommand("sv", SV_ServerCommand_f);
+
+	Cmd_AddCommand("areabench", SV_AreaBench_f);
 }
 
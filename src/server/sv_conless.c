@@ -158,6 +158,8 @@ SVC_DirectConnect(void)
 	int version;
 	int qport;
 	int challenge;
+	int netchan;
+	char reply[MAX_STRING_CHARS];
 
 	adr = net_from;
 
@@ -178,6 +180,13 @@ SVC_DirectConnect(void)
 
 	Q_strlcpy(userinfo, Cmd_Argv(4), sizeof(userinfo));
 
+	netchan = NETCHAN_VERSION_OLD;
+
+	if (!strncmp(Cmd_Argv(5), "netchan=", 8))
+	{
+		netchan = (int)strtol(Cmd_Argv(5) + 8, (char **)NULL, 10);
+	}
+
 	/* force the IP key/value pair so the game can filter based on ip */
 	Info_SetValueForKey(userinfo, "ip", NET_AdrToString(net_from));
 
@@ -270,6 +279,7 @@ gotnewcl:
 
 	/* build a new connection  accept the new client this
 	   is the only place a client_t is ever initialized */
+	SV_UnhashClient(newcl);
 	*newcl = temp;
 	sv_client = newcl;
 	ent = CL_EDICT(newcl);
@@ -301,16 +311,28 @@ gotnewcl:
 	/* send the connect packet to the client */
 	if (sv_downloadserver->string[0])
 	{
-		Netchan_OutOfBandPrint(NS_SERVER, adr, "client_connect dlserver=%s", sv_downloadserver->string);
+		Q_strlcpy(reply, va("client_connect dlserver=%s", sv_downloadserver->string),
+				sizeof(reply));
 	}
 	else
 	{
-		Netchan_OutOfBandPrint(NS_SERVER, adr, "client_connect");
+		Q_strlcpy(reply, "client_connect", sizeof(reply));
 	}
 
+	/* only clients asking for it get a newer netchan */
+	if (netchan > NETCHAN_VERSION_OLD)
+	{
+		netchan = Q_min(netchan, NETCHAN_VERSION);
+		Q_strlcat(reply, va(" netchan=%i", netchan), sizeof(reply));
+	}
+
+	Netchan_OutOfBandPrint(NS_SERVER, adr, "%s", reply);
+
 	Netchan_Setup(NS_SERVER, &newcl->netchan, adr, qport);
+	newcl->netchan.version = Q_max(netchan, NETCHAN_VERSION_OLD);
 
 	newcl->state = cs_connected;
+	SV_HashClient(newcl);
 
 	SZ_Init(&newcl->datagram, newcl->datagram_buf, sizeof(newcl->datagram_buf));
 	newcl->datagram.allowoverflow = true;
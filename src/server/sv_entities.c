@@ -30,18 +30,187 @@
 
 #include "header/server.h"
 
-// DG: is casted to int32_t* in SV_FatPVS() so align accordingly
-static YQ2_ALIGNAS_TYPE(int32_t) byte fatpvs[65536 / 8];
+#define SV_CLIENT_PARSE_ENTITIES 1024 /* MAX_PARSE_ENTITIES of the client */
+#define SV_MAX_DELTA_BYTES 64 /* longest MSG_WriteDeltaEntity() output, rounded up */
+#define SV_DELTA_CACHE_CHUNK 64 /* entities per job */
+#define SV_FRAME_OVERHEAD 160 /* frame header, playerstate and netchan header, roughly */
 
 /*
- * Writes a delta update of an entity_state_t list to the message.
+ * Most clients delta from the same frame, so the deltas of the
+ * entities they see are the same, too. SV_BuildDeltaCache() encodes
+ * them once per frame and SV_EmitPacketEntities() copies the bytes
+ * if the client's old and new states match those that were encoded.
+ * Everything but sv_deltacache_from is indexed by entity number.
  */
+typedef struct
+{
+	int length;
+	byte data[SV_MAX_DELTA_BYTES];
+} sv_cacheddelta_t;
+
+static entity_state_t sv_history[UPDATE_BACKUP][MAX_EDICTS];
+static int sv_historyframe[UPDATE_BACKUP];
+static int sv_historyedicts[UPDATE_BACKUP];
+
+static sv_cacheddelta_t sv_deltacache[MAX_EDICTS];
+static byte sv_deltawanted[MAX_EDICTS / 8];
+static int sv_deltacache_from = -1;
+
 static void
-SV_EmitPacketEntities(client_frame_t *from, client_frame_t *to, sizebuf_t *msg)
+SV_DeltaCacheJob(int index)
+{
+	const entity_state_t *from, *to;
+	sv_cacheddelta_t *cached;
+	sizebuf_t msg;
+	int e, last;
+
+	from = sv_history[sv_deltacache_from & UPDATE_MASK];
+	to = sv_history[sv.framenum & UPDATE_MASK];
+
+	e = index * SV_DELTA_CACHE_CHUNK;
+	last = Q_min(e + SV_DELTA_CACHE_CHUNK, sv_historyedicts[sv.framenum & UPDATE_MASK]);
+
+	for ( ; e < last; e++)
+	{
+		cached = &sv_deltacache[e];
+		cached->length = -1;
+
+		if (!(sv_deltawanted[e >> 3] & (1 << (e & 7))))
+		{
+			continue;
+		}
+
+		SZ_Init(&msg, cached->data, sizeof(cached->data));
+		msg.allowoverflow = msg.quietoverflow = true;
+		MSG_WriteDeltaEntity(&from[e], &to[e], &msg, false,
+				e <= maxclients->value);
+
+		if (msg.overflowed)
+		{
+			/* the client's own encoding is used instead */
+			SV_JobWarning("SV_DeltaCacheJob: delta longer than SV_MAX_DELTA_BYTES\n");
+			continue;
+		}
+
+		cached->length = msg.cursize;
+	}
+}
+
+/*
+ * Called once the frames of the clients are stored. Remembers
+ * the entities of this frame and encodes the deltas from the
+ * frame most clients acknowledged.
+ */
+void
+SV_BuildDeltaCache(client_t **clients, int count)
+{
+	int acked[UPDATE_BACKUP];
+	client_view_t *view;
+	entity_state_t *history;
+	int e, i, best;
+	int lastframe;
+
+	history = sv_history[sv.framenum & UPDATE_MASK];
+	sv_historyframe[sv.framenum & UPDATE_MASK] = sv.framenum;
+	sv_historyedicts[sv.framenum & UPDATE_MASK] = ge->num_edicts;
+
+	for (e = 0; e < ge->num_edicts; e++)
+	{
+		history[e] = EDICT_NUM(e)->s;
+	}
+
+	sv_deltacache_from = -1;
+	memset(acked, 0, sizeof(acked));
+	memset(sv_deltawanted, 0, sizeof(sv_deltawanted));
+
+	for (i = 0; i < count; i++)
+	{
+		lastframe = clients[i]->lastframe;
+
+		if ((lastframe <= 0) || (sv.framenum - lastframe >= (UPDATE_BACKUP - 3)) ||
+			(sv_historyframe[lastframe & UPDATE_MASK] != lastframe))
+		{
+			continue;
+		}
+
+		acked[lastframe & UPDATE_MASK]++;
+		view = &svs.client_views[clients[i] - svs.clients];
+
+		for (e = 0; e < view->numentities; e++)
+		{
+			sv_deltawanted[view->entities[e] >> 3] |= 1 << (view->entities[e] & 7);
+		}
+	}
+
+	best = 0;
+
+	for (i = 1; i < UPDATE_BACKUP; i++)
+	{
+		if (acked[i] > acked[best])
+		{
+			best = i;
+		}
+	}
+
+	/* nothing to share */
+	if (acked[best] < 2)
+	{
+		return;
+	}
+
+	sv_deltacache_from = sv_historyframe[best];
+
+	SV_RunJobs(SV_DeltaCacheJob, (ge->num_edicts + SV_DELTA_CACHE_CHUNK - 1) /
+			SV_DELTA_CACHE_CHUNK);
+}
+
+/*
+ * Writes the delta from oldent to newent if it's in the
+ * cache. Returns false if it has to be encoded.
+ */
+static qboolean
+SV_WriteCachedDelta(const entity_state_t *oldent, const entity_state_t *newent,
+		sizebuf_t *msg)
+{
+	const sv_cacheddelta_t *cached;
+	int e;
+
+	e = newent->number;
+
+	if ((e < 0) || (e >= sv_historyedicts[sv.framenum & UPDATE_MASK]))
+	{
+		return false;
+	}
+
+	cached = &sv_deltacache[e];
+
+	/* owned entities aren't solid to their owner, and
+	   everything could have changed since the cache
+	   was built, so compare the states */
+	if ((cached->length < 0) ||
+		memcmp(newent, &sv_history[sv.framenum & UPDATE_MASK][e], sizeof(*newent)) ||
+		memcmp(oldent, &sv_history[sv_deltacache_from & UPDATE_MASK][e], sizeof(*oldent)))
+	{
+		return false;
+	}
+
+	SZ_Write(msg, cached->data, cached->length);
+
+	return true;
+}
+
+/*
+ * Writes a delta update of an entity_state_t list to the message.
+ * Returns false if entities had to be left out to leave room.
+ */
+static qboolean
+SV_EmitPacketEntities(client_t *client, client_frame_t *from, client_frame_t *to,
+		sizebuf_t *msg)
 {
 	entity_state_t *oldent, *newent;
 	int oldindex, newindex;
 	int from_num_entities;
+	qboolean cached, complete;
 
 	MSG_WriteByte(msg, svc_packetentities);
 
@@ -54,18 +223,23 @@ SV_EmitPacketEntities(client_frame_t *from, client_frame_t *to, sizebuf_t *msg)
 		from_num_entities = from->num_entities;
 	}
 
+	cached = from && (sv_deltacache_from > 0) &&
+		(from->framenum == sv_deltacache_from);
+
 	newindex = 0;
 	oldindex = 0;
 	newent = NULL;
 	oldent = NULL;
+	complete = true;
 
 	while (newindex < to->num_entities || oldindex < from_num_entities)
 	{
 		int oldnum, newnum;
 		int bits;
 
-		if (msg->cursize > MAX_MSGLEN - 150)
+		if (msg->cursize > msg->maxsize - 150)
 		{
+			complete = false;
 			break;
 		}
 
@@ -98,8 +272,17 @@ SV_EmitPacketEntities(client_frame_t *from, client_frame_t *to, sizebuf_t *msg)
 			   being emited if the entity has not changed at all
 			   note that players are always 'newentities', this
 			   updates their oldorigin always and prevents warping */
-			MSG_WriteDeltaEntity(oldent, newent, msg,
-					false, newent->number <= maxclients->value);
+			if (cached && SV_WriteCachedDelta(oldent, newent, msg))
+			{
+				client->deltas_cached++;
+			}
+			else
+			{
+				MSG_WriteDeltaEntity(oldent, newent, msg,
+						false, newent->number <= maxclients->value);
+				client->deltas_encoded++;
+			}
+
 			oldindex++;
 			newindex++;
 			continue;
@@ -148,6 +331,8 @@ SV_EmitPacketEntities(client_frame_t *from, client_frame_t *to, sizebuf_t *msg)
 	}
 
 	MSG_WriteShort(msg, 0);
+
+	return complete;
 }
 
 static void
@@ -394,49 +579,212 @@ SV_WritePlayerstateToClient(client_frame_t *from, client_frame_t *to,
 	}
 }
 
+/*
+ * Returns true if the client still has the given frame and
+ * can delta from it. The client refuses frames if more than
+ * MAX_PARSE_ENTITIES - 128 entities were parsed from that
+ * frame on, not counting the frame being parsed, so count
+ * what was sent the same way.
+ */
+static qboolean
+SV_CanDeltaFrom(client_t *client, int framenum)
+{
+	client_frame_t *frame;
+	int entities, i;
+
+	if ((framenum <= 0) || (sv.framenum - framenum >= (UPDATE_BACKUP - 3)))
+	{
+		return false;
+	}
+
+	frame = &client->frames[framenum & UPDATE_MASK];
+
+	if (!frame->acked || (frame->framenum != framenum))
+	{
+		return false;
+	}
+
+	entities = 0;
+
+	for (i = framenum; i < sv.framenum; i++)
+	{
+		frame = &client->frames[i & UPDATE_MASK];
+
+		if (frame->framenum == i)
+		{
+			entities += frame->num_entities;
+		}
+	}
+
+	return entities < SV_CLIENT_PARSE_ENTITIES - 128;
+}
+
+/*
+ * Writes the player state and the entities, delta compressed
+ * against the frame deltaframe or the baselines if it's -1.
+ * Returns false if not all entities fit.
+ */
+static qboolean
+SV_WriteFrameDelta(client_t *client, int deltaframe, client_frame_t *frame,
+		sizebuf_t *msg)
+{
+	client_frame_t *oldframe;
+
+	oldframe = (deltaframe > 0) ?
+		&client->frames[deltaframe & UPDATE_MASK] : NULL;
+
+	/* delta encode the playerstate */
+	SV_WritePlayerstateToClient(oldframe, frame, msg);
+
+	/* delta encode the entities */
+	return SV_EmitPacketEntities(client, oldframe, frame, msg);
+}
+
+static void
+SV_WriteFrameHeader(client_frame_t *frame, int deltaframe, int suppressed,
+		sizebuf_t *msg)
+{
+	MSG_WriteByte(msg, svc_frame);
+	MSG_WriteLong(msg, sv.framenum);
+	MSG_WriteLong(msg, deltaframe); /* what we are delta'ing from */
+	MSG_WriteByte(msg, suppressed); /* rate dropped packets */
+
+	/* send over the areabits */
+	MSG_WriteByte(msg, frame->areabytes);
+	SZ_Write(msg, frame->areabits, frame->areabytes);
+}
+
 void
 SV_WriteFrameToClient(client_t *client, sizebuf_t *msg)
 {
-	client_frame_t *frame, *oldframe;
-	int lastframe;
+	client_view_t *view = &svs.client_views[client - svs.clients];
+	client_frame_t *frame;
+	sizebuf_t trial;
+	unsigned int cached, encoded;
+	int deltaframe, extraframe;
+	int begin, start, size, suppressed, i;
+	qboolean complete;
 
 	/* this is the frame we are creating */
 	frame = &client->frames[sv.framenum & UPDATE_MASK];
+	frame->framenum = sv.framenum;
+	frame->acked = false;
+
+	/* The last frame the client acknowledged is what Quake II
+	   always delta'd from. If that can't be used, or while the
+	   client loses packets, an older acknowledged frame may
+	   do better, and the baselines if there's none. Then
+	   one of them is tried, too, that costs a second
+	   encoding. The client only knows about one frame to
+	   delta from, never about single entities. */
+	deltaframe = -1;
+	extraframe = 0;
 
 	if (client->lastframe <= 0)
 	{
 		/* client is asking for a retransmit */
-		oldframe = NULL;
-		lastframe = -1;
-	}
-	else if (sv.framenum - client->lastframe >= (UPDATE_BACKUP - 3))
-	{
-		/* client hasn't gotten a good message through in a long time */
-		oldframe = NULL;
-		lastframe = -1;
 	}
 	else
 	{
-		/* we have a valid message to delta from */
-		oldframe = &client->frames[client->lastframe & UPDATE_MASK];
-		lastframe = client->lastframe;
+		if (SV_CanDeltaFrom(client, client->lastframe))
+		{
+			/* we have a valid message to delta from */
+			deltaframe = client->lastframe;
+
+			if (client->lossframe &&
+				(sv.framenum - client->lossframe < UPDATE_BACKUP - 3))
+			{
+				extraframe = -1;
+			}
+		}
+
+		/* otherwise the client hasn't gotten a good message
+		   through in a long time, or would refuse the frame */
+		if ((deltaframe == -1) || extraframe)
+		{
+			for (i = client->lastframe - 1; i > sv.framenum - (UPDATE_BACKUP - 3); i--)
+			{
+				if (SV_CanDeltaFrom(client, i))
+				{
+					extraframe = i;
+					break;
+				}
+			}
+		}
 	}
 
-	MSG_WriteByte(msg, svc_frame);
-	MSG_WriteLong(msg, sv.framenum);
-	MSG_WriteLong(msg, lastframe); /* what we are delta'ing from */
-	MSG_WriteByte(msg, client->surpressCount); /* rate dropped packets */
+	suppressed = client->surpressCount;
 	client->surpressCount = 0;
 
-	/* send over the areabits */
-	MSG_WriteByte(msg, frame->areabytes);
-	SZ_Write(msg, frame->areabits, frame->areabytes);
+	begin = msg->cursize;
+	SV_WriteFrameHeader(frame, deltaframe, suppressed, msg);
+	start = msg->cursize;
 
-	/* delta encode the playerstate */
-	SV_WritePlayerstateToClient(oldframe, frame, msg);
+	cached = client->deltas_cached;
+	encoded = client->deltas_encoded;
 
-	/* delta encode the entities */
-	SV_EmitPacketEntities(oldframe, frame, msg);
+	complete = SV_WriteFrameDelta(client, deltaframe, frame, msg);
+	size = msg->overflowed ? 0 : msg->cursize - start;
+
+	/* what the frame would have been */
+	client->frame_bytes_lastack += size;
+
+	if (extraframe)
+	{
+		/* the other base has to be smaller, so it's cut
+		   off as soon as it isn't, see the 150 bytes in
+		   SV_EmitPacketEntities() */
+		SZ_Init(&trial, view->trial_buf, msg->maxsize - start);
+		trial.allowoverflow = trial.quietoverflow = true; /* runs on a worker */
+
+		if (size && complete)
+		{
+			trial.maxsize = Q_min(trial.maxsize, size - 1 + 150);
+		}
+
+		/* only the deltas that are sent are counted */
+		i = client->deltas_cached;
+		client->deltas_cached = cached;
+		cached = i;
+		i = client->deltas_encoded;
+		client->deltas_encoded = encoded;
+		encoded = i;
+
+		if (SV_WriteFrameDelta(client, extraframe, frame, &trial) &&
+			!trial.overflowed && (!size || !complete || (trial.cursize < size)))
+		{
+			msg->cursize = begin;
+			msg->overflowed = false;
+
+			SV_WriteFrameHeader(frame, extraframe, suppressed, msg);
+			SZ_Write(msg, trial.data, trial.cursize);
+
+			deltaframe = extraframe;
+		}
+		else
+		{
+			client->deltas_cached = cached;
+			client->deltas_encoded = encoded;
+		}
+	}
+
+	if (msg->overflowed)
+	{
+		/* nothing fits, SV_SendClientDatagram() drops it */
+		return;
+	}
+
+	client->frames_sent++;
+	client->frame_bytes += msg->cursize - start;
+
+	if (deltaframe == -1)
+	{
+		client->frames_nodelta++;
+	}
+	else if (deltaframe != client->lastframe)
+	{
+		client->frames_olderbase++;
+	}
 }
 
 /*
@@ -444,13 +792,13 @@ SV_WriteFrameToClient(client_t *client, sizebuf_t *msg)
  * so we can't use a single PVS point
  */
 static void
-SV_FatPVS(vec3_t org)
+SV_FatPVS(vec3_t org, int32_t *fatpvs)
 {
 	int leafs[64];
 	int i, j, count;
 	// DG: used to be called "longs" and long was used which isn't really correct on 64bit
 	int32_t numInt32s;
-	byte *src;
+	const byte *src;
 	vec3_t mins, maxs;
 
 	for (i = 0; i < 3; i++)
@@ -496,35 +844,32 @@ SV_FatPVS(vec3_t org)
 
 		for (j = 0; j < numInt32s; j++)
 		{
-			((int32_t *)fatpvs)[j] |= ((int32_t *)src)[j];
+			fatpvs[j] |= ((const int32_t *)src)[j];
 		}
 	}
 }
 
 /*
- * Decides which entities are going to be visible to the client, and
- * copies off the playerstat and areabits.
+ * Copies off the playerstate and areabits and gathers the
+ * visibility data of the client into its view. Everything
+ * that touches the collision model's caches happens here,
+ * so this must run on the main thread.
  */
-void
-SV_BuildClientFrame(client_t *client)
+qboolean
+SV_SetupClientFrame(client_t *client, client_view_t *view)
 {
-	int e, i;
-	vec3_t org;
-	edict_t *ent;
+	int i;
 	edict_t *clent;
 	client_frame_t *frame;
-	entity_state_t *state;
-	int l;
-	int clientarea, clientcluster;
-	int leafnum;
-	byte *clientphs;
-	byte *bitvector;
+	int leafnum, clientcluster;
 
 	clent = CL_EDICT(client);
+	view->valid = false;
+	view->numentities = 0;
 
 	if (!clent->client)
 	{
-		return; /* not in game yet */
+		return false; /* not in game yet */
 	}
 
 	/* this is the frame we are creating */
@@ -535,26 +880,348 @@ SV_BuildClientFrame(client_t *client)
 	/* find the client's PVS */
 	for (i = 0; i < 3; i++)
 	{
-		org[i] = clent->client->ps.pmove.origin[i] * 0.125 +
+		view->org[i] = clent->client->ps.pmove.origin[i] * 0.125 +
 				 clent->client->ps.viewoffset[i];
 	}
 
-	leafnum = CM_PointLeafnum(org);
-	clientarea = CM_LeafArea(leafnum);
+	leafnum = CM_PointLeafnum(view->org);
+	view->clientarea = CM_LeafArea(leafnum);
 	clientcluster = CM_LeafCluster(leafnum);
 
 	/* calculate the visible areas */
-	frame->areabytes = CM_WriteAreaBits(frame->areabits, clientarea);
+	frame->areabytes = CM_WriteAreaBits(frame->areabits, view->clientarea);
 
 	/* grab the current player_state_t */
 	frame->ps = clent->client->ps;
 
-	SV_FatPVS(org);
-	clientphs = CM_ClusterPHS(clientcluster);
+	SV_FatPVS(view->org, view->fatpvs);
+	memcpy(view->phs, CM_ClusterPHS(clientcluster),
+			((CM_NumClusters() + 31) >> 5) << 2);
+
+	view->valid = true;
+
+	return true;
+}
+
+typedef struct
+{
+	int index;
+	int priority;
+	int cost;
+} sv_entitycost_t;
+
+static int
+SV_ComparePriority(const void *a, const void *b)
+{
+	const sv_entitycost_t *ea = a;
+	const sv_entitycost_t *eb = b;
+
+	if (ea->priority != eb->priority)
+	{
+		return ea->priority - eb->priority;
+	}
+
+	return ea->index - eb->index;
+}
+
+/*
+ * Entities that are close, in front of the client, players
+ * or were held back before come first.
+ */
+static int
+SV_EntityPriority(client_t *client, client_view_t *view, edict_t *ent)
+{
+	vec3_t forward, delta;
+	float dist;
+	int priority;
+
+	if (ent->solid == SOLID_BSP)
+	{
+		VectorAdd(ent->absmin, ent->absmax, delta);
+		VectorScale(delta, 0.5f, delta);
+		VectorSubtract(delta, view->org, delta);
+	}
+	else
+	{
+		VectorSubtract(ent->s.origin, view->org, delta);
+	}
+
+	dist = VectorLength(delta);
+	priority = (int)((view->entityage[ent->s.number] + 1) * 256 / (1 + dist / 64));
+
+	AngleVectors(CL_EDICT(client)->client->ps.viewangles, forward, NULL, NULL);
+
+	if (DotProduct(forward, delta) < 0)
+	{
+		priority /= 2;
+	}
+
+	if (ent->client)
+	{
+		priority *= 4;
+	}
+
+	return priority;
+}
+
+/*
+ * Entities sent as they are now start over at the lowest
+ * priority, those left out are dropped from the list.
+ */
+static void
+SV_FinishEntityList(client_view_t *view)
+{
+	int i, j, e;
+
+	for (i = 0, j = 0; i < view->numentities; i++)
+	{
+		e = view->entities[i];
+
+		if (e < 0)
+		{
+			continue;
+		}
+
+		if (!view->oldstates[i])
+		{
+			view->entityage[e] = 0;
+		}
+
+		view->entities[j] = e;
+		view->oldstates[j] = view->oldstates[i];
+		j++;
+	}
+
+	view->numentities = j;
+}
+
+/*
+ * Returns the state of entity e in frame, or NULL. The
+ * entities of a frame are sorted by number, so index
+ * walks through them while e only grows.
+ */
+static const entity_state_t *
+SV_FrameEntityState(const client_frame_t *frame, int *index, int e)
+{
+	const entity_state_t *state;
+
+	if (!frame)
+	{
+		return NULL;
+	}
+
+	while (*index < frame->num_entities)
+	{
+		state = &svs.client_entities[(frame->first_entity + *index) %
+				svs.num_client_entities];
+
+		if (state->number == e)
+		{
+			return state;
+		}
+
+		if (state->number > e)
+		{
+			break;
+		}
+
+		(*index)++;
+	}
+
+	return NULL;
+}
+
+/*
+ * Returns how many bytes the delta from oldstate, or
+ * from the baseline if there's none, to state takes.
+ */
+static int
+SV_DeltaCost(const entity_state_t *oldstate, const entity_state_t *state)
+{
+	sizebuf_t buf;
+	byte buf_data[SV_MAX_DELTA_BYTES];
+	int e = state->number;
+
+	SZ_Init(&buf, buf_data, sizeof(buf_data));
+
+	if (oldstate)
+	{
+		MSG_WriteDeltaEntity(oldstate, state, &buf, false,
+				e <= maxclients->value);
+	}
+	else
+	{
+		MSG_WriteDeltaEntity((e < sv.numbaselines) ? &sv.baselines[e] : NULL,
+				state, &buf, true, true);
+	}
+
+	return buf.cursize;
+}
+
+/*
+ * If the frame wouldn't fit into the client's budget, holds
+ * back the updates of the least important entities. They
+ * stay in the frame with the state of the frame sent last,
+ * so the client doesn't see them go back to an older state,
+ * and the frame only carries the difference to that. Those
+ * in neither that nor the acknowledged frame are left out. Either way the
+ * server's copy of the frame is what the client ends up
+ * with, so later deltas stay correct. Held back entities
+ * gain priority each frame until they're sent.
+ */
+static void
+SV_PrioritizeEntities(client_t *client, client_view_t *view)
+{
+	sv_entitycost_t costs[MAX_EDICTS];
+	const entity_state_t *oldstates[MAX_EDICTS];
+	const entity_state_t *sentstate;
+	client_frame_t *oldframe, *sentframe;
+	byte held[MAX_EDICTS];
+	edict_t *clent, *ent;
+	int i, j, e, oldindex, sentindex;
+	int total, count, cost;
+
+	view->numdeferred = 0;
+
+	for (i = 0; i < view->numentities; i++)
+	{
+		view->oldstates[i] = NULL;
+	}
+
+	/* a cheap upper bound first, without a frame
+	   to delta from nothing can be held back */
+	total = SV_FRAME_OVERHEAD + client->datagram.cursize;
+
+	if ((total + view->numentities * 43 <= view->budget) ||
+		!SV_CanDeltaFrom(client, client->lastframe))
+	{
+		SV_FinishEntityList(view);
+		return;
+	}
+
+	oldframe = &client->frames[client->lastframe & UPDATE_MASK];
+
+	/* the newest frame sent, may be the acknowledged one */
+	sentframe = NULL;
+
+	for (i = sv.framenum - 1; i >= client->lastframe; i--)
+	{
+		if (client->frames[i & UPDATE_MASK].framenum == i)
+		{
+			sentframe = &client->frames[i & UPDATE_MASK];
+			break;
+		}
+	}
+
+	clent = CL_EDICT(client);
+	oldindex = 0;
+	sentindex = 0;
+	count = 0;
+
+	for (i = 0; i < view->numentities; i++)
+	{
+		e = view->entities[i];
+		ent = EDICT_NUM(e);
+
+		oldstates[i] = SV_FrameEntityState(oldframe, &oldindex, e);
+		cost = SV_DeltaCost(oldstates[i], &ent->s);
+
+		/* what it would be held back with, cleared
+		   again below if it isn't */
+		sentstate = SV_FrameEntityState(sentframe, &sentindex, e);
+		view->oldstates[i] = sentstate ? sentstate : oldstates[i];
+		held[i] = false;
+		total += cost;
+
+		/* the client's own entity and events can't wait,
+		   unchanged entities cost nothing */
+		if ((ent == clent) || ent->s.event || !cost)
+		{
+			continue;
+		}
+
+		costs[count].index = i;
+		costs[count].priority = SV_EntityPriority(client, view, ent);
+		costs[count].cost = cost;
+		count++;
+	}
+
+	if (total > view->budget)
+	{
+		qsort(costs, count, sizeof(costs[0]), SV_ComparePriority);
+
+		for (j = 0; (j < count) && (total > view->budget); j++)
+		{
+			i = costs[j].index;
+			e = view->entities[i];
+
+			if (view->oldstates[i])
+			{
+				cost = SV_DeltaCost(oldstates[i], view->oldstates[i]);
+
+				if (cost >= costs[j].cost)
+				{
+					continue; /* holding it back saves nothing */
+				}
+
+				held[i] = true;
+			}
+			else
+			{
+				cost = 0;
+				view->entities[i] = -1;
+			}
+
+			total -= costs[j].cost - cost;
+			view->entityage[e] = Q_min(view->entityage[e] + 1, 255);
+			view->numdeferred++;
+		}
+
+		client->entities_deferred += view->numdeferred;
+
+		if (view->numdeferred)
+		{
+			client->frames_trimmed++;
+		}
+	}
+
+	for (i = 0; i < view->numentities; i++)
+	{
+		if ((view->entities[i] >= 0) && !held[i])
+		{
+			view->oldstates[i] = NULL;
+		}
+	}
+
+	SV_FinishEntityList(view);
+}
+
+/*
+ * Decides which entities are going to be visible to the
+ * client. Only reads the edicts and the view, so several
+ * clients can be culled at the same time.
+ */
+void
+SV_CullClientEntities(client_t *client, client_view_t *view)
+{
+	int e, i;
+	edict_t *ent;
+	edict_t *clent;
+	int l;
+	const byte *clientphs;
+	const byte *bitvector;
+
+	if (!view->valid)
+	{
+		return;
+	}
+
+	clent = CL_EDICT(client);
+	clientphs = (const byte *)view->phs;
+	bitvector = (const byte *)view->fatpvs;
 
 	/* build up the list of visible entities */
-	frame->num_entities = 0;
-	frame->first_entity = svs.next_client_entities;
+	view->numentities = 0;
 
 	for (e = 1; e < ge->num_edicts; e++)
 	{
@@ -577,12 +1244,12 @@ SV_BuildClientFrame(client_t *client)
 		if (ent != clent)
 		{
 			/* check area */
-			if (!CM_AreasConnected(clientarea, ent->areanum))
+			if (!CM_AreasConnected(view->clientarea, ent->areanum))
 			{
 				/* doors can legally straddle two areas,
 				   so we may need to check another one */
 				if (!ent->areanum2 ||
-					!CM_AreasConnected(clientarea, ent->areanum2))
+					!CM_AreasConnected(view->clientarea, ent->areanum2))
 				{
 					continue; /* blocked by a door */
 				}
@@ -600,12 +1267,11 @@ SV_BuildClientFrame(client_t *client)
 			}
 			else
 			{
-				bitvector = fatpvs;
-
 				if (ent->num_clusters == -1)
 				{
-					/* too many leafs for individual check, go by headnode */
-					if (!CM_HeadnodeVisible(ent->headnode, bitvector))
+					/* too many leafs for individual check, go by
+					   the clusters below the headnode */
+					if (!SV_EdictClustersVisible(ent, view->fatpvs))
 					{
 						continue;
 					}
@@ -636,7 +1302,7 @@ SV_BuildClientFrame(client_t *client)
 					vec3_t delta;
 					float len;
 
-					VectorSubtract(org, ent->s.origin, delta);
+					VectorSubtract(view->org, ent->s.origin, delta);
 					len = VectorLength(delta);
 
 					if (len > 400)
@@ -647,6 +1313,42 @@ SV_BuildClientFrame(client_t *client)
 			}
 		}
 
+		view->entities[view->numentities++] = e;
+	}
+
+	SV_PrioritizeEntities(client, view);
+}
+
+/*
+ * Copies the entities picked by SV_CullClientEntities() into
+ * the circular client_entities array. Main thread only, the
+ * clients must be stored in the same order every frame.
+ */
+void
+SV_StoreClientFrame(client_t *client, client_view_t *view)
+{
+	int i, e;
+	edict_t *ent;
+	edict_t *clent;
+	client_frame_t *frame;
+	entity_state_t *state;
+
+	if (!view->valid)
+	{
+		return;
+	}
+
+	clent = CL_EDICT(client);
+	frame = &client->frames[sv.framenum & UPDATE_MASK];
+
+	frame->num_entities = 0;
+	frame->first_entity = svs.next_client_entities;
+
+	for (i = 0; i < view->numentities; i++)
+	{
+		e = view->entities[i];
+		ent = EDICT_NUM(e);
+
 		/* add it to the circular client_entities array */
 		state = &svs.client_entities[svs.next_client_entities %
 				svs.num_client_entities];
@@ -657,7 +1359,17 @@ SV_BuildClientFrame(client_t *client)
 			ent->s.number = e;
 		}
 
-		*state = ent->s;
+		/* held back entities keep the state the client
+		   was sent last, without replaying its event */
+		if (view->oldstates[i])
+		{
+			*state = *view->oldstates[i];
+			state->event = 0;
+		}
+		else
+		{
+			*state = ent->s;
+		}
 
 		/* don't mark players missiles as solid */
 		if (ent->owner == clent)
@@ -261,6 +261,9 @@ SV_SpawnServer(char *server, char *spawnpoint, server_state_t serverstate,
 		FS_FCloseFile(sv.demofile);
 	}
 
+	/* the game may have written files since the last map */
+	FS_FlushDirCache();
+
 	svs.spawncount++; /* any partially connected client will be restarted */
 	sv.state = ss_dead;
 	Com_SetServerState(sv.state);
@@ -269,6 +272,7 @@ SV_SpawnServer(char *server, char *spawnpoint, server_state_t serverstate,
 	SV_ClearBaselines();
 	memset(&sv, 0, sizeof(sv));
 	svs.realtime = 0;
+	svs.realtime_usec = 0;
 	sv.loadgame = loadgame;
 	sv.attractloop = attractloop;
 
@@ -300,6 +304,10 @@ SV_SpawnServer(char *server, char *spawnpoint, server_state_t serverstate,
 		}
 
 		svs.clients[i].lastframe = -1;
+		svs.clients[i].lossframe = 0;
+
+		/* the frames of the last map are gone */
+		memset(svs.clients[i].frames, 0, sizeof(svs.clients[i].frames));
 	}
 
 	sv.time = 1000;
@@ -496,6 +504,7 @@ SV_InitGame(void)
 	svs.clients = Z_Malloc(sizeof(client_t) * maxclients->value);
 	svs.num_client_entities = maxclients->value * UPDATE_BACKUP * 64;
 	svs.client_entities = Z_Malloc( sizeof(entity_state_t) * svs.num_client_entities);
+	svs.client_views = Z_Malloc(sizeof(client_view_t) * maxclients->value);
 
 	/* init network stuff */
 	if (dedicated->value)
@@ -652,5 +661,8 @@ SV_Map(qboolean attractloop, char *levelstring, qboolean loadgame, qboolean isau
 	}
 
 	SV_BroadcastCommand("reconnect\n");
+
+	/* start the other instances with this map */
+	SV_ForkInstances();
 }
 
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 1997-2001 Id Software, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ * =======================================================================
+ *
+ * Several server instances in one dedicated server. The engine and
+ * the game keep their state in globals, so the instances can't be
+ * threads. Instead the server forks once the first map is loaded.
+ * The copies start out sharing everything loaded so far with the
+ * original process, the filesystem index, the collision model and
+ * the game library, and each of them listens on its own port.
+ *
+ * =======================================================================
+ */
+
+#include "header/server.h"
+
+static cvar_t *sv_instances;
+static cvar_t *sv_instance;
+static qboolean sv_forked;
+
+/*
+ * Turns a freshly forked copy into the given
+ * instance, listening on port + instance.
+ */
+static void
+SV_BecomeInstance(int instance)
+{
+	unsigned int entropy;
+	cvar_t *port;
+
+	port = Cvar_Get("port", va("%i", PORT_SERVER), CVAR_NOSET);
+
+	Cvar_FullSet("sv_instance", va("%i", instance), CVAR_NOSET);
+	Cvar_FullSet("port", va("%i", (int)port->value + instance), CVAR_NOSET);
+
+	/* the sockets are the original's, so are the random
+	   numbers of the engine and the game. Sys_ForkInstance()
+	   seeded rand() with the pid. */
+	NET_Config(false);
+	NET_Config(true);
+
+	entropy = (unsigned int)rand() ^ (unsigned int)time(NULL) ^
+		(unsigned int)Sys_Microseconds() ^ (instance * 0x9e3779b9U);
+	randk_reseed(entropy);
+
+	if (ge && (ge->apiversion == GAME_API_VERSION))
+	{
+		ge->SeedRandom(~entropy);
+	}
+
+	Com_Printf("Server instance %i listening on port %i.\n",
+			instance, (int)port->value);
+}
+
+/*
+ * Called once a map is loaded. The first time forks
+ * sv_instances - 1 copies of the dedicated server.
+ */
+void
+SV_ForkInstances(void)
+{
+	int count, i;
+
+	if (sv_forked || !dedicated->value || (sv.state != ss_game))
+	{
+		return;
+	}
+
+	sv_forked = true;
+	count = Q_min((int)sv_instances->value, MAX_INSTANCES);
+
+	if (count <= 1)
+	{
+		return;
+	}
+
+	/* threads don't survive fork(), and what's
+	   queued would be sent by every instance */
+	SV_ShutdownWorkers();
+	NET_FlushPackets();
+
+	for (i = 1; i < count; i++)
+	{
+		switch (Sys_ForkInstance(i))
+		{
+			case 1:
+				SV_BecomeInstance(i);
+				return;
+
+			case -1:
+				Com_Printf("%s: couldn't start instance %i\n", __func__, i);
+				return;
+		}
+	}
+}
+
+static void
+SV_Instances_f(void)
+{
+	sysinstance_t stats;
+	int count, i;
+	int rss, pss;
+
+	if ((int)sv_instance->value)
+	{
+		Com_Printf("Only instance 0 knows the other instances.\n");
+		return;
+	}
+
+	count = Q_max(1, Q_min((int)sv_instances->value, MAX_INSTANCES));
+	rss = pss = 0;
+
+	Com_Printf("inst    pid   rss kB   pss kB shared kB  cpu msec\n");
+	Com_Printf("---- ------ -------- -------- --------- ---------\n");
+
+	for (i = 0; i < count; i++)
+	{
+		if (!Sys_GetInstanceStats(i, &stats))
+		{
+			Com_Printf("%4i not running\n", i);
+			continue;
+		}
+
+		Com_Printf("%4i %6i %8i %8i %9i %9i\n", i, stats.pid, stats.rss,
+				stats.pss, stats.shared, stats.cputime);
+
+		rss += stats.rss;
+		pss += stats.pss;
+	}
+
+	/* pss adds up to what the instances really use,
+	   rss to what they'd use as separate servers */
+	Com_Printf("total: %i kB PSS (shared pages split), %i kB RSS\n", pss, rss);
+}
+
+void
+SV_InitInstances(void)
+{
+	sv_instances = Cvar_Get("sv_instances", "1", CVAR_NOSET);
+	sv_instance = Cvar_Get("sv_instance", "0", CVAR_NOSET);
+
+	Cmd_AddCommand("instances", SV_Instances_f);
+}
@@ -53,6 +53,7 @@ cvar_t *sv_showclamp;
 cvar_t *hostname;
 cvar_t *public_server; /* should heartbeats be sent */
 cvar_t *sv_entfile; /* External entity files. */
+cvar_t *sv_downloadrate; /* Bytes per second of windowed downloads. */
 cvar_t *sv_downloadserver; /* Download server. */
 
 void SV_ConnectionlessPacket(void);
@@ -191,73 +192,172 @@ SV_GiveMsec(void)
 	}
 }
 
+/*
+ * Hashes the parts of an address NET_CompareBaseAdr()
+ * looks at, together with the qport.
+ */
+static unsigned
+SV_ClientHashKey(const netadr_t *adr, int qport)
+{
+	const byte *data;
+	unsigned hash;
+	int i, len;
+
+	switch (adr->type)
+	{
+		case NA_IP:
+			data = adr->ip;
+			len = 4;
+			break;
+		case NA_IP6:
+			data = adr->ip;
+			len = 16;
+			break;
+		case NA_IPX:
+			data = adr->ipx;
+			len = 10;
+			break;
+		default:
+			data = NULL;
+			len = 0;
+			break;
+	}
+
+	hash = 2166136261u ^ (unsigned)adr->type;
+
+	for (i = 0; i < len; i++)
+	{
+		hash = (hash ^ data[i]) * 16777619u;
+	}
+
+	hash = (hash ^ (qport & 0xff)) * 16777619u;
+	hash = (hash ^ ((qport >> 8) & 0xff)) * 16777619u;
+
+	return hash & (CLIENT_HASH_SIZE - 1);
+}
+
+/*
+ * Adds a client to the lookup used for incoming packets.
+ * Must be called whenever a client leaves cs_free.
+ */
+void
+SV_HashClient(client_t *cl)
+{
+	client_t **chain;
+
+	chain = &svs.clienthash[SV_ClientHashKey(&cl->netchan.remote_address,
+			cl->netchan.qport)];
+	cl->hashnext = *chain;
+	*chain = cl;
+}
+
+/*
+ * Removes a client from the lookup, if it's in there.
+ * Must be called before a client becomes cs_free or
+ * its address or qport change.
+ */
+void
+SV_UnhashClient(client_t *cl)
+{
+	client_t **link;
+
+	link = &svs.clienthash[SV_ClientHashKey(&cl->netchan.remote_address,
+			cl->netchan.qport)];
+
+	for ( ; *link; link = &(*link)->hashnext)
+	{
+		if (*link == cl)
+		{
+			*link = cl->hashnext;
+			cl->hashnext = NULL;
+			return;
+		}
+	}
+}
+
+/*
+ * Finds the client a packet from adr with the given qport
+ * belongs to. If a zombie and a new connection share the
+ * address, the one in the lower slot wins, like it did
+ * when all slots were scanned.
+ */
+static client_t *
+SV_FindClient(const netadr_t *adr, int qport)
+{
+	client_t *cl, *best;
+
+	best = NULL;
+
+	for (cl = svs.clienthash[SV_ClientHashKey(adr, qport)]; cl; cl = cl->hashnext)
+	{
+		if ((cl->netchan.qport != qport) ||
+			!NET_CompareBaseAdr(*adr, cl->netchan.remote_address))
+		{
+			continue;
+		}
+
+		if (!best || (cl < best))
+		{
+			best = cl;
+		}
+	}
+
+	return best;
+}
+
 static void
 SV_ReadPackets(void)
 {
-	int i;
 	client_t *cl;
 	int qport;
 
 	while (NET_GetPacket(NS_SERVER, &net_from, &net_message))
 	{
 		/* check for connectionless packet (0xffffffff) first */
-		if (*(int *)net_message.data == -1)
+		if ((net_message.cursize >= 4) && (*(int *)net_message.data == -1))
 		{
 			SV_ConnectionlessPacket();
 			continue;
 		}
 
+		/* two sequence numbers and the qport */
+		if (net_message.cursize < 10)
+		{
+			svs.packets_dropped++;
+			continue;
+		}
+
 		/* read the qport out of the message so we can fix up
 		   stupid address translating routers */
-		MSG_BeginReading(&net_message);
-		MSG_ReadLong(&net_message); /* sequence number */
-		MSG_ReadLong(&net_message); /* sequence number */
-		qport = MSG_ReadShort(&net_message) & 0xffff;
+		qport = net_message.data[8] | (net_message.data[9] << 8);
 
 		/* check for packets from connected clients */
-		for (i = 0, cl = svs.clients; i < maxclients->value; i++, cl++)
+		if ((cl = SV_FindClient(&net_from, qport)) == NULL)
 		{
-			if (cl->state == cs_free)
-			{
-				continue;
-			}
+			svs.packets_dropped++;
+			continue;
+		}
 
-			if (!NET_CompareBaseAdr(net_from, cl->netchan.remote_address))
-			{
-				continue;
-			}
+		svs.packets_dispatched++;
 
-			if (cl->netchan.qport != qport)
-			{
-				continue;
-			}
+		if (cl->netchan.remote_address.port != net_from.port)
+		{
+			Com_Printf("%s: fixing up a translated port\n", __func__);
+			cl->netchan.remote_address.port = net_from.port;
+		}
 
-			if (cl->netchan.remote_address.port != net_from.port)
+		if (Netchan_Process(&cl->netchan, &net_message))
+		{
+			/* this is a valid, sequenced packet, so process it */
+			if (cl->state != cs_zombie)
 			{
-				Com_Printf("%s: fixing up a translated port\n", __func__);
-				cl->netchan.remote_address.port = net_from.port;
-			}
+				cl->lastmessage = svs.realtime; /* don't timeout */
 
-			if (Netchan_Process(&cl->netchan, &net_message))
-			{
-				/* this is a valid, sequenced packet, so process it */
-				if (cl->state != cs_zombie)
+				if (!(sv.demofile && (sv.state == ss_demo)))
 				{
-					cl->lastmessage = svs.realtime; /* don't timeout */
-
-					if (!(sv.demofile && (sv.state == ss_demo)))
-					{
-						SV_ExecuteClientMessage(cl);
-					}
+					SV_ExecuteClientMessage(cl);
 				}
 			}
-
-			break;
-		}
-
-		if (i != maxclients->value)
-		{
-			continue;
 		}
 	}
 }
@@ -293,6 +393,7 @@ SV_CheckTimeouts(void)
 		if ((cl->state == cs_zombie) &&
 			(cl->lastmessage < zombiepoint))
 		{
+			SV_UnhashClient(cl);
 			cl->state = cs_free; /* can now be reused */
 			continue;
 		}
@@ -302,6 +403,7 @@ SV_CheckTimeouts(void)
 		{
 			SV_BroadcastPrintf(PRINT_HIGH, "%s timed out\n", cl->name);
 			SV_DropClient(cl);
+			SV_UnhashClient(cl);
 			cl->state = cs_free; /* don't bother with zombie state */
 		}
 	}
@@ -357,6 +459,7 @@ SV_RunGameFrame(void)
 			}
 
 			svs.realtime = sv.time;
+			svs.realtime_usec = 0;
 		}
 	}
 
@@ -384,10 +487,15 @@ SV_Optimizations(void)
 	return cv ? cv->value : 0;
 }
 
-void
+/*
+ * Returns true if it waited in NET_Sleep() for
+ * the next frame or a packet, false otherwise.
+ */
+qboolean
 SV_Frame(int usec)
 {
 	int opt_sendrate;
+	int late;
 
 #ifndef DEDICATED_ONLY
 	time_before_game = time_after_game = 0;
@@ -396,10 +504,14 @@ SV_Frame(int usec)
 	/* if server is not active, do nothing */
 	if (!svs.initialized)
 	{
-		return;
+		return false;
 	}
 
-	svs.realtime += usec / 1000;
+	/* carry the fraction over, or realtime falls
+	   behind a little with every wakeup */
+	svs.realtime_usec += usec;
+	svs.realtime += svs.realtime_usec / 1000;
+	svs.realtime_usec %= 1000;
 
 	/* keep the random time dependent */
 	randk();
@@ -432,10 +544,20 @@ SV_Frame(int usec)
 			}
 
 			svs.realtime = sv.time - 100;
+			svs.realtime_usec = 0;
 		}
 
-		NET_Sleep(sv.time - svs.realtime);
-		return;
+		NET_FlushPackets();
+		return NET_Sleep((sv.time - svs.realtime) * 1000 - svs.realtime_usec);
+	}
+
+	if (!sv_timedemo->value)
+	{
+		late = (svs.realtime - sv.time) * 1000 + svs.realtime_usec;
+
+		svs.frames_run++;
+		svs.frame_late_total += late;
+		svs.frame_late_max = Q_max(svs.frame_late_max, late);
 	}
 
 	/* update ping based on the last known frame from all clients */
@@ -464,6 +586,11 @@ SV_Frame(int usec)
 
 	/* clear teleport flags, etc for next frame */
 	SV_PrepWorldFrame();
+
+	/* hand everything sent this frame to the system at once */
+	NET_FlushPackets();
+
+	return false;
 }
 
 /*
@@ -602,6 +729,8 @@ void
 SV_Init(void)
 {
 	SV_InitOperatorCommands();
+	SV_InitWorkers();
+	SV_InitInstances();
 
 	sv_optimize_sp_loadtime = Cvar_Get("sv_optimize_sp_loadtime", "15", 0);
 	sv_optimize_mp_loadtime = Cvar_Get("sv_optimize_mp_loadtime", "0", 0);
@@ -629,6 +758,7 @@ SV_Init(void)
 	allow_download_models = Cvar_Get("allow_download_models", "1", CVAR_ARCHIVE);
 	allow_download_sounds = Cvar_Get("allow_download_sounds", "1", CVAR_ARCHIVE);
 	allow_download_maps = Cvar_Get("allow_download_maps", "1", CVAR_ARCHIVE);
+	sv_downloadrate = Cvar_Get("sv_downloadrate", "100000", CVAR_ARCHIVE);
 	sv_downloadserver = Cvar_Get ("sv_downloadserver", "", 0);
 
 	sv_noreload = Cvar_Get("sv_noreload", "0", 0);
@@ -724,7 +854,10 @@ SV_Shutdown(char *finalmsg, qboolean reconnect)
 	}
 
 	Master_Shutdown();
+	NET_FlushPackets();
+	SV_ShutdownWorkers();
 	SV_ShutdownGameProgs();
+	SV_ShutdownWorld();
 
 	/* free current level */
 	if (sv.demofile)
@@ -748,6 +881,11 @@ SV_Shutdown(char *finalmsg, qboolean reconnect)
 		Z_Free(svs.client_entities);
 	}
 
+	if (svs.client_views)
+	{
+		Z_Free(svs.client_views);
+	}
+
 	if (svs.demofile)
 	{
 		fclose(svs.demofile);
@@ -196,7 +196,7 @@ SV_Multicast(vec3_t origin, multicast_t to)
 	int leafnum, cluster, area1 = 0, j;
 	qboolean reliable;
 	client_t *client;
-	byte *mask;
+	const byte *mask;
 
 	reliable = false;
 
@@ -445,20 +445,46 @@ SV_StartSound(vec3_t origin, edict_t *entity, int channel, int soundindex,
 	}
 }
 
-static qboolean
-SV_SendClientDatagram(client_t *client)
+/* Spawned clients that get a datagram this frame. */
+static client_t *sv_sendlist[MAX_CLIENTS];
+
+static client_view_t *
+SV_ClientView(client_t *client)
 {
-	byte msg_buf[MAX_MSGLEN];
-	sizebuf_t msg;
+	return &svs.client_views[client - svs.clients];
+}
 
-	SV_BuildClientFrame(client);
+static void
+SV_CullClientJob(int index)
+{
+	client_t *client = sv_sendlist[index];
+
+	SV_CullClientEntities(client, SV_ClientView(client));
+}
 
-	SZ_Init(&msg, msg_buf, sizeof(msg_buf));
-	msg.allowoverflow = true;
+static void
+SV_WriteFrameJob(int index)
+{
+	client_t *client = sv_sendlist[index];
+	client_view_t *view = SV_ClientView(client);
+
+	/* frames only grow beyond a datagram if
+	   the client's netchan can fragment them */
+	SZ_Init(&view->msg, view->msg_buf,
+			(client->netchan.version >= NETCHAN_VERSION) ?
+			sizeof(view->msg_buf) : MAX_MSGLEN);
+	view->msg.allowoverflow = true;
+	view->msg.quietoverflow = true; /* see SV_SendClientDatagram() */
 
 	/* send over all the relevant entity_state_t
 	   and the player_state_t */
-	SV_WriteFrameToClient(client, &msg);
+	SV_WriteFrameToClient(client, &view->msg);
+}
+
+static void
+SV_SendClientDatagram(client_t *client)
+{
+	sizebuf_t *msg = &SV_ClientView(client)->msg;
 
 	/* copy the accumulated multicast datagram
 	   for this client out to the message
@@ -470,25 +496,57 @@ SV_SendClientDatagram(client_t *client)
 	}
 	else
 	{
-		SZ_Write(&msg, client->datagram.data, client->datagram.cursize);
+		SZ_Write(msg, client->datagram.data, client->datagram.cursize);
 	}
 
 	SZ_Clear(&client->datagram);
 
-	if (msg.overflowed)
+	if (msg->overflowed)
 	{
 		/* must have room left for the packet header */
 		Com_Printf("WARNING: msg overflowed for %s\n", client->name);
-		SZ_Clear(&msg);
+		SZ_Clear(msg);
 	}
 
 	/* send the datagram */
-	Netchan_Transmit(&client->netchan, msg.cursize, msg.data);
+	Netchan_Transmit(&client->netchan, msg->cursize, msg->data);
 
-	/* record the size for rate estimation */
-	client->message_size[sv.framenum % RATE_MESSAGES] = msg.cursize;
+	client->ratetokens -= msg->cursize;
+	client->bytes_sent += msg->cursize;
+}
 
-	return true;
+/*
+ * Builds and sends the frames of all clients in sv_sendlist.
+ * Culling the entities and delta encoding them is done by the
+ * worker pool, everything touching shared state is done here
+ * in client order so the result doesn't depend on the number
+ * of threads.
+ */
+static void
+SV_SendClientDatagrams(int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		SV_SetupClientFrame(sv_sendlist[i], SV_ClientView(sv_sendlist[i]));
+	}
+
+	SV_RunJobs(SV_CullClientJob, count);
+
+	for (i = 0; i < count; i++)
+	{
+		SV_StoreClientFrame(sv_sendlist[i], SV_ClientView(sv_sendlist[i]));
+	}
+
+	SV_BuildDeltaCache(sv_sendlist, count);
+
+	SV_RunJobs(SV_WriteFrameJob, count);
+
+	for (i = 0; i < count; i++)
+	{
+		SV_SendClientDatagram(sv_sendlist[i]);
+	}
 }
 
 static void
@@ -504,36 +562,47 @@ SV_DemoCompleted(void)
 }
 
 /*
- * Returns true if the client is over its current
- * bandwidth estimation and should not be sent another packet
+ * Each client has a bucket of tokens, one per byte, filled at
+ * its rate and holding at most a fifth of a second worth.
+ * Frames and downloads take from it. Returns false if it's
+ * empty and the client shouldn't be sent a frame, otherwise
+ * sets how large the frame may be, see SV_PrioritizeEntities().
  */
 static qboolean
-SV_RateDrop(client_t *c)
+SV_RateAllows(client_t *c)
 {
-	int total;
-	int i;
+	client_view_t *view = SV_ClientView(c);
+	long long tokens;
 
-	/* never drop over the loopback */
-	if (c->netchan.remote_address.type == NA_LOOPBACK)
-	{
-		return false;
-	}
+	tokens = c->ratetokens + (long long)(svs.realtime - c->ratetime) * c->rate / 1000;
+	c->ratetokens = (int)Q_min(tokens, Q_max(c->rate / 5, MAX_MSGLEN));
+	c->ratetime = svs.realtime;
 
-	total = 0;
+	/* frames only grow beyond a datagram if
+	   the client's netchan can fragment them */
+	view->budget = (c->netchan.version >= NETCHAN_VERSION) ?
+		sizeof(view->msg_buf) : MAX_MSGLEN;
 
-	for (i = 0; i < RATE_MESSAGES; i++)
+	/* never drop over the loopback, it has
+	   no rate to keep to, so the bucket stays full */
+	if (c->netchan.remote_address.type == NA_LOOPBACK)
 	{
-		total += c->message_size[i];
+		c->ratetokens = Q_max(c->rate / 5, MAX_MSGLEN);
+		return true;
 	}
 
-	if (total > c->rate)
+	if (c->ratetokens <= 0)
 	{
 		c->surpressCount++;
-		c->message_size[sv.framenum % RATE_MESSAGES] = 0;
-		return true;
+		c->frames_suppressed++;
+		return false;
 	}
 
-	return false;
+	/* a frame doesn't wait for the bucket to fill up, a
+	   large one is paid for by the following frames */
+	view->budget = Q_min(view->budget, c->ratetokens);
+
+	return true;
 }
 
 static int
@@ -561,10 +630,10 @@ SV_NextDemoChunk(byte *msgbuf)
 		return -1;
 	}
 
-	if (n > MAX_MSGLEN)
+	if (n > MAX_FRAGMENTED_MSGLEN)
 	{
 		Com_Error(ERR_DROP,
-				"SV_SendClientMessages: msglen > MAX_MSGLEN");
+				"SV_SendClientMessages: msglen > MAX_FRAGMENTED_MSGLEN");
 	}
 
 	r = FS_FRead(msgbuf, n, 1, sv.demofile);
@@ -587,13 +656,95 @@ SV_SendDisconnect(client_t *c)
 	Netchan_Transmit(&c->netchan, 0, NULL);
 }
 
+/*
+ * Sends as much of a windowed download as sv_downloadrate
+ * allows. In game it's also held to the client's rate and
+ * gets only what that leaves over after the frames,
+ * the rate says nothing about downloads before that
+ * since it's clamped for gameplay. The blocks go in
+ * packets of their own and at most downloadwindow bytes
+ * ahead of what the client acknowledged. If nothing
+ * happened for a second, what isn't acknowledged got lost
+ * and is sent again.
+ */
+static void
+SV_SendDownloadWindow(client_t *c)
+{
+	sizebuf_t msg;
+	byte msg_buf[MAX_MSGLEN];
+	int rate, r, percent;
+
+	if (!c->download || !c->downloadwindow)
+	{
+		return;
+	}
+
+	rate = Q_max((int)sv_downloadrate->value, MAX_MSGLEN);
+
+	if (c->state == cs_spawned)
+	{
+		rate = Q_min(rate, c->rate);
+	}
+
+	c->downloadcredit += (int)((long long)(svs.realtime - c->downloadcredittime) * rate / 1000);
+	c->downloadcredit = Q_min(c->downloadcredit, Q_max(rate / 10, MAX_MSGLEN));
+	c->downloadcredittime = svs.realtime;
+
+	if ((c->downloadacked < c->downloadcount) &&
+		(svs.realtime - c->downloadtime > 1000))
+	{
+		c->downloadcount = c->downloadacked;
+		c->downloadtime = svs.realtime;
+	}
+
+	while ((c->downloadcredit > 0) &&
+		   ((c->state != cs_spawned) || (c->ratetokens > 0)) &&
+		   (c->downloadcount < c->downloadsize) &&
+		   (c->downloadcount - c->downloadacked < c->downloadwindow))
+	{
+		/* the block shares the packet with the netchan
+		   header, its own header and maybe a reliable */
+		r = sizeof(msg_buf) - 16 - c->netchan.reliable_length - c->netchan.message.cursize;
+		r = Q_min(r, c->downloadsize - c->downloadcount);
+		r = Q_min(r, c->downloadwindow - (c->downloadcount - c->downloadacked));
+
+		if (r <= 0)
+		{
+			break;
+		}
+
+		c->downloadcount += r;
+		percent = (int)((long long)c->downloadcount * 100 / c->downloadsize);
+
+		SZ_Init(&msg, msg_buf, sizeof(msg_buf));
+		MSG_WriteByte(&msg, svc_download);
+		MSG_WriteShort(&msg, r);
+		MSG_WriteByte(&msg, percent | DOWNLOAD_WINDOWED);
+		MSG_WriteLong(&msg, c->downloadcount - r);
+		SZ_Write(&msg, c->download + c->downloadcount - r, r);
+
+		Netchan_Transmit(&c->netchan, msg.cursize, msg.data);
+
+		c->downloadcredit -= msg.cursize;
+		c->downloadtime = svs.realtime;
+		c->download_bytes += msg.cursize;
+		c->bytes_sent += msg.cursize;
+
+		if (c->state == cs_spawned)
+		{
+			c->ratetokens -= msg.cursize;
+		}
+	}
+}
+
 void
 SV_SendClientMessages(void)
 {
 	int i;
 	client_t *c;
 	int msglen;
-	byte msgbuf[MAX_MSGLEN];
+	int numsend;
+	byte msgbuf[MAX_FRAGMENTED_MSGLEN];
 
 	/* read the next demo message if needed */
 	if (sv.demofile && (sv.state == ss_demo))
@@ -611,6 +762,8 @@ SV_SendClientMessages(void)
 		msglen = 0;
 	}
 
+	numsend = 0;
+
 	/* send a message to each spawned client */
 	for (i = 0, c = svs.clients; i < maxclients->value; i++, c++)
 	{
@@ -634,16 +787,24 @@ SV_SendClientMessages(void)
 		else if (c->state == cs_spawned)
 		{
 			/* don't overrun bandwidth */
-			if (SV_RateDrop(c))
+			if (!SV_RateAllows(c))
 			{
 				continue;
 			}
 
-			SV_SendClientDatagram(c);
+			sv_sendlist[numsend++] = c;
 		}
 
 		/* messages to non-spawned clients are sent by SendPrepClientMessages */
 	}
+
+	SV_SendClientDatagrams(numsend);
+
+	/* downloads in game get what the frames left over */
+	for (i = 0; i < numsend; i++)
+	{
+		SV_SendDownloadWindow(sv_sendlist[i]);
+	}
 }
 
 void
@@ -673,6 +834,8 @@ SV_SendPrepClientMessages(void)
 			continue;
 		}
 
+		SV_SendDownloadWindow(c);
+
 		/* just update reliable	if needed */
 		if (c->netchan.message.cursize ||
 			(curtime - c->netchan.last_sent > 1000))
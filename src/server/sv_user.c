@@ -369,6 +369,28 @@ SV_NextDownload_f(void)
 		return;
 	}
 
+	/* windowed downloads are sent by SV_SendPrepClientMessages(),
+	   the client only tells how much it got */
+	if (sv_client->downloadwindow)
+	{
+		r = (int)strtol(Cmd_Argv(1), (char **)NULL, 10);
+
+		if (r > sv_client->downloadacked)
+		{
+			sv_client->downloadacked = Q_min(r, sv_client->downloadsize);
+			sv_client->downloadcount = Q_max(sv_client->downloadcount, sv_client->downloadacked);
+			sv_client->downloadtime = svs.realtime;
+		}
+
+		if (sv_client->downloadacked == sv_client->downloadsize)
+		{
+			FS_FreeFile(sv_client->download);
+			sv_client->download = NULL;
+		}
+
+		return;
+	}
+
 	r = sv_client->downloadsize - sv_client->downloadcount;
 
 	if (r > 1024)
@@ -412,6 +434,7 @@ SV_BeginDownload_f(void)
 	extern cvar_t *allow_download_maps;
 	extern qboolean file_from_protected_pak;
 	int offset = 0;
+	int window = 0;
 
 	name = Cmd_Argv(1);
 
@@ -420,6 +443,11 @@ SV_BeginDownload_f(void)
 		offset = (int)strtol(Cmd_Argv(2), (char **)NULL, 10); /* downloaded offset */
 	}
 
+	if (Cmd_Argc() > 3)
+	{
+		window = (int)strtol(Cmd_Argv(3), (char **)NULL, 10); /* bytes to send ahead */
+	}
+
 	/* hacked by zoid to allow more conrol over download
 	   first off, no .. or global allow check */
 	if (strstr(name, "..") || strstr(name, "\\") || strstr(name, ":") || !allow_download->value
@@ -444,6 +472,18 @@ SV_BeginDownload_f(void)
 		return;
 	}
 
+	/* a windowed download lost something and starts over
+	   at the offset, no need to load the file again */
+	if (sv_client->download && sv_client->downloadwindow && (window > 0) &&
+		!strcmp(sv_client->downloadname, name) &&
+		(offset >= 0) && (offset < sv_client->downloadsize))
+	{
+		sv_client->downloadcount = offset;
+		sv_client->downloadacked = offset;
+		sv_client->downloadtime = svs.realtime;
+		return;
+	}
+
 	if (sv_client->download)
 	{
 		FS_FreeFile(sv_client->download);
@@ -451,6 +491,7 @@ SV_BeginDownload_f(void)
 
 	sv_client->downloadsize = FS_LoadFile(name, (void **)&sv_client->download);
 	sv_client->downloadcount = offset;
+	sv_client->downloadwindow = 0;
 
 	if (offset > sv_client->downloadsize)
 	{
@@ -473,6 +514,24 @@ SV_BeginDownload_f(void)
 		return;
 	}
 
+	Q_strlcpy(sv_client->downloadname, name, sizeof(sv_client->downloadname));
+
+	/* the client can take more than one block at a time. if
+	   there's nothing left the old way tells it that it's done */
+	if ((window > 0) && (sv_downloadrate->value > 0) &&
+		(sv_client->downloadcount < sv_client->downloadsize))
+	{
+		sv_client->downloadwindow = Q_min(window, 16 * DOWNLOAD_WINDOW);
+		sv_client->downloadacked = sv_client->downloadcount;
+		sv_client->downloadtime = svs.realtime;
+		sv_client->downloadcredittime = svs.realtime;
+		sv_client->downloadcredit = MAX_MSGLEN;
+
+		Com_DPrintf("Downloading %s to %s, %i bytes ahead\n", name,
+				sv_client->name, sv_client->downloadwindow);
+		return;
+	}
+
 	SV_NextDownload_f();
 	Com_DPrintf("Downloading %s to %s\n", name, sv_client->name);
 }
@@ -679,8 +738,17 @@ SV_ExecuteClientMessage(client_t *cl)
 
 					if (cl->lastframe > 0)
 					{
+						client_frame_t *frame = &cl->frames[cl->lastframe & UPDATE_MASK];
+
 						cl->frame_latency[cl->lastframe & (LATENCY_COUNTS - 1)] =
-							svs.realtime - cl->frames[cl->lastframe & UPDATE_MASK].senttime;
+							svs.realtime - frame->senttime;
+
+						/* it can be delta'd from for a while */
+						if ((cl->state == cs_spawned) &&
+							(frame->framenum == cl->lastframe))
+						{
+							frame->acked = true;
+						}
 					}
 				}
 
@@ -709,6 +777,12 @@ SV_ExecuteClientMessage(client_t *cl)
 					return;
 				}
 
+				/* the other way loses packets, too */
+				if (cl->netchan.dropped)
+				{
+					cl->lossframe = sv.framenum;
+				}
+
 				if (!sv_paused->value)
 				{
 					net_drop = cl->netchan.dropped;
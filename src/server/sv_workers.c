@@ -0,0 +1,353 @@
+/*
+ * Copyright (C) 1997-2001 Id Software, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ * =======================================================================
+ *
+ * A small pool of worker threads for the server. SV_RunJobs() hands
+ * out the indices 0 to count - 1 to the workers and the main thread
+ * and returns once all of them are done, so callers don't have to
+ * care whether the pool is running or not. Jobs must not call into
+ * the zone, the console or Com_Error(). Warnings go through
+ * SV_JobWarning(), which prints them once all jobs are done.
+ *
+ * =======================================================================
+ */
+
+#include "header/server.h"
+
+#define SV_MAX_WORKERS 16
+#define SV_MAX_JOB_WARNINGS 8
+
+static cvar_t *sv_threads;
+
+static sysMutex_t *sv_workmutex;
+static sysCond_t *sv_workcond;
+static sysCond_t *sv_donecond;
+static sysThread_t *sv_workthreads[SV_MAX_WORKERS];
+static int sv_numworkers;
+static qboolean sv_workquit;
+
+/* Current batch, protected by sv_workmutex. */
+static void (*sv_jobfunc)(int index);
+static int sv_jobcount;
+static int sv_jobnext;
+static int sv_jobdone;
+
+/* Warnings of the current batch, protected by sv_workmutex. */
+static qboolean sv_injobs;
+static const char *sv_jobwarnings[SV_MAX_JOB_WARNINGS];
+static int sv_jobwarningcount[SV_MAX_JOB_WARNINGS];
+static int sv_numjobwarnings;
+
+static void
+SV_Worker(void *data)
+{
+	void (*func)(int index);
+	int index;
+
+	Sys_LockMutex(sv_workmutex);
+
+	while (true)
+	{
+		while (!sv_workquit && sv_jobnext >= sv_jobcount)
+		{
+			Sys_WaitCond(sv_workcond, sv_workmutex);
+		}
+
+		if (sv_workquit)
+		{
+			break;
+		}
+
+		func = sv_jobfunc;
+		index = sv_jobnext++;
+
+		Sys_UnlockMutex(sv_workmutex);
+		func(index);
+		Sys_LockMutex(sv_workmutex);
+
+		if (++sv_jobdone == sv_jobcount)
+		{
+			Sys_SignalCond(sv_donecond);
+		}
+	}
+
+	Sys_UnlockMutex(sv_workmutex);
+}
+
+static void
+SV_StopWorkers(void)
+{
+	int i;
+
+	if (!sv_numworkers)
+	{
+		return;
+	}
+
+	Sys_LockMutex(sv_workmutex);
+	sv_workquit = true;
+	Sys_BroadcastCond(sv_workcond);
+	Sys_UnlockMutex(sv_workmutex);
+
+	for (i = 0; i < sv_numworkers; i++)
+	{
+		Sys_JoinThread(sv_workthreads[i]);
+		sv_workthreads[i] = NULL;
+	}
+
+	sv_numworkers = 0;
+	sv_workquit = false;
+}
+
+/*
+ * Starts the number of workers asked for by sv_threads,
+ * or one less than there are CPUs if it's negative.
+ * Returns false if the jobs must run on the main thread.
+ */
+static qboolean
+SV_StartWorkers(void)
+{
+	int count;
+
+	if (sv_threads->modified)
+	{
+		sv_threads->modified = false;
+		SV_StopWorkers();
+	}
+
+	if (sv_numworkers)
+	{
+		return true;
+	}
+
+	count = (int)sv_threads->value;
+
+	if (count < 0)
+	{
+		count = Sys_GetNumCPUs() - 1;
+	}
+
+	count = Q_min(count, SV_MAX_WORKERS);
+
+	if (count <= 0)
+	{
+		return false;
+	}
+
+#ifdef YQ2_NO_THREAD_LOCAL
+	/* the workers would share the collision state */
+	Com_Printf("%s: no thread local storage, worker threads disabled\n", __func__);
+	Cvar_Set("sv_threads", "0");
+	sv_threads->modified = false;
+	return false;
+#endif
+
+	if (!sv_workmutex)
+	{
+		sv_workmutex = Sys_CreateMutex();
+		sv_workcond = Sys_CreateCond();
+		sv_donecond = Sys_CreateCond();
+
+		if (!sv_workmutex || !sv_workcond || !sv_donecond)
+		{
+			Com_Printf("%s: couldn't create locks, worker threads disabled\n", __func__);
+			Cvar_Set("sv_threads", "0");
+			sv_threads->modified = false;
+			return false;
+		}
+	}
+
+	while (sv_numworkers < count)
+	{
+		if ((sv_workthreads[sv_numworkers] = Sys_CreateThread(SV_Worker, NULL)) == NULL)
+		{
+			break;
+		}
+
+		sv_numworkers++;
+	}
+
+	if (!sv_numworkers)
+	{
+		Com_Printf("%s: couldn't create threads, worker threads disabled\n", __func__);
+		Cvar_Set("sv_threads", "0");
+		sv_threads->modified = false;
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Prints the warning, or if it's called by a job, keeps it
+ * until all jobs are done. The warning must be a string
+ * constant, each one is printed once per batch.
+ */
+void
+SV_JobWarning(const char *warning)
+{
+	int i;
+
+	if (!sv_injobs)
+	{
+		Com_Printf("%s", warning);
+		return;
+	}
+
+	if (sv_numworkers)
+	{
+		Sys_LockMutex(sv_workmutex);
+	}
+
+	for (i = 0; i < sv_numjobwarnings; i++)
+	{
+		if (sv_jobwarnings[i] == warning)
+		{
+			break;
+		}
+	}
+
+	if (i < SV_MAX_JOB_WARNINGS)
+	{
+		sv_jobwarnings[i] = warning;
+		sv_jobwarningcount[i]++;
+		sv_numjobwarnings = Q_max(sv_numjobwarnings, i + 1);
+	}
+
+	if (sv_numworkers)
+	{
+		Sys_UnlockMutex(sv_workmutex);
+	}
+}
+
+static void
+SV_PrintJobWarnings(void)
+{
+	int i;
+
+	for (i = 0; i < sv_numjobwarnings; i++)
+	{
+		if (sv_jobwarningcount[i] > 1)
+		{
+			Com_Printf("(%i times) %s", sv_jobwarningcount[i], sv_jobwarnings[i]);
+		}
+		else
+		{
+			Com_Printf("%s", sv_jobwarnings[i]);
+		}
+
+		sv_jobwarnings[i] = NULL;
+		sv_jobwarningcount[i] = 0;
+	}
+
+	sv_numjobwarnings = 0;
+}
+
+static void
+SV_RunJobBatch(void (*func)(int index), int count)
+{
+	int index;
+
+	if ((count == 1) || !SV_StartWorkers())
+	{
+		for (index = 0; index < count; index++)
+		{
+			func(index);
+		}
+
+		return;
+	}
+
+	Sys_LockMutex(sv_workmutex);
+
+	sv_jobfunc = func;
+	sv_jobcount = count;
+	sv_jobnext = 0;
+	sv_jobdone = 0;
+
+	Sys_BroadcastCond(sv_workcond);
+
+	/* lend a hand */
+	while (sv_jobnext < sv_jobcount)
+	{
+		index = sv_jobnext++;
+
+		Sys_UnlockMutex(sv_workmutex);
+		func(index);
+		Sys_LockMutex(sv_workmutex);
+
+		sv_jobdone++;
+	}
+
+	while (sv_jobdone < sv_jobcount)
+	{
+		Sys_WaitCond(sv_donecond, sv_workmutex);
+	}
+
+	sv_jobfunc = NULL;
+	sv_jobcount = 0;
+	sv_jobnext = 0;
+
+	Sys_UnlockMutex(sv_workmutex);
+}
+
+/*
+ * Calls func for every index from 0 to count - 1 and
+ * waits until all calls have returned. The order in
+ * which the indices are handed out is unspecified.
+ */
+void
+SV_RunJobs(void (*func)(int index), int count)
+{
+	if (count <= 0)
+	{
+		return;
+	}
+
+	sv_injobs = true;
+	SV_RunJobBatch(func, count);
+	sv_injobs = false;
+
+	SV_PrintJobWarnings();
+}
+
+void
+SV_InitWorkers(void)
+{
+	sv_threads = Cvar_Get("sv_threads", "0", CVAR_ARCHIVE);
+	sv_threads->modified = false;
+}
+
+void
+SV_ShutdownWorkers(void)
+{
+	if (!sv_threads)
+	{
+		return;
+	}
+
+	SV_StopWorkers();
+
+	Sys_DestroyCond(sv_donecond);
+	Sys_DestroyCond(sv_workcond);
+	Sys_DestroyMutex(sv_workmutex);
+	sv_donecond = sv_workcond = NULL;
+	sv_workmutex = NULL;
+}
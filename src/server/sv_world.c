@@ -26,29 +26,92 @@
 
 #include "header/server.h"
 
-#define AREA_DEPTH 4
-#define AREA_NODES 32
+/*
+ * Entities are sorted into a loose quadtree. Like the uniform
+ * tree of the original code it only splits along x and y, maps
+ * are much wider than high. Every node covers a square of
+ * 2 * size edge length around its center, but accepts entities
+ * reaching up to size beyond it. An entity is linked into the
+ * deepest node whose cell holds its center and whose loose
+ * bounds hold its box, so small and fast moving entities like
+ * rockets and gibs end up deep down in the tree where they are
+ * only tested against queries near them, instead of piling up
+ * in the top nodes because they straddle a split plane. Nodes
+ * are created on demand and returned to the free list once
+ * they're empty.
+ */
+#define AREA_NODES 4096
+#define AREA_MINSIZE 64
+#define AREA_SPLIT 8
 #define MAX_TOTAL_ENT_LEAFS 128
+#define TRACEBATCH_CHUNK 4 /* rays per job of SV_TraceBatch() */
 
 #define STRUCT_FROM_LINK(l, t, m) ((t *)((byte *)l - (byte *)&(((t *)NULL)->m)))
 #define EDICT_FROM_AREA(l) STRUCT_FROM_LINK(l, edict_t, area)
 
 typedef struct areanode_s
 {
-	int axis; /* -1 = leaf node */
-	float dist;
-	struct areanode_s *children[2];
+	float center[2];
+	float size; /* half the edge length of the cell */
+	int numedicts; /* linked to this node and its children */
+	struct areanode_s *parent;
+	struct areanode_s *children[4];
 	link_t trigger_edicts;
 	link_t solid_edicts;
 } areanode_t;
 
-areanode_t sv_areanodes[AREA_NODES];
-int sv_numareanodes;
+static areanode_t sv_areanodes[AREA_NODES];
+static areanode_t *sv_freeareanodes;
+static int sv_numareanodes;
+
+/* Node each edict is linked to. The benchmark links
+   edicts that aren't part of ge->edicts, see below. */
+static areanode_t *sv_edictareas[MAX_EDICTS];
+static edict_t *sv_benchedicts;
+static areanode_t **sv_benchareas;
+static int sv_numbenchedicts;
 
-float *area_mins, *area_maxs;
-edict_t **area_list;
-int area_count, area_maxcount;
-int area_type;
+static struct
+{
+	int queries;
+	int nodes;
+	int tested;
+	int found;
+} sv_areastats;
+
+/* Edicts touching more than MAX_ENT_CLUSTERS clusters are marked
+   by headnode. For those the non-zero words of a bit vector of the
+   clusters below their headnode are kept here, so culling them is
+   a few ANDs against the client's fat PVS instead of a walk down
+   the tree for every client and frame. */
+typedef struct
+{
+	qboolean valid;
+	int headnode; /* the words were gathered for this node */
+	int numwords;
+	int maxwords;
+	int *words; /* pairs of word index and bits */
+} edictclusters_t;
+
+static edictclusters_t sv_edictclusters[MAX_EDICTS];
+static int32_t sv_clusterbits[65536 / 32];
+
+/* A single SV_AreaEdicts() query. Lives on the stack, so
+   queries from worker threads don't get in each other's way. */
+typedef struct
+{
+	const float *mins, *maxs;
+	edict_t **list;
+	int count, maxcount;
+	int type;
+	int nodes, tested; /* statistics */
+	qboolean overflowed;
+} areaquery_t;
+
+/* Rays of the current SV_TraceBatch() */
+static traceray_t *sv_batchrays;
+static trace_t *sv_batchtraces;
+static int sv_batchcount;
 
 static int SV_HullForEntity(edict_t *ent);
 
@@ -75,50 +138,215 @@ InsertLinkBefore(link_t *l, link_t *before)
 	l->next->prev = l;
 }
 
+static qboolean
+SV_IsBenchEdict(const edict_t *ent)
+{
+	return sv_numbenchedicts && (ent >= sv_benchedicts) &&
+		(ent < sv_benchedicts + sv_numbenchedicts);
+}
+
+static areanode_t **
+SV_AreaNodeForEdict(edict_t *ent)
+{
+	if (SV_IsBenchEdict(ent))
+	{
+		return &sv_benchareas[ent - sv_benchedicts];
+	}
+
+	return &sv_edictareas[NUM_FOR_EDICT(ent)];
+}
+
+static void
+SV_FreeEdictClusters(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_EDICTS; i++)
+	{
+		if (sv_edictclusters[i].words)
+		{
+			Z_Free(sv_edictclusters[i].words);
+		}
+	}
+
+	memset(sv_edictclusters, 0, sizeof(sv_edictclusters));
+}
+
+/*
+ * Gathers the cluster words of an edict that was marked
+ * by headnode. Doors and trains usually keep their node
+ * while moving, so this is only redone when it changes.
+ */
+static void
+SV_SetEdictClusters(edict_t *ent)
+{
+	edictclusters_t *ec;
+	int i, numwords, count;
+
+	if (SV_IsBenchEdict(ent))
+	{
+		return;
+	}
+
+	ec = &sv_edictclusters[NUM_FOR_EDICT(ent)];
+
+	if (ec->valid && (ec->headnode == ent->headnode))
+	{
+		return;
+	}
+
+	CM_HeadnodeClusters(ent->headnode, (byte *)sv_clusterbits);
+	numwords = (CM_NumClusters() + 31) >> 5;
+
+	for (i = 0, count = 0; i < numwords; i++)
+	{
+		if (sv_clusterbits[i])
+		{
+			count++;
+		}
+	}
+
+	if (count > ec->maxwords)
+	{
+		if (ec->words)
+		{
+			Z_Free(ec->words);
+		}
+
+		ec->words = Z_Malloc(count * 2 * sizeof(int));
+		ec->maxwords = count;
+	}
+
+	for (i = 0, count = 0; i < numwords; i++)
+	{
+		if (sv_clusterbits[i])
+		{
+			ec->words[count * 2] = i;
+			ec->words[count * 2 + 1] = sv_clusterbits[i];
+			sv_clusterbits[i] = 0;
+			count++;
+		}
+	}
+
+	ec->numwords = count;
+	ec->headnode = ent->headnode;
+	ec->valid = true;
+}
+
 /*
- * Builds a uniformly subdivided tree for the given world size
+ * Returns true if one of the clusters below the headnode
+ * of an edict with num_clusters == -1 is set in visbits.
  */
+qboolean
+SV_EdictClustersVisible(edict_t *ent, const int32_t *visbits)
+{
+	const edictclusters_t *ec;
+	int i;
+
+	ec = &sv_edictclusters[NUM_FOR_EDICT(ent)];
+
+	if (!ec->valid || (ec->headnode != ent->headnode))
+	{
+		return CM_HeadnodeVisible(ent->headnode, (const byte *)visbits);
+	}
+
+	for (i = 0; i < ec->numwords; i++)
+	{
+		if (visbits[ec->words[i * 2]] & ec->words[i * 2 + 1])
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
 static areanode_t *
-SV_CreateAreaNode(int depth, vec3_t mins, vec3_t maxs)
+SV_AllocAreaNode(areanode_t *parent, int quadrant)
 {
 	areanode_t *anode;
-	vec3_t size;
-	vec3_t mins1, maxs1, mins2, maxs2;
+	int i;
 
-	anode = &sv_areanodes[sv_numareanodes];
+	if (!sv_freeareanodes)
+	{
+		return NULL;
+	}
+
+	anode = sv_freeareanodes;
+	sv_freeareanodes = anode->children[0];
 	sv_numareanodes++;
 
+	memset(anode, 0, sizeof(*anode));
 	ClearLink(&anode->trigger_edicts);
 	ClearLink(&anode->solid_edicts);
 
-	if (depth == AREA_DEPTH)
+	anode->parent = parent;
+	anode->size = parent->size * 0.5f;
+
+	for (i = 0; i < 2; i++)
 	{
-		anode->axis = -1;
-		anode->children[0] = anode->children[1] = NULL;
-		return anode;
+		anode->center[i] = parent->center[i] +
+			((quadrant & (1 << i)) ? anode->size : -anode->size);
 	}
 
-	VectorSubtract(maxs, mins, size);
+	parent->children[quadrant] = anode;
+
+	return anode;
+}
 
-	if (size[0] > size[1])
+/*
+ * Finds the deepest node that can hold the given box,
+ * creating nodes on the way as needed.
+ */
+static areanode_t *
+SV_AreaNodeForBox(const vec3_t mins, const vec3_t maxs)
+{
+	areanode_t *anode, *child;
+	float center[2];
+	float extent;
+	int i, quadrant;
+
+	extent = 0;
+
+	for (i = 0; i < 2; i++)
 	{
-		anode->axis = 0;
+		center[i] = 0.5f * (mins[i] + maxs[i]);
+		extent = Q_max(extent, 0.5f * (maxs[i] - mins[i]));
 	}
-	else
+
+	anode = sv_areanodes;
+
+	/* Things outside of the world stay in the root node. */
+	for (i = 0; i < 2; i++)
 	{
-		anode->axis = 1;
+		if (fabs(center[i] - anode->center[i]) > anode->size)
+		{
+			return anode;
+		}
 	}
 
-	anode->dist = 0.5f * (maxs[anode->axis] + mins[anode->axis]);
-	VectorCopy(mins, mins1);
-	VectorCopy(mins, mins2);
-	VectorCopy(maxs, maxs1);
-	VectorCopy(maxs, maxs2);
+	while ((anode->size > AREA_MINSIZE) && (extent <= anode->size * 0.5f) &&
+		(anode->numedicts >= AREA_SPLIT))
+	{
+		quadrant = 0;
+
+		for (i = 0; i < 2; i++)
+		{
+			if (center[i] >= anode->center[i])
+			{
+				quadrant |= 1 << i;
+			}
+		}
+
+		child = anode->children[quadrant];
 
-	maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
+		if (!child && !(child = SV_AllocAreaNode(anode, quadrant)))
+		{
+			break;
+		}
 
-	anode->children[0] = SV_CreateAreaNode(depth + 1, mins2, maxs2);
-	anode->children[1] = SV_CreateAreaNode(depth + 1, mins1, maxs1);
+		anode = child;
+	}
 
 	return anode;
 }
@@ -126,14 +354,55 @@ SV_CreateAreaNode(int depth, vec3_t mins, vec3_t maxs)
 void
 SV_ClearWorld(void)
 {
+	const float *mins, *maxs;
+	areanode_t *anode;
+	int i;
+
 	memset(sv_areanodes, 0, sizeof(sv_areanodes));
-	sv_numareanodes = 0;
-	SV_CreateAreaNode(0, sv.models[1]->mins, sv.models[1]->maxs);
+	memset(sv_edictareas, 0, sizeof(sv_edictareas));
+	SV_FreeEdictClusters();
+
+	/* Node 0 is the root, all others go into the free list. */
+	sv_freeareanodes = NULL;
+
+	for (i = AREA_NODES - 1; i > 0; i--)
+	{
+		sv_areanodes[i].children[0] = sv_freeareanodes;
+		sv_freeareanodes = &sv_areanodes[i];
+	}
+
+	sv_numareanodes = 1;
+
+	anode = sv_areanodes;
+	ClearLink(&anode->trigger_edicts);
+	ClearLink(&anode->solid_edicts);
+
+	mins = sv.models[1]->mins;
+	maxs = sv.models[1]->maxs;
+
+	for (i = 0; i < 2; i++)
+	{
+		anode->center[i] = 0.5f * (mins[i] + maxs[i]);
+		anode->size = Q_max(anode->size, 0.5f * (maxs[i] - mins[i]));
+	}
+}
+
+/*
+ * Called when the server shuts down.
+ */
+void
+SV_ShutdownWorld(void)
+{
+	SV_FreeEdictClusters();
 }
 
 void
 SV_UnlinkEdict(edict_t *ent)
 {
+	areanode_t **slot;
+	areanode_t *anode, *parent;
+	int i;
+
 	if (!ent->area.prev)
 	{
 		return; /* not linked in anywhere */
@@ -141,6 +410,36 @@ SV_UnlinkEdict(edict_t *ent)
 
 	RemoveLink(&ent->area);
 	ent->area.prev = ent->area.next = NULL;
+
+	slot = SV_AreaNodeForEdict(ent);
+	anode = *slot;
+	*slot = NULL;
+
+	/* Return nodes that became empty to the free list. Children
+	   never hold more edicts than their parent, so they're gone
+	   already when a parent drops to zero. */
+	while (anode)
+	{
+		parent = anode->parent;
+		anode->numedicts--;
+
+		if (!anode->numedicts && parent)
+		{
+			for (i = 0; i < 4; i++)
+			{
+				if (parent->children[i] == anode)
+				{
+					parent->children[i] = NULL;
+				}
+			}
+
+			anode->children[0] = sv_freeareanodes;
+			sv_freeareanodes = anode;
+			sv_numareanodes--;
+		}
+
+		anode = parent;
+	}
 }
 
 void
@@ -352,6 +651,11 @@ SV_LinkEdict(edict_t *ent)
 		}
 	}
 
+	if (ent->num_clusters == -1)
+	{
+		SV_SetEdictClusters(ent);
+	}
+
 	/* if first time, make sure old_origin is valid */
 	if (!ent->linkcount)
 	{
@@ -365,29 +669,9 @@ SV_LinkEdict(edict_t *ent)
 		return;
 	}
 
-	/* find the first node that the ent's box crosses */
-	node = sv_areanodes;
-
-	while (1)
-	{
-		if (node->axis == -1)
-		{
-			break;
-		}
-
-		if (ent->absmin[node->axis] > node->dist)
-		{
-			node = node->children[0];
-		}
-		else if (ent->absmax[node->axis] < node->dist)
-		{
-			node = node->children[1];
-		}
-		else
-		{
-			break; /* crosses the node */
-		}
-	}
+	/* find the deepest node that holds the ent's box */
+	node = SV_AreaNodeForBox(ent->absmin, ent->absmax);
+	*SV_AreaNodeForEdict(ent) = node;
 
 	/* link it in */
 	if (ent->solid == SOLID_TRIGGER)
@@ -398,16 +682,26 @@ SV_LinkEdict(edict_t *ent)
 	{
 		InsertLinkBefore(&ent->area, &node->solid_edicts);
 	}
+
+	for ( ; node; node = node->parent)
+	{
+		node->numedicts++;
+	}
 }
 
 static void
-SV_AreaEdicts_r(areanode_t *node)
+SV_AreaEdicts_r(areaquery_t *q, areanode_t *node)
 {
 	link_t *l, *next, *start;
 	edict_t *check;
+	areanode_t *child;
+	float size;
+	int i;
+
+	q->nodes++;
 
 	/* touch linked edicts */
-	if (area_type == AREA_SOLID)
+	if (q->type == AREA_SOLID)
 	{
 		start = &node->solid_edicts;
 	}
@@ -426,63 +720,88 @@ SV_AreaEdicts_r(areanode_t *node)
 			continue; /* deactivated */
 		}
 
-		if ((check->absmin[0] > area_maxs[0]) ||
-			(check->absmin[1] > area_maxs[1]) ||
-			(check->absmin[2] > area_maxs[2]) ||
-			(check->absmax[0] < area_mins[0]) ||
-			(check->absmax[1] < area_mins[1]) ||
-			(check->absmax[2] < area_mins[2]))
+		q->tested++;
+
+		if ((check->absmin[0] > q->maxs[0]) ||
+			(check->absmin[1] > q->maxs[1]) ||
+			(check->absmin[2] > q->maxs[2]) ||
+			(check->absmax[0] < q->mins[0]) ||
+			(check->absmax[1] < q->mins[1]) ||
+			(check->absmax[2] < q->mins[2]))
 		{
 			continue; /* not touching */
 		}
 
-		if (area_count == area_maxcount)
+		if (q->count == q->maxcount)
 		{
-			Com_Printf("SV_AreaEdicts: MAXCOUNT\n");
+			q->overflowed = true;
 			return;
 		}
 
-		area_list[area_count] = check;
-		area_count++;
+		q->list[q->count] = check;
+		q->count++;
 	}
 
-	if (node->axis == -1)
+	/* recurse into the children whose loose bounds are touched */
+	for (i = 0; i < 4; i++)
 	{
-		return; /* terminal node */
-	}
+		child = node->children[i];
 
-	/* recurse down both sides */
-	if (area_maxs[node->axis] > node->dist)
-	{
-		SV_AreaEdicts_r(node->children[0]);
+		if (!child || !child->numedicts)
+		{
+			continue;
+		}
+
+		size = child->size * 2;
+
+		if ((child->center[0] - size > q->maxs[0]) ||
+			(child->center[1] - size > q->maxs[1]) ||
+			(child->center[0] + size < q->mins[0]) ||
+			(child->center[1] + size < q->mins[1]))
+		{
+			continue;
+		}
+
+		SV_AreaEdicts_r(q, child);
 	}
+}
+
+static int
+SV_AreaQuery(areaquery_t *q, const vec3_t mins, const vec3_t maxs,
+		edict_t **list, int maxcount, int areatype)
+{
+	memset(q, 0, sizeof(*q));
+	q->mins = mins;
+	q->maxs = maxs;
+	q->list = list;
+	q->maxcount = maxcount;
+	q->type = areatype;
+
+	SV_AreaEdicts_r(q, sv_areanodes);
 
-	if (area_mins[node->axis] < node->dist)
+	if (q->overflowed)
 	{
-		SV_AreaEdicts_r(node->children[1]);
+		/* may run on a worker thread */
+		SV_JobWarning("SV_AreaEdicts: MAXCOUNT\n");
 	}
+
+	return q->count;
 }
 
 int
 SV_AreaEdicts(vec3_t mins, vec3_t maxs, edict_t **list,
 		int maxcount, int areatype)
 {
-	area_mins = mins;
-	area_maxs = maxs;
-	area_list = list;
-	area_maxcount = maxcount;
-	area_type = areatype;
-	area_count = 0;
+	areaquery_t q;
 
-	SV_AreaEdicts_r(sv_areanodes);
+	SV_AreaQuery(&q, mins, maxs, list, maxcount, areatype);
 
-	area_mins = 0;
-	area_maxs = 0;
-	area_list = 0;
-	area_maxcount = 0;
-	area_type = 0;
+	sv_areastats.queries++;
+	sv_areastats.nodes += q.nodes;
+	sv_areastats.tested += q.tested;
+	sv_areastats.found += q.count;
 
-	return area_count;
+	return q.count;
 }
 
 int
@@ -559,11 +878,13 @@ SV_ClipMoveToEntities(moveclip_t *clip)
 {
 	int i, num;
 	edict_t *touchlist[MAX_EDICTS], *touch;
+	areaquery_t q;
 	trace_t trace;
 	int headnode;
 	float *angles;
 
-	num = SV_AreaEdicts(clip->boxmins, clip->boxmaxs, touchlist,
+	/* may run on a worker thread, see SV_TraceBatch() */
+	num = SV_AreaQuery(&q, clip->boxmins, clip->boxmaxs, touchlist,
 			MAX_EDICTS, AREA_SOLID);
 
 	/* be careful, it is possible to have an entity in this
@@ -718,3 +1039,270 @@ SV_Trace(vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end,
 	return clip.trace;
 }
 
+static void
+SV_TraceBatchJob(int index)
+{
+	traceray_t *ray;
+	int i, last;
+
+	last = Q_min((index + 1) * TRACEBATCH_CHUNK, sv_batchcount);
+
+	for (i = index * TRACEBATCH_CHUNK; i < last; i++)
+	{
+		ray = &sv_batchrays[i];
+		sv_batchtraces[i] = SV_Trace(ray->start, ray->mins, ray->maxs,
+				ray->end, ray->passent, ray->contentmask);
+	}
+}
+
+/*
+ * Traces a batch of independent rays. The results are the
+ * same as if SV_Trace() was called for each ray in order,
+ * nothing is linked or unlinked between them. Large enough
+ * batches are spread over the worker threads.
+ */
+void
+SV_TraceBatch(traceray_t *rays, trace_t *traces, int count)
+{
+	if (count <= 0)
+	{
+		return;
+	}
+
+	sv_batchrays = rays;
+	sv_batchtraces = traces;
+	sv_batchcount = count;
+
+	SV_RunJobs(SV_TraceBatchJob,
+			(count + TRACEBATCH_CHUNK - 1) / TRACEBATCH_CHUNK);
+
+	sv_batchrays = NULL;
+	sv_batchtraces = NULL;
+	sv_batchcount = 0;
+}
+
+
+/*
+ * Benchmark for the entity index. Links a number of synthetic
+ * edicts clustered around a few hot spots, like projectiles,
+ * gibs and players in a deathmatch, and runs random box
+ * queries against the index and against a plain scan over all
+ * edicts. The synthetic edicts are removed afterwards.
+ */
+static unsigned sv_benchseed;
+
+static float
+SV_BenchRand(void)
+{
+	sv_benchseed = sv_benchseed * 1103515245 + 12345;
+
+	return (float)((sv_benchseed >> 8) & 0xffff) / 65535.0f;
+}
+
+static void
+SV_BenchPoint(const vec3_t *hotspots, vec3_t point)
+{
+	const float *mins, *maxs;
+	int i, spot;
+
+	mins = sv.models[1]->mins;
+	maxs = sv.models[1]->maxs;
+
+	if (SV_BenchRand() < 0.75f)
+	{
+		spot = (int)(SV_BenchRand() * 7.99f);
+
+		for (i = 0; i < 3; i++)
+		{
+			point[i] = hotspots[spot][i] + (SV_BenchRand() - 0.5f) * 512;
+			point[i] = Q_clamp(point[i], mins[i], maxs[i]);
+		}
+	}
+	else
+	{
+		for (i = 0; i < 3; i++)
+		{
+			point[i] = mins[i] + SV_BenchRand() * (maxs[i] - mins[i]);
+		}
+	}
+}
+
+static qboolean
+SV_BenchTouches(const edict_t *check, const vec3_t mins, const vec3_t maxs, int areatype)
+{
+	if (!check->area.prev || (check->solid == SOLID_NOT))
+	{
+		return false;
+	}
+
+	if ((check->solid == SOLID_TRIGGER) != (areatype == AREA_TRIGGERS))
+	{
+		return false;
+	}
+
+	return !((check->absmin[0] > maxs[0]) ||
+			(check->absmin[1] > maxs[1]) ||
+			(check->absmin[2] > maxs[2]) ||
+			(check->absmax[0] < mins[0]) ||
+			(check->absmax[1] < mins[1]) ||
+			(check->absmax[2] < mins[2]));
+}
+
+void
+SV_AreaBench_f(void)
+{
+	edict_t *list[MAX_EDICTS];
+	vec3_t hotspots[8];
+	vec3_t *qmins, *qmaxs;
+	edict_t *ent;
+	long long start, indextime, lineartime, linktime;
+	int numedicts, numqueries, numlinks;
+	int linearfound, lineartested;
+	int i, j, k, type;
+	float size;
+
+	if (sv.state != ss_game)
+	{
+		Com_Printf("No map loaded.\n");
+		return;
+	}
+
+	numedicts = (Cmd_Argc() > 1) ? (int)strtol(Cmd_Argv(1), NULL, 10) : 512;
+	numqueries = (Cmd_Argc() > 2) ? (int)strtol(Cmd_Argv(2), NULL, 10) : 10000;
+	numedicts = Q_clamp(numedicts, 1, MAX_EDICTS);
+	numqueries = Q_clamp(numqueries, 1, 1000000);
+
+	sv_benchseed = 1;
+
+	/* The middle of the map is usually busy. */
+	for (i = 0; i < 8; i++)
+	{
+		for (j = 0; j < 3; j++)
+		{
+			hotspots[i][j] = sv.models[1]->mins[j] + (i ? SV_BenchRand() : 0.5f) *
+				(sv.models[1]->maxs[j] - sv.models[1]->mins[j]);
+		}
+	}
+
+	sv_benchedicts = Z_Malloc(numedicts * sizeof(edict_t));
+	sv_benchareas = Z_Malloc(numedicts * sizeof(areanode_t *));
+	sv_numbenchedicts = numedicts;
+
+	/* Mostly projectiles and gibs, some players and a few items. */
+	for (i = 0; i < numedicts; i++)
+	{
+		ent = &sv_benchedicts[i];
+		ent->inuse = true;
+
+		k = (int)(SV_BenchRand() * 10);
+		size = (k < 6) ? 4 : ((k < 9) ? 16 : 32);
+		ent->solid = (k == 9) && (i & 1) ? SOLID_TRIGGER : SOLID_BBOX;
+
+		VectorSet(ent->mins, -size, -size, -size);
+		VectorSet(ent->maxs, size, size, size);
+		SV_BenchPoint(hotspots, ent->s.origin);
+	}
+
+	start = Sys_Microseconds();
+
+	for (i = 0; i < numedicts; i++)
+	{
+		SV_LinkEdict(&sv_benchedicts[i]);
+	}
+
+	/* Everything moves a bit each frame. */
+	for (j = 0; j < 10; j++)
+	{
+		for (i = 0; i < numedicts; i++)
+		{
+			ent = &sv_benchedicts[i];
+
+			for (k = 0; k < 3; k++)
+			{
+				ent->s.origin[k] += (SV_BenchRand() - 0.5f) * 64;
+			}
+
+			SV_LinkEdict(ent);
+		}
+	}
+
+	linktime = Sys_Microseconds() - start;
+	numlinks = numedicts * 11;
+
+	/* Trace sized boxes, most of them near the action. */
+	qmins = Z_Malloc(numqueries * sizeof(vec3_t));
+	qmaxs = Z_Malloc(numqueries * sizeof(vec3_t));
+
+	for (i = 0; i < numqueries; i++)
+	{
+		SV_BenchPoint(hotspots, qmins[i]);
+		size = 4 + SV_BenchRand() * 124;
+
+		for (k = 0; k < 3; k++)
+		{
+			qmaxs[i][k] = qmins[i][k] + size;
+			qmins[i][k] -= size;
+		}
+	}
+
+	memset(&sv_areastats, 0, sizeof(sv_areastats));
+	start = Sys_Microseconds();
+
+	for (i = 0; i < numqueries; i++)
+	{
+		type = (i % 5) ? AREA_SOLID : AREA_TRIGGERS;
+		SV_AreaEdicts(qmins[i], qmaxs[i], list, MAX_EDICTS, type);
+	}
+
+	indextime = Sys_Microseconds() - start;
+
+	linearfound = lineartested = 0;
+	start = Sys_Microseconds();
+
+	for (i = 0; i < numqueries; i++)
+	{
+		type = (i % 5) ? AREA_SOLID : AREA_TRIGGERS;
+
+		for (j = 1; j < ge->num_edicts; j++)
+		{
+			lineartested++;
+			linearfound += SV_BenchTouches(EDICT_NUM(j), qmins[i], qmaxs[i], type);
+		}
+
+		for (j = 0; j < numedicts; j++)
+		{
+			lineartested++;
+			linearfound += SV_BenchTouches(&sv_benchedicts[j], qmins[i], qmaxs[i], type);
+		}
+	}
+
+	lineartime = Sys_Microseconds() - start;
+
+	Com_Printf("areabench: %i edicts, %i queries, %i nodes in use\n",
+			numedicts + ge->num_edicts - 1, numqueries, sv_numareanodes);
+	Com_Printf("  link:   %lli usec for %i links\n", linktime, numlinks);
+	Com_Printf("  index:  %lli usec, %.1f nodes and %.1f edicts tested per query, %i found\n",
+			indextime, (float)sv_areastats.nodes / numqueries,
+			(float)sv_areastats.tested / numqueries, sv_areastats.found);
+	Com_Printf("  linear: %lli usec, %.1f edicts tested per query, %i found\n",
+			lineartime, (float)lineartested / numqueries, linearfound);
+
+	if (linearfound != sv_areastats.found)
+	{
+		Com_Printf("WARNING: index and linear scan disagree\n");
+	}
+
+	for (i = 0; i < numedicts; i++)
+	{
+		SV_UnlinkEdict(&sv_benchedicts[i]);
+	}
+
+	Z_Free(qmins);
+	Z_Free(qmaxs);
+	Z_Free(sv_benchedicts);
+	Z_Free(sv_benchareas);
+
+	sv_benchedicts = NULL;
+	sv_benchareas = NULL;
+	sv_numbenchedicts = 0;
+}